@@ -1,997 +1,6588 @@
 #include <GL/freeglut.h>
+#ifdef CPT205_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 #include <cmath>
 #include <vector>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <limits>
+#include <unordered_map>
+#include <filesystem>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cassert>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PARTICLE_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
 #define DEG2RAD 0.0174532925
 
-GLuint loadPPMTexture(const char* filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open PPM file: " << filename << std::endl;
-        return 0;
+// 编译期三角函数表：圆和椭圆的顶点只需查表再缩放平移，绘制时不再调用cos/sin
+// std::cos在C++17里不是constexpr，这里用泰勒级数自己算（角度在[-pi, pi]内，精度足够）
+constexpr double TABLE_PI = 3.14159265358979323846;
+
+constexpr double tableSin(double x) {
+    if (x > TABLE_PI) x -= 2 * TABLE_PI;  // 先把角度折回[-pi, pi]
+    double term = x, sum = x;
+    for (int n = 1; n < 12; n++) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
     }
+    return sum;
+}
 
-    std::string line;
-    std::getline(file, line);  // P6
-    if (line != "P6") {
-        std::cerr << "Not a valid PPM file: " << filename << std::endl;
-        return 0;
+constexpr double tableCos(double x) {
+    return tableSin(x + TABLE_PI / 2);
+}
+
+// 单位圆：每隔Step度一个点，最后一个点（360度）与第一个重合，方便画闭合的扇形
+template <int Step>
+struct UnitCircle {
+    static constexpr int SEGMENTS = 360 / Step;
+    float x[SEGMENTS + 1];
+    float y[SEGMENTS + 1];
+
+    constexpr UnitCircle() : x(), y() {
+        for (int i = 0; i <= SEGMENTS; i++) {
+            double angle = i * Step * TABLE_PI / 180;
+            x[i] = static_cast<float>(tableCos(angle));
+            y[i] = static_cast<float>(tableSin(angle));
+        }
+    }
+};
+
+constexpr UnitCircle<10> CIRCLE_10;  // 气球、高光、花蕊
+constexpr UnitCircle<45> CIRCLE_45;  // 花瓣（八边形）
+
+// OpenGL 1.5以上的函数需要在运行时获取（Windows的opengl32只导出1.1）
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_VERSION_1_5
+typedef ptrdiff_t GLintptr;
+typedef ptrdiff_t GLsizeiptr;
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_STREAM_DRAW 0x88E0
+#define GL_STATIC_DRAW 0x88E4
+#define GL_DYNAMIC_DRAW 0x88E8
+#endif
+#ifndef GL_VERSION_2_0
+typedef char GLchar;
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+#define GL_INFO_LOG_LENGTH 0x8B84
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+typedef struct __GLsync* GLsync;
+typedef unsigned long long GLuint64;
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_WAIT_FAILED 0x911D
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#define GL_READ_FRAMEBUFFER_BINDING 0x8CAA
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+typedef void (APIENTRY* GLGenBuffersFn)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY* GLDeleteBuffersFn)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRY* GLBindBufferFn)(GLenum target, GLuint buffer);
+typedef void (APIENTRY* GLBufferDataFn)(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+typedef void (APIENTRY* GLBufferSubDataFn)(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+typedef void (APIENTRY* GLBufferStorageFn)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void* (APIENTRY* GLMapBufferRangeFn)(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLsync (APIENTRY* GLFenceSyncFn)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRY* GLClientWaitSyncFn)(GLsync sync, GLbitfield flags, GLuint64 timeout);
+typedef void (APIENTRY* GLDeleteSyncFn)(GLsync sync);
+typedef GLuint (APIENTRY* GLCreateShaderFn)(GLenum type);
+typedef void (APIENTRY* GLShaderSourceFn)(GLuint shader, GLsizei count, const GLchar* const* source, const GLint* length);
+typedef void (APIENTRY* GLCompileShaderFn)(GLuint shader);
+typedef void (APIENTRY* GLGetShaderivFn)(GLuint shader, GLenum name, GLint* value);
+typedef void (APIENTRY* GLGetShaderInfoLogFn)(GLuint shader, GLsizei size, GLsizei* length, GLchar* log);
+typedef void (APIENTRY* GLDeleteShaderFn)(GLuint shader);
+typedef GLuint (APIENTRY* GLCreateProgramFn)();
+typedef void (APIENTRY* GLDeleteProgramFn)(GLuint program);
+typedef void (APIENTRY* GLAttachShaderFn)(GLuint program, GLuint shader);
+typedef void (APIENTRY* GLBindAttribLocationFn)(GLuint program, GLuint index, const GLchar* name);
+typedef void (APIENTRY* GLLinkProgramFn)(GLuint program);
+typedef void (APIENTRY* GLGetProgramivFn)(GLuint program, GLenum name, GLint* value);
+typedef void (APIENTRY* GLGetProgramInfoLogFn)(GLuint program, GLsizei size, GLsizei* length, GLchar* log);
+typedef void (APIENTRY* GLUseProgramFn)(GLuint program);
+typedef GLint (APIENTRY* GLGetAttribLocationFn)(GLuint program, const GLchar* name);
+typedef GLint (APIENTRY* GLGetUniformLocationFn)(GLuint program, const GLchar* name);
+typedef void (APIENTRY* GLUniform1fFn)(GLint location, GLfloat v0);
+typedef void (APIENTRY* GLUniform1iFn)(GLint location, GLint v0);
+typedef void (APIENTRY* GLUniform4fFn)(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+typedef void (APIENTRY* GLEnableVertexAttribArrayFn)(GLuint index);
+typedef void (APIENTRY* GLDisableVertexAttribArrayFn)(GLuint index);
+typedef void (APIENTRY* GLVertexAttribPointerFn)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+typedef void (APIENTRY* GLVertexAttribDivisorFn)(GLuint index, GLuint divisor);
+typedef void (APIENTRY* GLDrawArraysInstancedFn)(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+typedef void (APIENTRY* GLGenFramebuffersFn)(GLsizei n, GLuint* framebuffers);
+typedef void (APIENTRY* GLDeleteFramebuffersFn)(GLsizei n, const GLuint* framebuffers);
+typedef void (APIENTRY* GLBindFramebufferFn)(GLenum target, GLuint framebuffer);
+typedef void (APIENTRY* GLFramebufferTexture2DFn)(GLenum target, GLenum attachment, GLenum textureTarget, GLuint texture, GLint level);
+typedef GLenum (APIENTRY* GLCheckFramebufferStatusFn)(GLenum target);
+typedef void (APIENTRY* GLBlitFramebufferFn)(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0,
+                                             GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+typedef void (APIENTRY* GLBlendFuncSeparateFn)(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+typedef void (APIENTRY* GLCompressedTexImage2DFn)(GLenum target, GLint level, GLenum format, GLsizei width, GLsizei height,
+                                                  GLint border, GLsizei size, const void* data);
+
+GLGenBuffersFn glGenBuffersPtr = nullptr;
+GLDeleteBuffersFn glDeleteBuffersPtr = nullptr;
+GLBindBufferFn glBindBufferPtr = nullptr;
+GLBufferDataFn glBufferDataPtr = nullptr;
+GLBufferSubDataFn glBufferSubDataPtr = nullptr;
+GLBufferStorageFn glBufferStoragePtr = nullptr;
+GLMapBufferRangeFn glMapBufferRangePtr = nullptr;
+GLFenceSyncFn glFenceSyncPtr = nullptr;
+GLClientWaitSyncFn glClientWaitSyncPtr = nullptr;
+GLDeleteSyncFn glDeleteSyncPtr = nullptr;
+GLCreateShaderFn glCreateShaderPtr = nullptr;
+GLShaderSourceFn glShaderSourcePtr = nullptr;
+GLCompileShaderFn glCompileShaderPtr = nullptr;
+GLGetShaderivFn glGetShaderivPtr = nullptr;
+GLGetShaderInfoLogFn glGetShaderInfoLogPtr = nullptr;
+GLDeleteShaderFn glDeleteShaderPtr = nullptr;
+GLCreateProgramFn glCreateProgramPtr = nullptr;
+GLDeleteProgramFn glDeleteProgramPtr = nullptr;
+GLAttachShaderFn glAttachShaderPtr = nullptr;
+GLBindAttribLocationFn glBindAttribLocationPtr = nullptr;
+GLLinkProgramFn glLinkProgramPtr = nullptr;
+GLGetProgramivFn glGetProgramivPtr = nullptr;
+GLGetProgramInfoLogFn glGetProgramInfoLogPtr = nullptr;
+GLUseProgramFn glUseProgramPtr = nullptr;
+GLGetAttribLocationFn glGetAttribLocationPtr = nullptr;
+GLGetUniformLocationFn glGetUniformLocationPtr = nullptr;
+GLUniform1fFn glUniform1fPtr = nullptr;
+GLUniform1iFn glUniform1iPtr = nullptr;
+GLUniform4fFn glUniform4fPtr = nullptr;
+GLEnableVertexAttribArrayFn glEnableVertexAttribArrayPtr = nullptr;
+GLDisableVertexAttribArrayFn glDisableVertexAttribArrayPtr = nullptr;
+GLVertexAttribPointerFn glVertexAttribPointerPtr = nullptr;
+GLVertexAttribDivisorFn glVertexAttribDivisorPtr = nullptr;
+GLDrawArraysInstancedFn glDrawArraysInstancedPtr = nullptr;
+GLGenFramebuffersFn glGenFramebuffersPtr = nullptr;  // 帧缓冲对象，不支持时为空
+GLDeleteFramebuffersFn glDeleteFramebuffersPtr = nullptr;
+GLBindFramebufferFn glBindFramebufferPtr = nullptr;
+GLFramebufferTexture2DFn glFramebufferTexture2DPtr = nullptr;
+GLCheckFramebufferStatusFn glCheckFramebufferStatusPtr = nullptr;
+GLBlitFramebufferFn glBlitFramebufferPtr = nullptr;  // 帧缓冲之间直接复制像素，不支持时为空
+GLBlendFuncSeparateFn glBlendFuncSeparatePtr = nullptr;  // 颜色和alpha分别混合（1.4起），不支持时为空
+GLCompressedTexImage2DFn glCompressedTexImage2DPtr = nullptr;  // 只在支持S3TC时加载
+
+void* getGLProcAddress(const char* name) {
+#ifdef CPT205_HEADLESS
+    return reinterpret_cast<void*>(eglGetProcAddress(name));
+#else
+    return reinterpret_cast<void*>(glutGetProcAddress(name));
+#endif
+}
+
+bool hasGLExtension(const char* name) {
+    const char* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+    if (extensions == nullptr) return false;
+    std::string list = std::string(" ") + extensions + " ";
+    return list.find(std::string(" ") + name + " ") != std::string::npos;
+}
+
+// 当前上下文的OpenGL版本是否不低于 major.minor
+bool hasGLVersion(int major, int minor) {
+    const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    int actualMajor = 0, actualMinor = 0;
+    if (version == nullptr || sscanf(version, "%d.%d", &actualMajor, &actualMinor) != 2) return false;
+    return actualMajor > major || (actualMajor == major && actualMinor >= minor);
+}
+
+// 需要在创建GL上下文之后调用
+void loadGLFunctions() {
+    glGenBuffersPtr = reinterpret_cast<GLGenBuffersFn>(getGLProcAddress("glGenBuffers"));
+    glDeleteBuffersPtr = reinterpret_cast<GLDeleteBuffersFn>(getGLProcAddress("glDeleteBuffers"));
+    glBindBufferPtr = reinterpret_cast<GLBindBufferFn>(getGLProcAddress("glBindBuffer"));
+    glBufferDataPtr = reinterpret_cast<GLBufferDataFn>(getGLProcAddress("glBufferData"));
+    glBufferSubDataPtr = reinterpret_cast<GLBufferSubDataFn>(getGLProcAddress("glBufferSubData"));
+    if (hasGLVersion(4, 4) || hasGLExtension("GL_ARB_buffer_storage")) {
+        glBufferStoragePtr = reinterpret_cast<GLBufferStorageFn>(getGLProcAddress("glBufferStorage"));
+    }
+    if (hasGLVersion(3, 0) || hasGLExtension("GL_ARB_map_buffer_range")) {
+        glMapBufferRangePtr = reinterpret_cast<GLMapBufferRangeFn>(getGLProcAddress("glMapBufferRange"));
+    }
+    if (hasGLVersion(3, 2) || hasGLExtension("GL_ARB_sync")) {
+        glFenceSyncPtr = reinterpret_cast<GLFenceSyncFn>(getGLProcAddress("glFenceSync"));
+        glClientWaitSyncPtr = reinterpret_cast<GLClientWaitSyncFn>(getGLProcAddress("glClientWaitSync"));
+        glDeleteSyncPtr = reinterpret_cast<GLDeleteSyncFn>(getGLProcAddress("glDeleteSync"));
+    }
+    if (hasGLVersion(1, 4)) {
+        glBlendFuncSeparatePtr = reinterpret_cast<GLBlendFuncSeparateFn>(getGLProcAddress("glBlendFuncSeparate"));
+    }
+    if (hasGLVersion(2, 0)) {
+        glCreateShaderPtr = reinterpret_cast<GLCreateShaderFn>(getGLProcAddress("glCreateShader"));
+        glShaderSourcePtr = reinterpret_cast<GLShaderSourceFn>(getGLProcAddress("glShaderSource"));
+        glCompileShaderPtr = reinterpret_cast<GLCompileShaderFn>(getGLProcAddress("glCompileShader"));
+        glGetShaderivPtr = reinterpret_cast<GLGetShaderivFn>(getGLProcAddress("glGetShaderiv"));
+        glGetShaderInfoLogPtr = reinterpret_cast<GLGetShaderInfoLogFn>(getGLProcAddress("glGetShaderInfoLog"));
+        glDeleteShaderPtr = reinterpret_cast<GLDeleteShaderFn>(getGLProcAddress("glDeleteShader"));
+        glCreateProgramPtr = reinterpret_cast<GLCreateProgramFn>(getGLProcAddress("glCreateProgram"));
+        glDeleteProgramPtr = reinterpret_cast<GLDeleteProgramFn>(getGLProcAddress("glDeleteProgram"));
+        glAttachShaderPtr = reinterpret_cast<GLAttachShaderFn>(getGLProcAddress("glAttachShader"));
+        glBindAttribLocationPtr = reinterpret_cast<GLBindAttribLocationFn>(getGLProcAddress("glBindAttribLocation"));
+        glLinkProgramPtr = reinterpret_cast<GLLinkProgramFn>(getGLProcAddress("glLinkProgram"));
+        glGetProgramivPtr = reinterpret_cast<GLGetProgramivFn>(getGLProcAddress("glGetProgramiv"));
+        glGetProgramInfoLogPtr = reinterpret_cast<GLGetProgramInfoLogFn>(getGLProcAddress("glGetProgramInfoLog"));
+        glUseProgramPtr = reinterpret_cast<GLUseProgramFn>(getGLProcAddress("glUseProgram"));
+        glGetAttribLocationPtr = reinterpret_cast<GLGetAttribLocationFn>(getGLProcAddress("glGetAttribLocation"));
+        glGetUniformLocationPtr = reinterpret_cast<GLGetUniformLocationFn>(getGLProcAddress("glGetUniformLocation"));
+        glUniform1fPtr = reinterpret_cast<GLUniform1fFn>(getGLProcAddress("glUniform1f"));
+        glUniform1iPtr = reinterpret_cast<GLUniform1iFn>(getGLProcAddress("glUniform1i"));
+        glUniform4fPtr = reinterpret_cast<GLUniform4fFn>(getGLProcAddress("glUniform4f"));
+        glEnableVertexAttribArrayPtr = reinterpret_cast<GLEnableVertexAttribArrayFn>(getGLProcAddress("glEnableVertexAttribArray"));
+        glDisableVertexAttribArrayPtr = reinterpret_cast<GLDisableVertexAttribArrayFn>(getGLProcAddress("glDisableVertexAttribArray"));
+        glVertexAttribPointerPtr = reinterpret_cast<GLVertexAttribPointerFn>(getGLProcAddress("glVertexAttribPointer"));
     }
+    if (hasGLVersion(3, 3)) {
+        glVertexAttribDivisorPtr = reinterpret_cast<GLVertexAttribDivisorFn>(getGLProcAddress("glVertexAttribDivisor"));
+        glDrawArraysInstancedPtr = reinterpret_cast<GLDrawArraysInstancedFn>(getGLProcAddress("glDrawArraysInstanced"));
+    } else if (hasGLExtension("GL_ARB_instanced_arrays") && hasGLExtension("GL_ARB_draw_instanced")) {
+        glVertexAttribDivisorPtr = reinterpret_cast<GLVertexAttribDivisorFn>(getGLProcAddress("glVertexAttribDivisorARB"));
+        glDrawArraysInstancedPtr = reinterpret_cast<GLDrawArraysInstancedFn>(getGLProcAddress("glDrawArraysInstancedARB"));
+    }
+    // EXT版本的函数签名和常量与核心版本相同
+    const char* framebufferSuffix = hasGLVersion(3, 0) || hasGLExtension("GL_ARB_framebuffer_object") ? ""
+                                    : hasGLExtension("GL_EXT_framebuffer_object") ? "EXT" : nullptr;
+    if (framebufferSuffix != nullptr) {
+        std::string suffix = framebufferSuffix;
+        glGenFramebuffersPtr = reinterpret_cast<GLGenFramebuffersFn>(getGLProcAddress(("glGenFramebuffers" + suffix).c_str()));
+        glDeleteFramebuffersPtr = reinterpret_cast<GLDeleteFramebuffersFn>(getGLProcAddress(("glDeleteFramebuffers" + suffix).c_str()));
+        glBindFramebufferPtr = reinterpret_cast<GLBindFramebufferFn>(getGLProcAddress(("glBindFramebuffer" + suffix).c_str()));
+        glFramebufferTexture2DPtr = reinterpret_cast<GLFramebufferTexture2DFn>(getGLProcAddress(("glFramebufferTexture2D" + suffix).c_str()));
+        glCheckFramebufferStatusPtr = reinterpret_cast<GLCheckFramebufferStatusFn>(getGLProcAddress(("glCheckFramebufferStatus" + suffix).c_str()));
+        if (suffix.empty() || hasGLExtension("GL_EXT_framebuffer_blit")) {
+            glBlitFramebufferPtr = reinterpret_cast<GLBlitFramebufferFn>(getGLProcAddress(("glBlitFramebuffer" + suffix).c_str()));
+        }
+    }
+    if (hasGLVersion(1, 3) && hasGLExtension("GL_EXT_texture_compression_s3tc")) {
+        glCompressedTexImage2DPtr = reinterpret_cast<GLCompressedTexImage2DFn>(getGLProcAddress("glCompressedTexImage2D"));
+    }
+    if (!hasGLVersion(1, 5)) {
+        glGenBuffersPtr = nullptr;  // 没有VBO时退回客户端顶点数组
+    }
+}
 
-    // Skip comments
-    while (std::getline(file, line) && line[0] == '#');
+// 编译着色器程序，失败时打印日志、释放已创建的对象并返回0；positionAttribute 固定绑定到属性0（为空时着色器用内置的gl_Vertex）
+GLuint compileProgram(const char* vertexSource, const char* fragmentSource, const char* positionAttribute) {
+    if (glCreateShaderPtr == nullptr) return 0;
+    const char* sources[2] = {vertexSource, fragmentSource};
+    const GLenum types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    GLuint program = glCreateProgramPtr();
+    for (int i = 0; i < 2; i++) {
+        GLuint shader = glCreateShaderPtr(types[i]);
+        glShaderSourcePtr(shader, 1, &sources[i], nullptr);
+        glCompileShaderPtr(shader);
+        GLint ok = 0;
+        glGetShaderivPtr(shader, GL_COMPILE_STATUS, &ok);
+        if (!ok) {
+            char log[1024];
+            glGetShaderInfoLogPtr(shader, sizeof(log), nullptr, log);
+            std::cerr << "Failed to compile shader: " << log << std::endl;
+            glDeleteShaderPtr(shader);
+            glDeleteProgramPtr(program);  // 已附加的着色器随程序一起释放
+            return 0;
+        }
+        glAttachShaderPtr(program, shader);
+        glDeleteShaderPtr(shader);
+    }
+    if (positionAttribute != nullptr) glBindAttribLocationPtr(program, 0, positionAttribute);
+    glLinkProgramPtr(program);
+    GLint ok = 0;
+    glGetProgramivPtr(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLogPtr(program, sizeof(log), nullptr, log);
+        std::cerr << "Failed to link shader program: " << log << std::endl;
+        glDeleteProgramPtr(program);
+        return 0;
+    }
+    return program;
+}
 
-    std::stringstream dimensions(line);
+// 位图字体里一个字符的位图，参数与glBitmap相同
+struct BitmapGlyph {
     int width, height;
-    dimensions >> width >> height;
+    float xorig, yorig, advance;
+    const GLubyte* bits;  // 自下而上，每行按字节补齐，高位在左
+};
+
+// 窗口系统相关的调用都经过这里。无窗口模式（CPT205_HEADLESS，见headless.cpp）不调用glutInit，
+// 时间由帧号决定，文字直接用freeglut导出的字体表绘制
+#ifndef CPT205_HEADLESS
+double elapsedSeconds() {
+    return glutGet(GLUT_ELAPSED_TIME) / 1000.0;
+}
+
+void presentFrame() {
+    glutSwapBuffers();
+}
+
+// 交换缓冲之后后缓冲的内容不确定
+bool presentKeepsFrame() {
+    return false;
+}
+
+void requestRedisplay() {
+    glutPostRedisplay();
+}
+
+void scheduleTimer(unsigned int milliseconds, void (*callback)(int)) {
+    glutTimerFunc(milliseconds, callback, 0);
+}
+
+void textBitmapCharacter(void* font, int c) {
+    glutBitmapCharacter(font, c);
+}
+
+int textBitmapWidth(void* font, int c) {
+    return glutBitmapWidth(font, c);
+}
+
+int textBitmapLength(void* font, const char* text) {
+    return glutBitmapLength(font, reinterpret_cast<const unsigned char*>(text));
+}
+
+int textBitmapHeight(void* font) {
+    return glutBitmapHeight(font);
+}
+
+void textStrokeCharacter(void* font, int c) {
+    glutStrokeCharacter(font, c);
+}
+
+int textStrokeLength(void* font, const char* text) {
+    return glutStrokeLength(font, reinterpret_cast<const unsigned char*>(text));
+}
+
+// 软件光栅化要直接读字体表，GLUT的接口读不到，窗口模式下没有
+bool textBitmapGlyph(void*, int, BitmapGlyph&) {
+    return false;
+}
+
+float textStrokeGlyph(void*, int, const std::function<void(const float*, int)>&) {
+    return 0;
+}
+#else
+double headlessSeconds = 0.0;  // 由headless.cpp按帧号设置
+
+double elapsedSeconds() {
+    return headlessSeconds;
+}
+
+void presentFrame() {}  // 离屏表面不需要交换，像素由headless.cpp读取
+
+bool presentKeepsFrame() {
+    return true;
+}
+
+void requestRedisplay() {}
+
+void scheduleTimer(unsigned int, void (*)(int)) {}
+
+// freeglut内部的字体结构，Linux上的libglut把这些字体表作为数据符号导出
+struct SFG_Font {
+    const char* Name;
+    int Quantity;
+    int Height;
+    const GLubyte** Characters;
+    float xorig, yorig;
+};
+struct SFG_StrokeVertex {
+    GLfloat X, Y;
+};
+struct SFG_StrokeStrip {
+    int Number;
+    const SFG_StrokeVertex* Vertices;
+};
+struct SFG_StrokeChar {
+    GLfloat Right;
+    int Number;
+    const SFG_StrokeStrip* Strips;
+};
+struct SFG_StrokeFont {
+    const char* Name;
+    int Quantity;
+    GLfloat Height;
+    const SFG_StrokeChar** Characters;
+};
+extern "C" SFG_Font fgFontHelvetica10, fgFontHelvetica18;
+extern "C" SFG_StrokeFont fgStrokeRoman;
+
+// 场景只用到这三种字体
+const SFG_Font* bitmapFont(void* font) {
+    return font == GLUT_BITMAP_HELVETICA_18 ? &fgFontHelvetica18 : &fgFontHelvetica10;
+}
+
+bool textBitmapGlyph(void* font, int c, BitmapGlyph& glyph) {
+    const SFG_Font* f = bitmapFont(font);
+    if (c < 1 || c >= f->Quantity) return false;
+    const GLubyte* face = f->Characters[c];
+    glyph = {face[0], f->Height, f->xorig, f->yorig, static_cast<float>(face[0]), face + 1};
+    return true;
+}
+
+// 与glutBitmapCharacter相同：按字体表里的位图调用glBitmap，并把光栅位置右移字宽
+void textBitmapCharacter(void* font, int c) {
+    BitmapGlyph glyph;
+    if (!textBitmapGlyph(font, c, glyph)) return;
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+    glPixelStorei(GL_UNPACK_LSB_FIRST, GL_FALSE);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBitmap(glyph.width, glyph.height, glyph.xorig, glyph.yorig, glyph.advance, 0.0f, glyph.bits);
+    glPopClientAttrib();
+}
+
+int textBitmapWidth(void* font, int c) {
+    const SFG_Font* f = bitmapFont(font);
+    if (c < 1 || c >= f->Quantity) return 0;
+    return f->Characters[c][0];
+}
+
+int textBitmapHeight(void* font) {
+    return bitmapFont(font)->Height;
+}
+
+// 多行文字取最长的一行
+int textBitmapLength(void* font, const char* text) {
+    int length = 0, line = 0;
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            length = std::max(length, line);
+            line = 0;
+        } else {
+            line += textBitmapWidth(font, static_cast<unsigned char>(*c));
+        }
+    }
+    return std::max(length, line);
+}
+
+// 对字符的每个笔画调用一次strip（折线的顶点按x、y交错存放），返回字宽
+float textStrokeGlyph(void*, int c, const std::function<void(const float*, int)>& strip) {
+    if (c < 0 || c >= fgStrokeRoman.Quantity || fgStrokeRoman.Characters[c] == nullptr) return 0;
+    const SFG_StrokeChar* character = fgStrokeRoman.Characters[c];
+    for (int i = 0; i < character->Number; i++) {
+        strip(&character->Strips[i].Vertices[0].X, character->Strips[i].Number);
+    }
+    return character->Right;
+}
+
+// 与glutStrokeCharacter相同：每个笔画画成一条折线，然后平移到下一个字符
+void textStrokeCharacter(void* font, int c) {
+    float advance = textStrokeGlyph(font, c, [](const float* points, int count) {
+        glBegin(GL_LINE_STRIP);
+        for (int j = 0; j < count; j++) {
+            glVertex2f(points[2 * j], points[2 * j + 1]);
+        }
+        glEnd();
+    });
+    glTranslatef(advance, 0.0f, 0.0f);
+}
+
+int textStrokeLength(void*, const char* text) {
+    float length = 0, line = 0;
+    for (const char* c = text; *c != '\0'; c++) {
+        unsigned char ch = static_cast<unsigned char>(*c);
+        if (ch == '\n') {
+            length = std::max(length, line);
+            line = 0;
+        } else if (ch < fgStrokeRoman.Quantity && fgStrokeRoman.Characters[ch] != nullptr) {
+            line += fgStrokeRoman.Characters[ch]->Right;
+        }
+    }
+    return static_cast<int>(std::max(length, line) + 0.5f);
+}
+
+// 创建离屏的pbuffer上下文；优先用surfaceless平台，不需要任何显示服务器
+bool createHeadlessContext(int width, int height) {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay != nullptr) {
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "Failed to initialise EGL" << std::endl;
+        return false;
+    }
+
+    const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+            EGL_DEPTH_SIZE, 16,
+            EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+        std::cerr << "No suitable EGL config" << std::endl;
+        return false;
+    }
+    const EGLint surfaceAttributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+    if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context)) {
+        std::cerr << "Failed to create an offscreen GL context" << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
+
+// 只读映射整个文件：头部和像素都直接在映射的内存里读取，不经过中间缓冲
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept {
+        swap(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        close();
+        swap(other);
+        return *this;
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const char* filename) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (view == nullptr) {
+            close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(view);
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        void* view = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);  // 映射建立后文件描述符就不需要了
+        if (view == MAP_FAILED) return false;
+        bytes = static_cast<const unsigned char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes != nullptr) UnmapViewOfFile(bytes);
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes != nullptr) munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    // 提示系统提前把文件读进页缓存，之后复制像素时不会因缺页而阻塞
+    void prefetch() const {
+#ifndef _WIN32
+        if (bytes != nullptr) madvise(const_cast<unsigned char*>(bytes), length, MADV_WILLNEED);
+#endif
+    }
+
+    const unsigned char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    void swap(MappedFile& other) {
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+#ifdef _WIN32
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+#endif
+    }
+};
+
+struct PPMImage {
+    int width = 0, height = 0;
+    const unsigned char* pixels = nullptr;  // 指向映射内存中的像素，不拥有
+};
+
+// 在内存里解析P6头：魔数、宽、高、最大值，中间可以有空白和注释
+bool parsePPMHeader(const unsigned char* data, size_t size, PPMImage& image) {
+    size_t pos = 2;
+    auto skipSpace = [&]() {
+        while (pos < size && (isspace(data[pos]) || data[pos] == '#')) {
+            if (data[pos] == '#') {
+                while (pos < size && data[pos] != '\n') pos++;
+            } else {
+                pos++;
+            }
+        }
+    };
+    auto readNumber = [&](int& value) {
+        skipSpace();
+        if (pos >= size || !isdigit(data[pos])) return false;
+        value = 0;
+        while (pos < size && isdigit(data[pos]) && value < 65536) {
+            value = value * 10 + (data[pos++] - '0');
+        }
+        return value > 0 && value < 65536;
+    };
+
+    int maxColor = 0;
+    if (size < 2 || data[0] != 'P' || data[1] != '6') return false;
+    if (!readNumber(image.width) || !readNumber(image.height) || !readNumber(maxColor) || maxColor > 255) return false;
+    pos++;  // 最大值后面正好是一个空白字符
+    if (pos > size || size - pos < static_cast<size_t>(image.width) * image.height * 3) return false;
+    image.pixels = data + pos;
+    return true;
+}
 
-    std::getline(file, line);  // Max color value, usually 255
-    int maxColor = std::stoi(line);
+void setTextureFilters() {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
 
-    std::vector<unsigned char> data(width * height * 3);
-    file.read(reinterpret_cast<char*>(data.data()), data.size());
+// 同步加载：像素直接从映射的内存交给glTexImage2D，没有额外的复制
+GLuint loadPPMTexture(const char* filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Failed to open PPM file: " << filename << std::endl;
+        return 0;
+    }
+    PPMImage image;
+    if (!parsePPMHeader(file.data(), file.size(), image)) {
+        std::cerr << "Not a valid PPM file: " << filename << std::endl;
+        return 0;
+    }
 
     GLuint textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_2D, textureID);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data.data());
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);  // PPM的行没有对齐
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+    glPopClientAttrib();
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    setTextureFilters();
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
     return textureID;
 }
-const int WINDOW_WIDTH = 600;
-const int WINDOW_HEIGHT = 800;
-float skyColor = 0.4;  // 初始化浅蓝色天空
-float bannerYOffset = -100;  // 初始牌子与气球的相对位置
-float zoomFactor = 1.0f;
-float targetX = WINDOW_WIDTH / 2;
-float targetY = WINDOW_HEIGHT / 2;
-char text[2000] = "XJTLU Graduation Ceremony 2024\n"
-                  "Dear All,\n"
-                  "    We are delighted to invite you to join us in celebrating the outstanding achievements of our graduating class at Xi'an Jiaotong-Liverpool University.\n"
-                  "\n"
-                  "Event Details:"
-                  "Details:\n"
-                  "Date: [June 10, 2024]\n"
-                  "Time: [10:00 AM]\n"
-                  "Venue: [XJTLU Central Auditorium]\n"
-                  "Please RSVP by [June 1, 2024].\n"
-                  "Warm Regards,\n"
-                  "Xi'an Jiaotong-Liverpool University";  // 信纸上的文字
-int frameCounter = 0;  // 计数器来跟踪经过的帧数
-bool windowsVisible = true;
-bool windowsActivated = false;
-//bool flowersDrawn = false;
-bool balloonsFlying = false;
-bool fireworksStarted = false;
-bool timerStarted = false;
 
+// 异步加载：request只映射文件、解析头并分配纹理，立即返回；像素在之后每帧的pump里
+// 按字节预算分块经像素缓冲对象（PBO）上传，驱动在后台传输，启动和单帧都不会被大图卡住
+class TextureUploader {
+public:
+    static const size_t BYTES_PER_FRAME = 4 * 1024 * 1024;
 
-struct Particle {
-    float x, y;  // 粒子的位置
-    float vx, vy;  // 粒子的速度
-    float life;  // 粒子的生命周期
-    float r, g, b;  // 粒子的颜色
-};
-class Firework {
-private:
-    float x, y;  // 烟花的起始位置
-    std::vector<Particle> particles;  // 烟花的粒子
-    float alpha = 1;  // 烟花的透明度
+    GLuint request(const char* filename) {
+        Upload upload;
+        if (!upload.file.open(filename)) {
+            std::cerr << "Failed to open PPM file: " << filename << std::endl;
+            return 0;
+        }
+        if (!parsePPMHeader(upload.file.data(), upload.file.size(), upload.image)) {
+            std::cerr << "Not a valid PPM file: " << filename << std::endl;
+            return 0;
+        }
+        upload.file.prefetch();
+        if (!checked) {
+            checked = true;
+            usePixelBuffer = glBindBufferPtr != nullptr && (hasGLVersion(2, 1) || hasGLExtension("GL_ARB_pixel_buffer_object"));
+        }
 
-public:
-    Firework() {
-        init();
+        glGenTextures(1, &upload.texture);
+        glBindTexture(GL_TEXTURE_2D, upload.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, upload.image.width, upload.image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        setTextureFilters();
+        glBindTexture(GL_TEXTURE_2D, 0);
+        GLuint texture = upload.texture;
+        pending.push_back(std::move(upload));
+        return texture;
     }
 
-    void init() {
-        x = static_cast<float>(rand() % WINDOW_WIDTH);
-        y = static_cast<float>(500 + rand() % 300);
-        alpha = 1.0;
-        int numParticles = 100 + rand() % 100;  // 生成100到200个粒子
-        for (int i = 0; i < numParticles; i++) {
-            float speed = static_cast<float>(rand() % 100 + 100) / 100.0;  // 速度范围：1到2
-            float angle = static_cast<float>(rand() % 360) * 3.142 / 180.0;  // 随机方向
-            Particle particle = {
-                    x, y,
-                    speed * cos(angle), speed * sin(angle),
-                    2.0,  // 初始生命周期为2
-                    static_cast<float>(rand()) / RAND_MAX,
-                    static_cast<float>(rand()) / RAND_MAX,
-                    static_cast<float>(rand()) / RAND_MAX
-            };
-            particles.push_back(particle);
-        }
+    // 这张纹理没有未完成的上传，request返回的纹理此时所有像素都已传到GPU。
+    // 只看尚未完成的请求，纹理删除后名字被新的请求复用也不会误报
+    bool ready(GLuint texture) const {
+        return std::none_of(pending.begin(), pending.end(), [texture](const Upload& upload) { return upload.texture == texture; });
     }
 
-    void update() {
-        for (auto& particle : particles) {
-            particle.x += particle.vx;
-            particle.y += particle.vy;
-            particle.life -= 0.01;  // 减少生命周期
-            if (particle.life < 0) particle.life = 0;
+    bool busy() const {
+        return !pending.empty();
+    }
+
+    // 每帧调用一次：上传最多budget字节的像素，再收回已经传完的纹理
+    void pump(size_t budget = BYTES_PER_FRAME) {
+        if (pending.empty()) return;
+        glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (Upload& upload : pending) {
+            if (budget == 0) break;
+            size_t rowBytes = static_cast<size_t>(upload.image.width) * 3;
+            glBindTexture(GL_TEXTURE_2D, upload.texture);
+            while (budget > 0 && upload.nextRow < upload.image.height) {
+                int rows = static_cast<int>(std::min<size_t>(upload.image.height - upload.nextRow, std::max<size_t>(1, budget / rowBytes)));
+                const unsigned char* source = upload.image.pixels + upload.nextRow * rowBytes;
+                uploadRows(upload, rows, source, rows * rowBytes);
+                upload.nextRow += rows;
+                budget -= std::min(budget, rows * rowBytes);
+            }
+            if (upload.nextRow == upload.image.height && upload.fence == nullptr && glFenceSyncPtr != nullptr) {
+                upload.fence = glFenceSyncPtr(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
         }
-        alpha -= 0.01;  // 减少烟花的透明度
-        if (alpha <= 0) {
-            particles.clear();
-            init();
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPopClientAttrib();
+        retire(false);
+    }
+
+    // 把剩下的全部上传完并等待完成（工具和性能测试使用）
+    void finish() {
+        while (busy()) {
+            pump(static_cast<size_t>(-1));
+            retire(true);
         }
     }
 
-    void draw() const {
-        glPointSize(3.0);
-        for (const auto& particle : particles) {
-            glColor4f(particle.r, particle.g, particle.b, alpha * particle.life);  // 使用透明度
-            glBegin(GL_POINTS);
-            glVertex2f(particle.x, particle.y);
-            glEnd();
+private:
+    struct Upload {
+        MappedFile file;
+        PPMImage image;
+        GLuint texture = 0;
+        int nextRow = 0;
+        GLsync fence = nullptr;
+    };
+
+    std::deque<Upload> pending;
+    GLuint pixelBuffer = 0;
+    bool checked = false;
+    bool usePixelBuffer = false;
+
+    void uploadRows(const Upload& upload, int rows, const unsigned char* source, size_t bytes) {
+        if (!usePixelBuffer) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.nextRow, upload.image.width, rows, GL_RGB, GL_UNSIGNED_BYTE, source);
+            return;
         }
+        if (pixelBuffer == 0) glGenBuffersPtr(1, &pixelBuffer);
+        // 每块重新指定数据：驱动从映射的文件复制一次，旧的缓冲由驱动回收，不用等上一块传完
+        glBindBufferPtr(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+        glBufferDataPtr(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(bytes), source, GL_STREAM_DRAW);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.nextRow, upload.image.width, rows, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        glBindBufferPtr(GL_PIXEL_UNPACK_BUFFER, 0);
     }
 
-    bool isFadedOut() const {
-        return alpha <= 0;
+    // 按提交顺序收回传完的纹理；没有同步对象时提交完就算完成（GL命令本身是有序的）
+    void retire(bool wait) {
+        while (!pending.empty()) {
+            Upload& upload = pending.front();
+            if (upload.nextRow < upload.image.height) return;
+            if (upload.fence != nullptr) {
+                GLenum status = glClientWaitSyncPtr(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+                if (status == GL_TIMEOUT_EXPIRED) return;
+                glDeleteSyncPtr(upload.fence);
+            }
+            pending.pop_front();
+        }
     }
 };
+TextureUploader textureUploader;
 
-struct Leaf {
-    float x, y;  // 叶子的位置
-    float width, height;  // 叶子的大小
-    float r, g, b;  // 叶子的颜色
+// 纹理中的一块区域：独立纹理时是整张(0,0)-(1,1)，图集中是子矩形
+struct TextureRegion {
+    GLuint texture = 0;
+    float u0 = 0, v0 = 0, u1 = 1, v1 = 1;
+    int width = 0, height = 0;
 };
-class Tree {
-private:
-    int x, y;
-    std::vector<Leaf> leaves;
 
+// 天际线矩形装箱：记录每一段已用到的高度，新矩形放在顶端最低、其次最窄的位置
+class SkylinePacker {
 public:
-    Tree(int x, int y) : x(x), y(y) {
-        generateLeaves();
+    SkylinePacker(int width, int height) : width(width), height(height), skyline{{0, 0, width}} {}
+
+    bool insert(int w, int h, int& outX, int& outY) {
+        size_t best = skyline.size();
+        int bestTop = height + 1, bestWidth = width + 1, bestY = 0;
+        for (size_t i = 0; i < skyline.size(); i++) {
+            int y = fit(i, w, h);
+            if (y < 0) continue;
+            if (y + h < bestTop || (y + h == bestTop && skyline[i].width < bestWidth)) {
+                best = i;
+                bestTop = y + h;
+                bestWidth = skyline[i].width;
+                bestY = y;
+            }
+        }
+        if (best == skyline.size()) return false;
+        outX = skyline[best].x;
+        outY = bestY;
+        place(best, outX, bestTop, w);
+        return true;
     }
 
-    void generateLeaves() {
-        int numLeaves = 100 + rand() % 10;  // 生成50到100片叶子
-        for (int i = 0; i < numLeaves; i++) {
-            float leafX = x + static_cast<float>(rand() % 100 - 50);  // 叶子的x坐标在树干的左右50像素内
-            float leafY = y + static_cast<float>(rand() % 200);  // 叶子的y坐标在树干的上方200像素内
-            float leafWidth = static_cast<float>(rand() % 10 + 5);  // 叶子的宽度在5到15像素之间
-            float leafHeight = static_cast<float>(rand() % 10 + 5);  // 叶子的高度在5到15像素之间
-            Leaf leaf = {
-                    leafX, leafY,
-                    leafWidth, leafHeight,
-                    0.0, static_cast<float>(rand()) / RAND_MAX, 0.0  // 叶子的颜色为随机的绿色
-            };
-            leaves.push_back(leaf);
+private:
+    struct Segment { int x, y, width; };
+    int width, height;
+    std::vector<Segment> skyline;
+
+    // 从第index段开始放宽w的矩形，返回它的底边高度；放不下返回-1
+    int fit(size_t index, int w, int h) const {
+        int x = skyline[index].x;
+        if (x + w > width) return -1;
+        int y = 0;
+        for (size_t i = index; x + w > skyline[i].x; i++) {
+            y = std::max(y, skyline[i].y);
+            if (i + 1 == skyline.size()) break;
         }
+        return y + h <= height ? y : -1;
     }
 
-    void draw() const {
-//        std::cout << "Drawing a tree at position (" << x << ", " << y << ")" << std::endl;
-        // 绘制树干
-        glColor3f(0.5, 0.35, 0.05);  // 棕色
-        glBegin(GL_QUADS);
-        glVertex2i(x - 10, y);
-        glVertex2i(x + 10, y);
-        glVertex2i(x + 10, y + 200);
-        glVertex2i(x - 10, y + 200);
-        glEnd();
+    // 插入新的一段，截掉被它盖住的部分，再合并等高的相邻段
+    void place(size_t index, int x, int top, int w) {
+        skyline.insert(skyline.begin() + index, {x, top, w});
+        size_t i = index + 1;
+        while (i < skyline.size() && skyline[i].x < x + w) {
+            int shrink = x + w - skyline[i].x;
+            if (shrink < skyline[i].width) {
+                skyline[i].x += shrink;
+                skyline[i].width -= shrink;
+                break;
+            }
+            skyline.erase(skyline.begin() + i);
+        }
+        for (size_t j = 0; j + 1 < skyline.size(); ) {
+            if (skyline[j].y == skyline[j + 1].y) {
+                skyline[j].width += skyline[j + 1].width;
+                skyline.erase(skyline.begin() + j + 1);
+            } else {
+                j++;
+            }
+        }
+    }
+};
 
-        // 绘制叶子
-        for (const Leaf& leaf : leaves) {
-            glColor3f(leaf.r, leaf.g, leaf.b);
-            glBegin(GL_QUADS);
-            glVertex2f(leaf.x - leaf.width / 2, leaf.y - leaf.height / 2);
-            glVertex2f(leaf.x + leaf.width / 2, leaf.y - leaf.height / 2);
-            glVertex2f(leaf.x + leaf.width / 2, leaf.y + leaf.height / 2);
-            glVertex2f(leaf.x - leaf.width / 2, leaf.y + leaf.height / 2);
-            glEnd();
+// 纹理缓存：同一路径只加载一次，内容相同的不同文件共用同一块区域；
+// 小图装进共享的图集，同一图集里的图片可以在一个批次里用一次绑定画完
+class TextureCache {
+public:
+    static const int ATLAS_SIZE = 1024;
+    static const int MAX_ATLAS_IMAGE = 256;  // 超过这个尺寸的图片单独成一张纹理
+    static const int PADDING = 1;  // 每块四周复制一圈边缘像素，线性过滤时不会采到相邻的图
+
+    // 失败时返回texture为0的区域
+    const TextureRegion& get(const char* filename) {
+        auto cached = byPath.find(filename);
+        if (cached != byPath.end()) return cached->second;
+
+        static const TextureRegion missing;
+        MappedFile file;
+        if (!file.open(filename)) {
+            std::cerr << "Failed to open PPM file: " << filename << std::endl;
+            return missing;
+        }
+        PPMImage image;
+        if (!parsePPMHeader(file.data(), file.size(), image)) {
+            std::cerr << "Not a valid PPM file: " << filename << std::endl;
+            return missing;
+        }
+
+        unsigned long long hash = contentHash(image);
+        auto candidates = byContent.equal_range(hash);
+        for (auto same = candidates.first; same != candidates.second; ++same) {
+            if (sameContent(same->second.path, image)) {
+                return byPath.emplace(filename, same->second.region).first->second;
+            }
+        }
+        TextureRegion region = image.width <= MAX_ATLAS_IMAGE && image.height <= MAX_ATLAS_IMAGE
+                                   ? addToAtlas(image) : addStandalone(image);
+        byContent.emplace(hash, Content{filename, region});
+        return byPath.emplace(filename, region).first->second;
+    }
+
+    int atlasCount() const {
+        return static_cast<int>(atlases.size());
+    }
+
+    // 实际创建的GL纹理数（图集加上单独的大图）
+    int textureCount() const {
+        return static_cast<int>(atlases.size()) + standaloneCount;
+    }
+
+private:
+    struct Atlas {
+        GLuint texture;
+        SkylinePacker packer;
+    };
+
+    // 第一次加载这份内容的文件，散列相同时重新映射它逐字节比较
+    struct Content {
+        std::string path;
+        TextureRegion region;
+    };
+
+    std::unordered_map<std::string, TextureRegion> byPath;
+    std::unordered_multimap<unsigned long long, Content> byContent;
+    std::vector<Atlas> atlases;
+    int standaloneCount = 0;
+
+    // FNV-1a，包含宽高，不同尺寸的同样字节不会冲突
+    static unsigned long long contentHash(const PPMImage& image) {
+        unsigned long long hash = 14695981039346656037ull;
+        auto mix = [&hash](const unsigned char* bytes, size_t length) {
+            for (size_t i = 0; i < length; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        int size[2] = {image.width, image.height};
+        mix(reinterpret_cast<const unsigned char*>(size), sizeof(size));
+        mix(image.pixels, static_cast<size_t>(image.width) * image.height * 3);
+        return hash;
+    }
+
+    // 散列只用来找候选，相同的散列不一定是相同的图片
+    static bool sameContent(const std::string& path, const PPMImage& image) {
+        MappedFile file;
+        PPMImage other;
+        return file.open(path.c_str()) && parsePPMHeader(file.data(), file.size(), other) && other.width == image.width &&
+               other.height == image.height && memcmp(other.pixels, image.pixels, static_cast<size_t>(image.width) * image.height * 3) == 0;
+    }
+
+    TextureRegion addStandalone(const PPMImage& image) {
+        TextureRegion region;
+        region.width = image.width;
+        region.height = image.height;
+        glGenTextures(1, &region.texture);
+        glBindTexture(GL_TEXTURE_2D, region.texture);
+        glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+        glPopClientAttrib();
+        setTextureFilters();
+        glBindTexture(GL_TEXTURE_2D, 0);
+        standaloneCount++;
+        return region;
+    }
+
+    TextureRegion addToAtlas(const PPMImage& image) {
+        int w = image.width + 2 * PADDING, h = image.height + 2 * PADDING;
+        int x = 0, y = 0;
+        Atlas* atlas = nullptr;
+        for (Atlas& candidate : atlases) {
+            if (candidate.packer.insert(w, h, x, y)) {
+                atlas = &candidate;
+                break;
+            }
+        }
+        if (atlas == nullptr) {
+            atlases.push_back({0, SkylinePacker(ATLAS_SIZE, ATLAS_SIZE)});
+            atlas = &atlases.back();
+            glGenTextures(1, &atlas->texture);
+            glBindTexture(GL_TEXTURE_2D, atlas->texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, ATLAS_SIZE, ATLAS_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            setTextureFilters();
+            atlas->packer.insert(w, h, x, y);
+        }
+
+        // 带边的副本：边缘的行和列向外复制一份
+        std::vector<unsigned char> padded(static_cast<size_t>(w) * h * 3);
+        for (int row = 0; row < h; row++) {
+            int sourceRow = std::min(std::max(row - PADDING, 0), image.height - 1);
+            for (int column = 0; column < w; column++) {
+                int sourceColumn = std::min(std::max(column - PADDING, 0), image.width - 1);
+                const unsigned char* source = image.pixels + (static_cast<size_t>(sourceRow) * image.width + sourceColumn) * 3;
+                std::copy(source, source + 3, padded.begin() + (static_cast<size_t>(row) * w + column) * 3);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, atlas->texture);
+        glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGB, GL_UNSIGNED_BYTE, padded.data());
+        glPopClientAttrib();
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        TextureRegion region;
+        region.texture = atlas->texture;
+        region.width = image.width;
+        region.height = image.height;
+        region.u0 = static_cast<float>(x + PADDING) / ATLAS_SIZE;
+        region.v0 = static_cast<float>(y + PADDING) / ATLAS_SIZE;
+        region.u1 = static_cast<float>(x + PADDING + image.width) / ATLAS_SIZE;
+        region.v1 = static_cast<float>(y + PADDING + image.height) / ATLAS_SIZE;
+        return region;
+    }
+};
+TextureCache textureCache;
+
+// 预处理的纹理文件（.ctex）：头、各级mip的目录、按16字节对齐的像素数据，
+// 数据可以直接交给glTexImage2D/glCompressedTexImage2D；加载时只需映射文件，不再解析PPM或生成mip
+struct TextureFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width, height, levels;
+    uint64_t sourceSize;  // 源文件的大小和修改时间，变了就重新转换
+    int64_t sourceTime;
+};
+
+struct TextureFileLevel {
+    uint32_t width, height;
+    uint64_t offset, size;
+};
+
+enum TextureFileFormat : uint32_t { TEXTURE_RGBA8 = 0, TEXTURE_BC1 = 1 };
+const uint32_t TEXTURE_FILE_VERSION = 1;
+
+// 2x2盒式滤波缩小一半，奇数边长时最后一行/列和自己平均
+std::vector<unsigned char> downsampleRGBA(const std::vector<unsigned char>& source, int width, int height) {
+    int w = std::max(1, width / 2), h = std::max(1, height / 2);
+    std::vector<unsigned char> result(static_cast<size_t>(w) * h * 4);
+    for (int y = 0; y < h; y++) {
+        int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+        for (int x = 0; x < w; x++) {
+            int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            for (int c = 0; c < 4; c++) {
+                int sum = source[(static_cast<size_t>(y0) * width + x0) * 4 + c] + source[(static_cast<size_t>(y0) * width + x1) * 4 + c]
+                        + source[(static_cast<size_t>(y1) * width + x0) * 4 + c] + source[(static_cast<size_t>(y1) * width + x1) * 4 + c];
+                result[(static_cast<size_t>(y) * w + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+    return result;
+}
+
+uint16_t packRGB565(const int color[3]) {
+    return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | (color[2] * 31 + 127) / 255);
+}
+
+void unpackRGB565(uint16_t packed, int color[3]) {
+    color[0] = (packed >> 11) * 255 / 31;
+    color[1] = (packed >> 5 & 63) * 255 / 63;
+    color[2] = (packed & 31) * 255 / 31;
+}
+
+// BC1（DXT1）压缩一个4x4块：端点取颜色包围盒向内收缩1/16，按各通道与绿色的相关性选对角线，
+// 每个像素选最近的调色板颜色；质量不如离线工具，但转换足够快，可以在首次运行时做
+void compressBC1Block(const unsigned char block[16][4], unsigned char out[8]) {
+    int low[3] = {255, 255, 255}, high[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            low[c] = std::min(low[c], static_cast<int>(block[i][c]));
+            high[c] = std::max(high[c], static_cast<int>(block[i][c]));
+        }
+    }
+    int mean[3] = {(low[0] + high[0]) / 2, (low[1] + high[1]) / 2, (low[2] + high[2]) / 2};
+    for (int c : {0, 2}) {
+        int covariance = 0;
+        for (int i = 0; i < 16; i++) {
+            covariance += (block[i][c] - mean[c]) * (block[i][1] - mean[1]);
+        }
+        if (covariance < 0) std::swap(low[c], high[c]);
+    }
+    for (int c = 0; c < 3; c++) {
+        int inset = (high[c] - low[c]) / 16;
+        high[c] -= inset;
+        low[c] += inset;
+    }
+
+    uint16_t color0 = packRGB565(high), color1 = packRGB565(low);
+    if (color0 < color1) std::swap(color0, color1);
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        int palette[4][3];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+                int distance = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = block[i][c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance) {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices |= static_cast<uint32_t>(best) << (i * 2);
+        }
+    }
+    unsigned char bytes[8] = {static_cast<unsigned char>(color0), static_cast<unsigned char>(color0 >> 8),
+                              static_cast<unsigned char>(color1), static_cast<unsigned char>(color1 >> 8),
+                              static_cast<unsigned char>(indices), static_cast<unsigned char>(indices >> 8),
+                              static_cast<unsigned char>(indices >> 16), static_cast<unsigned char>(indices >> 24)};
+    std::copy(bytes, bytes + 8, out);
+}
+
+// 不足4的边用边缘像素补齐
+std::vector<unsigned char> compressBC1(const std::vector<unsigned char>& rgba, int width, int height) {
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    std::vector<unsigned char> result(static_cast<size_t>(blocksX) * blocksY * 8);
+    unsigned char block[16][4];
+    for (int by = 0; by < blocksY; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            for (int i = 0; i < 16; i++) {
+                int x = std::min(bx * 4 + i % 4, width - 1), y = std::min(by * 4 + i / 4, height - 1);
+                std::copy_n(&rgba[(static_cast<size_t>(y) * width + x) * 4], 4, block[i]);
+            }
+            compressBC1Block(block, &result[(static_cast<size_t>(by) * blocksX + bx) * 8]);
+        }
+    }
+    return result;
+}
+
+bool readSourceStamp(const char* filename, uint64_t& size, int64_t& time) {
+    std::error_code error;
+    size = std::filesystem::file_size(filename, error);
+    if (error) return false;
+    time = static_cast<int64_t>(std::filesystem::last_write_time(filename, error).time_since_epoch().count());
+    return !error;
+}
+
+// 先写临时文件再改名，中途失败不会留下坏缓存
+bool writeFileAtomically(const char* target, const std::vector<unsigned char>& bytes) {
+    std::string temporary = std::string(target) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!out) {
+            std::cerr << "Failed to write file: " << temporary << std::endl;
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    std::remove(target);  // Windows上rename不会覆盖已有文件
+    if (std::rename(temporary.c_str(), target) != 0) {
+        std::cerr << "Failed to write file: " << target << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// 一级mip的字节数：RGBA8每像素4字节，BC1每个4x4块8字节
+uint64_t textureLevelSize(uint32_t format, uint32_t width, uint32_t height) {
+    if (format == TEXTURE_BC1) return static_cast<uint64_t>((width + 3) / 4) * ((height + 3) / 4) * 8;
+    return static_cast<uint64_t>(width) * height * 4;
+}
+
+// PPM -> 完整mip链（可选BC1压缩），结果是.ctex文件的全部内容
+bool buildTextureFile(const char* source, bool compress, std::vector<unsigned char>& bytes) {
+    MappedFile file;
+    PPMImage image;
+    TextureFileHeader header{};
+    memcpy(header.magic, "CTEX", 4);
+    header.version = TEXTURE_FILE_VERSION;
+    header.format = compress ? TEXTURE_BC1 : TEXTURE_RGBA8;
+    if (!file.open(source) || !parsePPMHeader(file.data(), file.size(), image) ||
+        !readSourceStamp(source, header.sourceSize, header.sourceTime)) {
+        std::cerr << "Failed to convert PPM file: " << source << std::endl;
+        return false;
+    }
+    header.width = image.width;
+    header.height = image.height;
+
+    std::vector<unsigned char> rgba(static_cast<size_t>(image.width) * image.height * 4);
+    for (size_t i = 0, count = static_cast<size_t>(image.width) * image.height; i < count; i++) {
+        std::copy_n(image.pixels + i * 3, 3, &rgba[i * 4]);
+        rgba[i * 4 + 3] = 255;
+    }
+    std::vector<std::vector<unsigned char>> levels;
+    std::vector<TextureFileLevel> directory;
+    int width = image.width, height = image.height;
+    while (true) {
+        levels.push_back(compress ? compressBC1(rgba, width, height) : rgba);
+        directory.push_back({static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, levels.back().size()});
+        if (width == 1 && height == 1) break;
+        rgba = downsampleRGBA(rgba, width, height);
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+    header.levels = static_cast<uint32_t>(levels.size());
+
+    auto align = [](uint64_t offset) { return (offset + 15) & ~static_cast<uint64_t>(15); };
+    uint64_t offset = align(sizeof(header) + sizeof(TextureFileLevel) * directory.size());
+    for (TextureFileLevel& level : directory) {
+        level.offset = offset;
+        offset = align(offset + level.size);
+    }
+
+    bytes.assign(offset, 0);  // 末尾也补齐，映射后最后一级的对齐填充可读
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + sizeof(header), directory.data(), sizeof(TextureFileLevel) * directory.size());
+    for (size_t i = 0; i < levels.size(); i++) {
+        memcpy(bytes.data() + directory[i].offset, levels[i].data(), levels[i].size());
+    }
+    return true;
+}
+
+// 离线/首次运行的转换，写到target
+bool convertPPMToTextureFile(const char* source, const char* target, bool compress) {
+    std::vector<unsigned char> bytes;
+    return buildTextureFile(source, compress, bytes) && writeFileAtomically(target, bytes);
+}
+
+// 检查映射的.ctex是否完整、与源文件一致且当前上下文能用；
+// 每一级的尺寸必须是上一级减半，字节数必须与格式和尺寸相符，否则上传时会读出映射范围
+bool validTextureFile(const MappedFile& file, const char* source) {
+    if (file.size() < sizeof(TextureFileHeader)) return false;
+    TextureFileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    if (memcmp(header.magic, "CTEX", 4) != 0 || header.version != TEXTURE_FILE_VERSION || header.levels == 0 || header.levels > 32) return false;
+    if (readSourceStamp(source, sourceSize, sourceTime) && (sourceSize != header.sourceSize || sourceTime != header.sourceTime)) return false;
+    if (header.format == TEXTURE_BC1 && glCompressedTexImage2DPtr == nullptr) return false;
+    if (header.format != TEXTURE_RGBA8 && header.format != TEXTURE_BC1) return false;
+    if (header.width == 0 || header.height == 0 || header.width >= 65536 || header.height >= 65536) return false;
+    if (file.size() < sizeof(header) + sizeof(TextureFileLevel) * header.levels) return false;
+    uint32_t width = header.width, height = header.height;
+    for (uint32_t i = 0; i < header.levels; i++) {
+        TextureFileLevel level;
+        memcpy(&level, file.data() + sizeof(header) + sizeof(level) * i, sizeof(level));
+        if (level.width != width || level.height != height || level.size != textureLevelSize(header.format, width, height)) return false;
+        if (level.offset > file.size() || level.size > file.size() - level.offset) return false;
+        if (width == 1 && height == 1 && i + 1 < header.levels) return false;
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    return true;
+}
+
+// 加载PPM对应的纹理缓存（同目录下的<文件名>.ctex），没有或过期时先转换；
+// 源文件不在时只要缓存完整也能加载。目录不可写时直接用内存里转换的结果，只是下次还要再转换。
+// 带mip链，缩小显示时不再闪烁
+GLuint loadCachedTexture(const char* filename, bool compress = false) {
+    std::string cachePath = std::string(filename) + ".ctex";
+    MappedFile file;
+    std::vector<unsigned char> converted;
+    const unsigned char* data = nullptr;
+    if (file.open(cachePath.c_str()) && validTextureFile(file, filename)) {
+        data = file.data();
+    } else {
+        file = MappedFile();
+        compress = compress && glCompressedTexImage2DPtr != nullptr;
+        if (!buildTextureFile(filename, compress, converted)) return 0;
+        if (!writeFileAtomically(cachePath.c_str(), converted)) {
+            std::cerr << "Using " << filename << " without a texture cache" << std::endl;
+        }
+        data = converted.data();
+    }
+
+    TextureFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    for (uint32_t i = 0; i < header.levels; i++) {
+        TextureFileLevel level;
+        memcpy(&level, data + sizeof(header) + sizeof(level) * i, sizeof(level));
+        const unsigned char* pixels = data + level.offset;
+        if (header.format == TEXTURE_BC1) {
+            glCompressedTexImage2DPtr(GL_TEXTURE_2D, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.width, level.height, 0,
+                                      static_cast<GLsizei>(level.size), pixels);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+const int WINDOW_WIDTH = 600;
+const int WINDOW_HEIGHT = 800;
+float skyColor = 0.4;  // 初始化浅蓝色天空
+float bannerYOffset = -100;  // 初始牌子与气球的相对位置
+char text[2000] = "XJTLU Graduation Ceremony 2024\n"
+                  "Dear All,\n"
+                  "    We are delighted to invite you to join us in celebrating the outstanding achievements of our graduating class at Xi'an Jiaotong-Liverpool University.\n"
+                  "\n"
+                  "Event Details:"
+                  "Details:\n"
+                  "Date: [June 10, 2024]\n"
+                  "Time: [10:00 AM]\n"
+                  "Venue: [XJTLU Central Auditorium]\n"
+                  "Please RSVP by [June 1, 2024].\n"
+                  "Warm Regards,\n"
+                  "Xi'an Jiaotong-Liverpool University";  // 信纸上的文字
+int frameCounter = 0;  // 计数器来跟踪经过的帧数
+bool windowsVisible = true;
+bool windowsActivated = false;
+//bool flowersDrawn = false;
+bool balloonsFlying = false;
+bool fireworksStarted = false;
+bool timerStarted = false;
+float interpolationAlpha = 1.0f;  // 绘制时在上一步和当前步的模拟状态之间插值的比例
+
+// 世界坐标中的轴对齐矩形，用于视野裁剪
+struct Bounds {
+    float x0, y0, x1, y1;
+
+    bool overlaps(const Bounds& other) const {
+        return x0 <= other.x1 && other.x0 <= x1 && y0 <= other.y1 && other.y0 <= y1;
+    }
+};
+
+// 批处理用的顶点：位置 + 8位RGBA颜色 + 纹理坐标（不贴图时忽略）
+struct Vertex {
+    float x, y;
+    unsigned char r, g, b, a;
+    float u, v;
+};
+
+unsigned char colorToByte(float value) {
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// 静态几何体：只在初始化时上传一次到VBO
+struct StaticMesh {
+    GLuint buffer = 0;
+    std::vector<Vertex> vertices;  // 没有VBO时直接用客户端数组绘制
+    int count = 0;
+    Bounds bounds = {0, 0, -1, -1};  // 所有顶点的外接矩形
+};
+
+thread_local bool runningJob = false;  // 当前线程是否正在执行任务系统里的任务
+
+// 任务系统：每个工作线程有自己的任务队列，空闲时从其他队列窃取任务
+class JobSystem {
+public:
+    typedef std::function<void()> Job;
+
+    explicit JobSystem(int numThreads = static_cast<int>(std::thread::hardware_concurrency()) - 1) {
+        start(numThreads);
+    }
+
+    ~JobSystem() {
+        stop();
+    }
+
+    // 换成numThreads个工作线程（不含主线程）；先完成已提交的任务。
+    // 单核机器上默认没有工作线程，ThreadSanitizer要靠这个才能看到并发
+    void resize(int numThreads) {
+        wait();
+        stop();
+        start(numThreads);
+    }
+
+    int workerCount() const {
+        return static_cast<int>(queues.size());
+    }
+
+    void submit(Job job) {
+        WorkQueue& queue = *queues[nextQueue++ % queues.size()];
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    // 把 [0, count) 切成若干块，每块作为一个任务提交
+    void parallelFor(int count, int chunkSize, const std::function<void(int, int)>& body) {
+        for (int begin = 0; begin < count; begin += chunkSize) {
+            int end = std::min(begin + chunkSize, count);
+            submit([body, begin, end]() { body(begin, end); });
+        }
+    }
+
+    // 同步点：主线程也参与执行，直到所有已提交的任务完成
+    void wait() {
+        while (pending > 0) {
+            Job job;
+            if (take(0, job)) {
+                run(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct WorkQueue {
+        std::deque<Job> jobs;
+        std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> pending{0};  // 已提交但尚未完成的任务
+    std::atomic<int> queued{0};  // 仍在队列中等待执行的任务
+    std::atomic<unsigned> nextQueue{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void start(int numThreads) {
+        numThreads = std::max(numThreads, 0);
+        stopping = false;
+        queues.clear();
+        for (int i = 0; i <= numThreads; i++) {  // 队列0属于主线程
+            queues.emplace_back(new WorkQueue());
+        }
+        for (int i = 1; i <= numThreads; i++) {
+            threads.emplace_back(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+
+    // 先从自己的队列尾部取任务，没有则从其他队列头部窃取
+    bool take(int self, Job& job) {
+        for (int i = 0; i < workerCount(); i++) {
+            WorkQueue& queue = *queues[(self + i) % workerCount()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty()) continue;
+            if (i == 0) {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            } else {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void run(Job& job) {
+        bool outer = runningJob;
+        runningJob = true;
+        job();
+        runningJob = outer;
+        pending--;
+    }
+
+    void workerLoop(int index) {
+        while (true) {
+            Job job;
+            if (take(index, job)) {
+                run(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return queued > 0 || stopping; });
+            if (stopping && queued == 0) return;
+        }
+    }
+};
+JobSystem jobSystem;
+
+// 软件光栅化（--software）：没有可用的GPU时整个场景在CPU上画。只实现场景用得到的部分：
+// Renderer转换出来的三角形（顶点颜色插值，可选最近点采样的纹理）、方形的点、位图文字和清屏，
+// 除清屏以外都按 SRC_ALPHA, ONE_MINUS_SRC_ALPHA 混合。提交时只做三角形设置并把命令分到图块里，
+// 帧结束时各图块在任务系统里并行地按提交顺序执行自己的命令；图块互不重叠，不需要加锁。
+// 边函数、颜色插值和混合每次算一行里相邻的4个像素（SSE2）
+class SoftwareRasterizer {
+public:
+    static const int TILE = 64;  // 图块边长（像素），帧缓冲按图块补齐
+
+    // 到像素坐标的变换，场景只用到平移和缩放
+    struct Transform {
+        float sx = 1, sy = 1, tx = 0, ty = 0;
+
+        // 先做inner再做自己
+        Transform operator*(const Transform& inner) const {
+            return {sx * inner.sx, sy * inner.sy, sx * inner.tx + tx, sy * inner.ty + ty};
+        }
+    };
+
+    void resize(int width, int height) {
+        frameWidth = width;
+        frameHeight = height;
+        tilesX = (width + TILE - 1) / TILE;
+        tilesY = (height + TILE - 1) / TILE;
+        stride = tilesX * TILE;
+        pixels.assign(static_cast<size_t>(stride) * tilesY * TILE, 0);
+        bins.assign(tilesX * tilesY, std::vector<int>());
+        commands.clear();
+        triangles.clear();
+        disableScissor();
+    }
+
+    int width() const {
+        return frameWidth;
+    }
+
+    int height() const {
+        return frameHeight;
+    }
+
+    // 之后的命令只画在这个矩形里（像素坐标，左下角为原点）
+    void scissor(int x, int y, int width, int height) {
+        clip = {std::max(x, 0), std::max(y, 0), std::min(x + width, frameWidth), std::min(y + height, frameHeight)};
+    }
+
+    void disableScissor() {
+        clip = {0, 0, frameWidth, frameHeight};
+    }
+
+    // 与glClear相同：裁剪矩形内直接填成这个颜色，不混合
+    void clear(const unsigned char colour[4]) {
+        Command command = {};
+        command.kind = COMMAND_CLEAR;
+        command.bounds = clip;
+        command.colour = pack(colour);
+        add(command);
+    }
+
+    // 每三个顶点一个三角形；texture是softwareTexture返回的编号，0表示不贴图
+    void drawTriangles(const Vertex* vertices, int count, const Transform& transform, int texture) {
+        for (int i = 0; i + 2 < count; i += 3) {
+            setupTriangle(vertices + i, transform, texture);
+        }
+    }
+
+    // 与glPointSize相同，点的大小是像素，不随变换缩放
+    void drawPoints(const Vertex* vertices, int count, float size, const Transform& transform) {
+        float half = size / 2;
+        for (int i = 0; i < count; i++) {
+            float x = transform.sx * vertices[i].x + transform.tx, y = transform.sy * vertices[i].y + transform.ty;
+            Command command = {};
+            command.kind = COMMAND_RECT;
+            command.bounds = intersect({pixelIndex(std::ceil(x - half - 0.5f)), pixelIndex(std::ceil(y - half - 0.5f)),
+                                        pixelIndex(std::ceil(x + half - 0.5f)), pixelIndex(std::ceil(y + half - 0.5f))});
+            command.colour = pack(&vertices[i].r);
+            if (vertices[i].a != 0) add(command);
+        }
+    }
+
+    // 与glBitmap相同：位图的左下角在(x - xorig, y - yorig)，为1的位画成这个颜色
+    void drawBitmap(float x, float y, const BitmapGlyph& glyph, const unsigned char colour[4]) {
+        Command command = {};
+        command.kind = COMMAND_BITMAP;
+        command.originX = static_cast<int>(std::floor(x - glyph.xorig));
+        command.originY = static_cast<int>(std::floor(y - glyph.yorig));
+        command.bounds = intersect({command.originX, command.originY, command.originX + glyph.width, command.originY + glyph.height});
+        command.colour = pack(colour);
+        command.bits = glyph.bits;
+        command.rowBytes = (glyph.width + 7) / 8;
+        add(command);
+    }
+
+    // 行自下而上的RGBA像素，返回给drawTriangles用的编号（从1开始）
+    int softwareTexture(int width, int height, const unsigned char* rgba) {
+        Texture texture;
+        texture.width = width;
+        texture.height = height;
+        texture.texels.resize(static_cast<size_t>(width) * height);
+        std::memcpy(texture.texels.data(), rgba, texture.texels.size() * 4);
+        textures.push_back(std::move(texture));
+        return static_cast<int>(textures.size());
+    }
+
+    // 执行所有已提交的命令；读像素之前必须调用
+    void finish() {
+        if (commands.empty()) return;
+        jobSystem.parallelFor(tilesX * tilesY, 4, [this](int begin, int end) {
+            for (int tile = begin; tile < end; tile++) {
+                drawTile(tile);
+            }
+        });
+        jobSystem.wait();
+        for (std::vector<int>& bin : bins) {
+            bin.clear();
+        }
+        commands.clear();
+        triangles.clear();
+    }
+
+    // 复制出width*height个RGBA像素，第一行在最下面（与glReadPixels相同）
+    void read(unsigned char* rgba) const {
+        for (int y = 0; y < frameHeight; y++) {
+            std::memcpy(rgba + static_cast<size_t>(y) * frameWidth * 4, &pixels[static_cast<size_t>(y) * stride],
+                        static_cast<size_t>(frameWidth) * 4);
+        }
+    }
+
+private:
+    enum CommandKind { COMMAND_CLEAR, COMMAND_RECT, COMMAND_TRIANGLE, COMMAND_BITMAP };
+
+    struct Rect {
+        int x0, y0, x1, y1;  // 不含x1和y1
+
+        bool empty() const {
+            return x1 <= x0 || y1 <= y0;
+        }
+    };
+
+    struct Command {
+        CommandKind kind;
+        Rect bounds;  // 会画到的像素，已经与裁剪矩形求交
+        uint32_t colour;  // 清屏、点和位图的颜色
+        int triangle;  // 在triangles中的下标
+        int originX, originY;  // 位图左下角
+        const GLubyte* bits;
+        int rowBytes;
+    };
+
+    // 边函数 a*(x - x0) + b*(y - y0)，像素中心不小于bias时在里面。两个三角形共用的边总是从同一个端点算起，
+    // 结果正好互为相反数，bias在一边取0、另一边取最小的正数，边上的像素只画一次
+    struct Edge {
+        float a, b, x0, y0, bias;
+    };
+
+    // 属性的平面方程 dx*x + dy*y + c（像素中心坐标）
+    struct Plane {
+        float dx, dy, c;
+
+        float at(float x, float y) const {
+            return dx * x + dy * y + c;
+        }
+    };
+
+    struct Triangle {
+        Edge edges[3];
+        Plane planes[6];  // r、g、b、a（0到255）、u、v
+        bool flat;  // 三个顶点颜色相同，不用插值
+        uint32_t colour;
+        int texture;  // 0表示不贴图
+    };
+
+    struct Texture {
+        int width = 0, height = 0;
+        std::vector<uint32_t> texels;
+    };
+
+    int frameWidth = 0, frameHeight = 0;
+    int tilesX = 0, tilesY = 0, stride = 0;
+    std::vector<uint32_t> pixels;  // 每个像素的RGBA四个字节，第一行在最下面
+    Rect clip = {0, 0, 0, 0};
+    std::vector<Command> commands;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<int>> bins;  // 每个图块要执行的命令，按提交顺序
+    std::vector<Texture> textures;
+
+    static uint32_t pack(const unsigned char colour[4]) {
+        return colour[0] | colour[1] << 8 | colour[2] << 16 | static_cast<uint32_t>(colour[3]) << 24;
+    }
+
+    Rect intersect(const Rect& rect) const {
+        return {std::max(rect.x0, clip.x0), std::max(rect.y0, clip.y0), std::min(rect.x1, clip.x1), std::min(rect.y1, clip.y1)};
+    }
+
+    void add(const Command& command) {
+        if (command.bounds.empty()) return;
+        int index = static_cast<int>(commands.size());
+        commands.push_back(command);
+        const Rect& r = command.bounds;
+        for (int ty = r.y0 / TILE; ty <= (r.y1 - 1) / TILE; ty++) {
+            for (int tx = r.x0 / TILE; tx <= (r.x1 - 1) / TILE; tx++) {
+                if (command.kind == COMMAND_TRIANGLE && !overlaps(triangles[command.triangle], tx, ty, r)) continue;
+                bins[ty * tilesX + tx].push_back(index);
+            }
+        }
+    }
+
+    // 三角形是否可能盖住这个图块：每条边在图块（与外接矩形的交集）四角的像素中心里取最大值，有一条边全在外面就不是
+    static bool overlaps(const Triangle& triangle, int tx, int ty, const Rect& bounds) {
+        float x0 = std::max(tx * TILE, bounds.x0) + 0.5f, x1 = std::min(tx * TILE + TILE, bounds.x1) - 0.5f;
+        float y0 = std::max(ty * TILE, bounds.y0) + 0.5f, y1 = std::min(ty * TILE + TILE, bounds.y1) - 0.5f;
+        for (const Edge& e : triangle.edges) {
+            float x = e.a > 0 ? x1 : x0, y = e.b > 0 ? y1 : y0;
+            float w = e.a * (x - e.x0) + e.b * (y - e.y0);
+            if (w < -0.01f * (std::fabs(e.a) + std::fabs(e.b))) return false;  // 留一点余量，舍入误差不会漏掉像素
+        }
+        return true;
+    }
+
+    // 远在画面外的坐标先夹住再转成整数
+    static int pixelIndex(float value) {
+        return static_cast<int>(std::min(std::max(value, -1.0f), 65536.0f));
+    }
+
+    void setupTriangle(const Vertex* v, const Transform& transform, int texture) {
+        float x[3], y[3];
+        for (int i = 0; i < 3; i++) {
+            x[i] = transform.sx * v[i].x + transform.tx;
+            y[i] = transform.sy * v[i].y + transform.ty;
+        }
+        double area = static_cast<double>(x[1] - x[0]) * (y[2] - y[0]) - static_cast<double>(x[2] - x[0]) * (y[1] - y[0]);
+        if (!(area != 0)) return;  // 退化或者坐标是NaN
+        float minX = std::min(x[0], std::min(x[1], x[2])), maxX = std::max(x[0], std::max(x[1], x[2]));
+        float minY = std::min(y[0], std::min(y[1], y[2])), maxY = std::max(y[0], std::max(y[1], y[2]));
+        // 像素中心落在[min, max]里的像素
+        Rect bounds = intersect({pixelIndex(std::ceil(minX - 0.5f)), pixelIndex(std::ceil(minY - 0.5f)),
+                                 pixelIndex(std::floor(maxX - 0.5f)) + 1, pixelIndex(std::floor(maxY - 0.5f)) + 1});
+        if (bounds.empty()) return;
+
+        Triangle triangle;
+        float orientation = area > 0 ? 1.0f : -1.0f;  // 顺时针的三角形把所有边函数取反
+        for (int i = 0; i < 3; i++) {
+            int p = i, q = (i + 1) % 3;
+            float sign = orientation;
+            if (x[q] < x[p] || (x[q] == x[p] && y[q] < y[p])) {
+                std::swap(p, q);
+                sign = -sign;
+            }
+            Edge& e = triangle.edges[i];
+            e.a = -(y[q] - y[p]) * sign;
+            e.b = (x[q] - x[p]) * sign;
+            e.x0 = x[p];
+            e.y0 = y[p];
+            e.bias = e.a > 0 || (e.a == 0 && e.b > 0) ? 0.0f : std::numeric_limits<float>::denorm_min();
+        }
+        float values[6][3];
+        for (int i = 0; i < 3; i++) {
+            values[0][i] = v[i].r;
+            values[1][i] = v[i].g;
+            values[2][i] = v[i].b;
+            values[3][i] = v[i].a;
+            values[4][i] = v[i].u;
+            values[5][i] = v[i].v;
+        }
+        for (int k = 0; k < 6; k++) {
+            double d1 = values[k][1] - values[k][0], d2 = values[k][2] - values[k][0];
+            double dx = (d1 * (y[2] - y[0]) - d2 * (y[1] - y[0])) / area;
+            double dy = (d2 * (x[1] - x[0]) - d1 * (x[2] - x[0])) / area;
+            triangle.planes[k] = {static_cast<float>(dx), static_cast<float>(dy), static_cast<float>(values[k][0] - dx * x[0] - dy * y[0])};
+        }
+        triangle.flat = texture == 0 && std::memcmp(&v[0].r, &v[1].r, 4) == 0 && std::memcmp(&v[0].r, &v[2].r, 4) == 0;
+        triangle.colour = pack(&v[0].r);
+        triangle.texture = texture;
+        if (triangle.flat && v[0].a == 0) return;
+
+        Command command = {};
+        command.kind = COMMAND_TRIANGLE;
+        command.bounds = bounds;
+        command.triangle = static_cast<int>(triangles.size());
+        triangles.push_back(triangle);
+        add(command);
+    }
+
+    // 这一行里可能在三角形内的像素范围：由边函数解出x再各放宽一个像素，边上的像素仍逐个判断
+    static bool rowSpan(const Triangle& t, const Rect& r, float py, int& x0, int& x1) {
+        float left = static_cast<float>(r.x0), right = static_cast<float>(r.x1);
+        for (const Edge& e : t.edges) {
+            float row = e.b * (py - e.y0);
+            if (e.a == 0) {
+                if (row < e.bias) return false;
+            } else if (e.a > 0) {
+                left = std::max(left, e.x0 - row / e.a - 1.5f);
+            } else {
+                right = std::min(right, e.x0 - row / e.a + 1.5f);
+            }
+        }
+        if (!(left < right)) return false;
+        x0 = std::max(r.x0, static_cast<int>(left));
+        x1 = std::min(r.x1, static_cast<int>(right) + 1);
+        return x0 < x1;
+    }
+
+    // 与按4个像素判断时的运算顺序相同，结果也完全相同
+    static bool inside(const Triangle& t, float px, float py) {
+        for (const Edge& e : t.edges) {
+            if (!(e.a * (px - e.x0) + e.b * (py - e.y0) >= e.bias)) return false;
+        }
+        return true;
+    }
+
+    // 不透明的纯色三角形每行盖住连续的一段，找到两端后直接填充
+    void fillRow(const Triangle& t, int y, int x0, int x1) {
+        float py = y + 0.5f;
+        while (x0 < x1 && !inside(t, x0 + 0.5f, py)) x0++;
+        while (x1 > x0 && !inside(t, x1 - 0.5f, py)) x1--;
+        uint32_t* row = &pixels[static_cast<size_t>(y) * stride];
+        std::fill(row + x0, row + x1, t.colour);
+    }
+
+    static uint32_t blend(uint32_t dst, float r, float g, float b, float a) {
+        float s = a / 255.0f, d = 1 - s;
+        auto channel = [](float src, uint32_t dst, float s, float d) {
+            return static_cast<uint32_t>(std::min(std::max(src * s + (dst & 255) * d + 0.5f, 0.0f), 255.0f));
+        };
+        return channel(r, dst, s, d) | channel(g, dst >> 8, s, d) << 8 | channel(b, dst >> 16, s, d) << 16 | channel(a, dst >> 24, s, d) << 24;
+    }
+
+    uint32_t sample(int texture, float u, float v) const {
+        const Texture& t = textures[texture - 1];
+        int x = std::min(std::max(static_cast<int>(std::floor(u * t.width)), 0), t.width - 1);
+        int y = std::min(std::max(static_cast<int>(std::floor(v * t.height)), 0), t.height - 1);
+        return t.texels[static_cast<size_t>(y) * t.width + x];
+    }
+
+    void drawTile(int tile) {
+        int tx = tile % tilesX, ty = tile / tilesX;
+        Rect area = {tx * TILE, ty * TILE, tx * TILE + TILE, ty * TILE + TILE};
+        for (int index : bins[tile]) {
+            const Command& command = commands[index];
+            Rect r = {std::max(area.x0, command.bounds.x0), std::max(area.y0, command.bounds.y0),
+                      std::min(area.x1, command.bounds.x1), std::min(area.y1, command.bounds.y1)};
+            if (r.empty()) continue;
+            switch (command.kind) {
+                case COMMAND_CLEAR:
+                    for (int y = r.y0; y < r.y1; y++) {
+                        std::fill(&pixels[static_cast<size_t>(y) * stride + r.x0], &pixels[static_cast<size_t>(y) * stride + r.x1], command.colour);
+                    }
+                    break;
+                case COMMAND_RECT:
+                    fillRect(r, command.colour);
+                    break;
+                case COMMAND_BITMAP:
+                    drawBits(r, command);
+                    break;
+                case COMMAND_TRIANGLE:
+                    rasterize(r, triangles[command.triangle]);
+                    break;
+            }
+        }
+    }
+
+    void drawBits(const Rect& r, const Command& command) {
+        const unsigned char* c = reinterpret_cast<const unsigned char*>(&command.colour);
+        for (int y = r.y0; y < r.y1; y++) {
+            const GLubyte* row = command.bits + static_cast<size_t>(y - command.originY) * command.rowBytes;
+            uint32_t* out = &pixels[static_cast<size_t>(y) * stride];
+            for (int x = r.x0; x < r.x1; x++) {
+                int i = x - command.originX;
+                if (row[i >> 3] & (0x80 >> (i & 7))) out[x] = blend(out[x], c[0], c[1], c[2], c[3]);
+            }
+        }
+    }
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // 4个像素的颜色（0到255）按alpha混合到dst上，只写mask为真的像素
+    static __m128i blend4(__m128i dst, __m128 r, __m128 g, __m128 b, __m128 a, __m128i mask) {
+        const __m128i byte = _mm_set1_epi32(255);
+        const __m128 half = _mm_set1_ps(0.5f);
+        __m128 s = _mm_mul_ps(a, _mm_set1_ps(1.0f / 255.0f)), d = _mm_sub_ps(_mm_set1_ps(1.0f), s);
+        auto channel = [&](__m128 src, int shift) {
+            __m128 old = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(dst, shift), byte));
+            __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(src, s), _mm_mul_ps(old, d)), half);
+            return _mm_slli_epi32(_mm_and_si128(_mm_cvttps_epi32(value), byte), shift);
+        };
+        __m128i result = _mm_or_si128(_mm_or_si128(channel(r, 0), channel(g, 8)), _mm_or_si128(channel(b, 16), channel(a, 24)));
+        return _mm_or_si128(_mm_and_si128(mask, result), _mm_andnot_si128(mask, dst));
+    }
+
+    // 行里[x0, x1)的4个一组的掩码；图块按4像素对齐，组不会越过图块
+    static __m128i spanMask(int x, int x0, int x1) {
+        __m128i lanes = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+        return _mm_and_si128(_mm_cmpgt_epi32(lanes, _mm_set1_epi32(x0 - 1)), _mm_cmplt_epi32(lanes, _mm_set1_epi32(x1)));
+    }
+
+    void fillRect(const Rect& r, uint32_t colour) {
+        const unsigned char* c = reinterpret_cast<const unsigned char*>(&colour);
+        __m128 cr = _mm_set1_ps(c[0]), cg = _mm_set1_ps(c[1]), cb = _mm_set1_ps(c[2]), ca = _mm_set1_ps(c[3]);
+        __m128i solid = _mm_set1_epi32(static_cast<int>(colour));
+        for (int y = r.y0; y < r.y1; y++) {
+            uint32_t* row = &pixels[static_cast<size_t>(y) * stride];
+            for (int x = r.x0 & ~3; x < r.x1; x += 4) {
+                __m128i* out = reinterpret_cast<__m128i*>(row + x);
+                __m128i mask = spanMask(x, r.x0, r.x1), dst = _mm_load_si128(out);
+                if (c[3] == 255) {
+                    _mm_store_si128(out, _mm_or_si128(_mm_and_si128(mask, solid), _mm_andnot_si128(mask, dst)));
+                } else {
+                    _mm_store_si128(out, blend4(dst, cr, cg, cb, ca, mask));
+                }
+            }
+        }
+    }
+
+    void rasterize(const Rect& r, const Triangle& t) {
+        const unsigned char* c = reinterpret_cast<const unsigned char*>(&t.colour);
+        const __m128 centres = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps(), full = _mm_set1_ps(255.0f);
+        __m128 a[3], bias[3], ex[3];
+        for (int i = 0; i < 3; i++) {
+            a[i] = _mm_set1_ps(t.edges[i].a);
+            bias[i] = _mm_set1_ps(t.edges[i].bias);
+            ex[i] = _mm_set1_ps(t.edges[i].x0);
+        }
+        __m128 dx[6];
+        for (int k = 0; k < 6; k++) {
+            dx[k] = _mm_set1_ps(t.planes[k].dx);
+        }
+        bool opaque = t.flat && c[3] == 255;
+        for (int y = r.y0; y < r.y1; y++) {
+            float py = y + 0.5f;
+            int spanX0, spanX1;
+            if (!rowSpan(t, r, py, spanX0, spanX1)) continue;
+            if (opaque) {
+                fillRow(t, y, spanX0, spanX1);
+                continue;
+            }
+            __m128 row[3];
+            for (int i = 0; i < 3; i++) {
+                row[i] = _mm_set1_ps(t.edges[i].b * (py - t.edges[i].y0));
+            }
+            uint32_t* pixelsRow = &pixels[static_cast<size_t>(y) * stride];
+            for (int x = spanX0 & ~3; x < spanX1; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), centres);
+                __m128i mask = spanMask(x, spanX0, spanX1);
+                for (int i = 0; i < 3; i++) {
+                    __m128 w = _mm_add_ps(_mm_mul_ps(a[i], _mm_sub_ps(px, ex[i])), row[i]);
+                    mask = _mm_and_si128(mask, _mm_castps_si128(_mm_cmpge_ps(w, bias[i])));
+                }
+                if (_mm_movemask_epi8(mask) == 0) continue;
+                __m128i* out = reinterpret_cast<__m128i*>(pixelsRow + x);
+                __m128i dst = _mm_load_si128(out);
+                __m128 colour[4];
+                for (int k = 0; k < 4; k++) {
+                    if (t.flat) {
+                        colour[k] = _mm_set1_ps(c[k]);
+                    } else {
+                        __m128 value = _mm_add_ps(_mm_mul_ps(dx[k], px), _mm_set1_ps(t.planes[k].dy * py + t.planes[k].c));
+                        colour[k] = _mm_min_ps(_mm_max_ps(value, zero), full);
+                    }
+                }
+                if (t.texture != 0) {
+                    // 最近点采样没有SSE2的收集指令，逐个像素取纹素
+                    __m128 u = _mm_add_ps(_mm_mul_ps(dx[4], px), _mm_set1_ps(t.planes[4].dy * py + t.planes[4].c));
+                    __m128 v = _mm_add_ps(_mm_mul_ps(dx[5], px), _mm_set1_ps(t.planes[5].dy * py + t.planes[5].c));
+                    alignas(16) float us[4], vs[4];
+                    alignas(16) uint32_t texels[4];
+                    _mm_store_ps(us, u);
+                    _mm_store_ps(vs, v);
+                    for (int i = 0; i < 4; i++) {
+                        texels[i] = sample(t.texture, us[i], vs[i]);
+                    }
+                    __m128i texel = _mm_load_si128(reinterpret_cast<const __m128i*>(texels));
+                    for (int k = 0; k < 4; k++) {
+                        __m128 value = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texel, 8 * k), _mm_set1_epi32(255)));
+                        colour[k] = _mm_mul_ps(colour[k], _mm_mul_ps(value, _mm_set1_ps(1.0f / 255.0f)));
+                    }
+                }
+                _mm_store_si128(out, blend4(dst, colour[0], colour[1], colour[2], colour[3], mask));
+            }
+        }
+    }
+#else
+    void fillRect(const Rect& r, uint32_t colour) {
+        const unsigned char* c = reinterpret_cast<const unsigned char*>(&colour);
+        for (int y = r.y0; y < r.y1; y++) {
+            uint32_t* row = &pixels[static_cast<size_t>(y) * stride];
+            for (int x = r.x0; x < r.x1; x++) {
+                row[x] = c[3] == 255 ? colour : blend(row[x], c[0], c[1], c[2], c[3]);
+            }
+        }
+    }
+
+    void rasterize(const Rect& r, const Triangle& t) {
+        const unsigned char* c = reinterpret_cast<const unsigned char*>(&t.colour);
+        for (int y = r.y0; y < r.y1; y++) {
+            float py = y + 0.5f;
+            int spanX0, spanX1;
+            if (!rowSpan(t, r, py, spanX0, spanX1)) continue;
+            if (t.flat && c[3] == 255) {
+                fillRow(t, y, spanX0, spanX1);
+                continue;
+            }
+            uint32_t* row = &pixels[static_cast<size_t>(y) * stride];
+            for (int x = spanX0; x < spanX1; x++) {
+                float px = x + 0.5f;
+                if (!inside(t, px, py)) continue;
+                float colour[4];
+                for (int k = 0; k < 4; k++) {
+                    colour[k] = t.flat ? c[k] : std::min(std::max(t.planes[k].at(px, py), 0.0f), 255.0f);
+                }
+                if (t.texture != 0) {
+                    uint32_t texel = sample(t.texture, t.planes[4].at(px, py), t.planes[5].at(px, py));
+                    for (int k = 0; k < 4; k++) {
+                        colour[k] *= (texel >> (8 * k) & 255) / 255.0f;
+                    }
+                }
+                row[x] = blend(row[x], colour[0], colour[1], colour[2], colour[3]);
+            }
+        }
+    }
+#endif
+};
+
+// 保留模式渲染器：绘制代码仍按 begin/vertex/end 的方式提交图元，
+// 但所有图元都被转换成三角形累积起来，在 flush 时通过环形缓冲区一次性绘制
+class Renderer {
+public:
+    int drawCalls = 0;  // 本帧的绘制调用次数
+
+    // 软件光栅化：不加载GL函数，所有图元都交给SoftwareRasterizer；要在init之前调用
+    void useSoftware(int width, int height) {
+        software = true;
+        raster.resize(width, height);
+    }
+
+    bool softwareMode() const {
+        return software;
+    }
+
+    SoftwareRasterizer& softwareRasterizer() {
+        return raster;
+    }
+
+    void init() {
+        if (software) return;
+        loadGLFunctions();
+        if (glGenBuffersPtr == nullptr) {
+            streamMode = STREAM_CLIENT_ARRAYS;
+            return;
+        }
+        glGenBuffersPtr(1, &ringBuffer);
+        glBindBufferPtr(GL_ARRAY_BUFFER, ringBuffer);
+        GLsizeiptr size = static_cast<GLsizeiptr>(sizeof(Vertex)) * SEGMENT_VERTICES * RING_SEGMENTS;
+        if (glBufferStoragePtr && glMapBufferRangePtr && glFenceSyncPtr) {
+            // 持久映射：CPU直接写入映射的内存，用栅栏保证GPU读完之前不会被覆盖
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStoragePtr(GL_ARRAY_BUFFER, size, nullptr, flags);
+            mapped = static_cast<Vertex*>(glMapBufferRangePtr(GL_ARRAY_BUFFER, 0, size, flags));
+        }
+        if (mapped != nullptr) {
+            streamMode = STREAM_PERSISTENT;
+        } else {
+            glBufferDataPtr(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            streamMode = STREAM_BUFFER_SUBDATA;
+        }
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+    }
+
+    const char* streamModeName() const {
+        if (software) return "software rasterizer";
+        switch (streamMode) {
+            case STREAM_PERSISTENT: return "persistent mapped ring buffer";
+            case STREAM_BUFFER_SUBDATA: return "glBufferSubData ring buffer";
+            default: return "client arrays";
+        }
+    }
+
+    void beginFrame() {
+        drawCalls = 0;
+        segment = (segment + 1) % RING_SEGMENTS;
+        segmentUsed = 0;
+        if (fences[segment] != nullptr) {
+            glClientWaitSyncPtr(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);  // 最多等1秒
+            glDeleteSyncPtr(fences[segment]);
+            fences[segment] = nullptr;
+        }
+    }
+
+    void endFrame() {
+        flush();
+        if (software) {
+            raster.finish();
+        } else if (streamMode == STREAM_PERSISTENT) {
+            fences[segment] = glFenceSyncPtr(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+
+    void color(float r, float g, float b, float a = 1.0f) {
+        currentColor[0] = colorToByte(r);
+        currentColor[1] = colorToByte(g);
+        currentColor[2] = colorToByte(b);
+        currentColor[3] = colorToByte(a);
+    }
+
+    void texCoord(float u, float v) {
+        currentTexCoord[0] = u;
+        currentTexCoord[1] = v;
+    }
+
+    // 模型视图矩阵：GL时直接调用对应的函数，软件光栅化时自己维护（只有平移和缩放）；都先画完之前的批次
+    void pushMatrix() {
+        flush();
+        if (!software) {
+            glPushMatrix();
+            return;
+        }
+        matrixStack.push_back(matrix);
+    }
+
+    void popMatrix() {
+        flush();
+        if (!software) {
+            glPopMatrix();
+            return;
+        }
+        matrix = matrixStack.back();
+        matrixStack.pop_back();
+    }
+
+    void translate(float x, float y) {
+        flush();
+        if (!software) {
+            glTranslatef(x, y, 0);
+            return;
+        }
+        matrix = matrix * SoftwareRasterizer::Transform{1, 1, x, y};
+    }
+
+    void scale(float factor) {
+        flush();
+        if (!software) {
+            glScalef(factor, factor, 1);
+            return;
+        }
+        matrix = matrix * SoftwareRasterizer::Transform{factor, factor, 0, 0};
+    }
+
+    void viewport(GLint out[4]) {
+        if (!software) {
+            glGetIntegerv(GL_VIEWPORT, out);
+            return;
+        }
+        out[0] = out[1] = 0;
+        out[2] = raster.width();
+        out[3] = raster.height();
+    }
+
+    void clearColor(float r, float g, float b, float a) {
+        if (!software) {
+            glClearColor(r, g, b, a);
+            return;
+        }
+        clearValue[0] = r;
+        clearValue[1] = g;
+        clearValue[2] = b;
+        clearValue[3] = a;
+    }
+
+    void getClearColor(GLfloat out[4]) {
+        if (!software) {
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, out);
+            return;
+        }
+        std::copy(clearValue, clearValue + 4, out);
+    }
+
+    void clear() {
+        flush();
+        if (!software) {
+            glClear(GL_COLOR_BUFFER_BIT);
+            return;
+        }
+        unsigned char colour[4] = {colorToByte(clearValue[0]), colorToByte(clearValue[1]), colorToByte(clearValue[2]), colorToByte(clearValue[3])};
+        raster.clear(colour);
+    }
+
+    // 之后的绘制和清屏只影响这个像素矩形
+    void scissor(int x, int y, int width, int height) {
+        flush();
+        if (!software) {
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(x, y, width, height);
+            return;
+        }
+        raster.scissor(x, y, width, height);
+    }
+
+    void disableScissor() {
+        flush();
+        if (!software) {
+            glDisable(GL_SCISSOR_TEST);
+            return;
+        }
+        raster.disableScissor();
+    }
+
+    // 位图文字的起点，颜色取当前颜色；与glRasterPos相同，变换后在视口外时之后的字符都不画
+    void rasterPos(float x, float y) {
+        flush();
+        if (!software) {
+            glColor4ubv(currentColor);
+            glRasterPos2f(x, y);
+            return;
+        }
+        SoftwareRasterizer::Transform transform = pixelTransform();
+        rasterX = transform.sx * x + transform.tx;
+        rasterY = transform.sy * y + transform.ty;
+        rasterValid = rasterVisible(x, y);
+        std::copy(currentColor, currentColor + 4, rasterColour);
+    }
+
+    // 软件光栅化时rasterPos(x, y)是否有效
+    bool rasterVisible(float x, float y) const {
+        SoftwareRasterizer::Transform transform = pixelTransform();
+        float px = transform.sx * x + transform.tx, py = transform.sy * y + transform.ty;
+        return px >= 0 && px <= raster.width() && py >= 0 && py <= raster.height();
+    }
+
+    // 在光栅位置画一个位图字符，光栅位置右移字宽
+    void bitmapCharacter(void* font, int c) {
+        if (!software) {
+            textBitmapCharacter(font, c);
+            return;
+        }
+        BitmapGlyph glyph;
+        if (!rasterValid || !textBitmapGlyph(font, c, glyph)) return;
+        raster.drawBitmap(rasterX, rasterY, glyph, rasterColour);
+        rasterX += glyph.advance;
+    }
+
+    // 用当前颜色画一个笔画字符，然后平移到下一个字符。软件光栅化时线宽与GL一样是1像素，
+    // 可以再加宽widen（物体坐标，两端也各延长一半，相当于用方笔刷描边）；GL时不支持加宽
+    void strokeCharacter(void* font, int c, float widen = 0) {
+        if (!software) {
+            glColor4ubv(currentColor);
+            textStrokeCharacter(font, c);
+            return;
+        }
+        lineWidth = 1 / pixelTransform().sx + widen;
+        lineCap = widen / 2;
+        float advance = textStrokeGlyph(font, c, [this](const float* points, int count) {
+            begin(GL_LINE_STRIP);
+            for (int j = 0; j < count; j++) {
+                vertex(points[2 * j], points[2 * j + 1]);
+            }
+            end();
+        });
+        lineWidth = 1;
+        lineCap = 0;
+        translate(advance, 0);
+    }
+
+    // 软件光栅化用的纹理（行自下而上的RGBA像素），返回的编号用于bindTexture
+    GLuint softwareTexture(int width, int height, const unsigned char* rgba) {
+        return static_cast<GLuint>(raster.softwareTexture(width, height, rgba));
+    }
+
+    // 之后的图元使用这张纹理（0表示不贴图，颜色与纹理相乘）；换纹理会先画完之前的批次
+    void bindTexture(GLuint texture) {
+        if (texture == batchTexture) return;
+        flush();
+        batchTexture = texture;
+    }
+
+    // 用纹理区域贴一个矩形；同一图集里的区域连续画时只占一个批次
+    void texturedQuad(const TextureRegion& region, float x0, float y0, float x1, float y1) {
+        bindTexture(region.texture);
+        begin(GL_QUADS);
+        texCoord(region.u0, region.v1);
+        vertex(x0, y0);
+        texCoord(region.u1, region.v1);
+        vertex(x1, y0);
+        texCoord(region.u1, region.v0);
+        vertex(x1, y1);
+        texCoord(region.u0, region.v0);
+        vertex(x0, y1);
+        end();
+    }
+
+    void begin(GLenum mode) {
+        primitiveMode = mode;
+        primitive.clear();
+    }
+
+    void vertex(float x, float y) {
+        primitive.push_back({x, y, currentColor[0], currentColor[1], currentColor[2], currentColor[3],
+                             currentTexCoord[0], currentTexCoord[1]});
+    }
+
+    // 把当前图元转换成三角形加入批次
+    void end() {
+        std::vector<Vertex>& out = *target;
+        int n = static_cast<int>(primitive.size());
+        switch (primitiveMode) {
+            case GL_TRIANGLES:
+                out.insert(out.end(), primitive.begin(), primitive.begin() + n / 3 * 3);
+                break;
+            case GL_QUADS:
+                for (int i = 0; i + 3 < n; i += 4) {
+                    triangle(out, primitive[i], primitive[i + 1], primitive[i + 2]);
+                    triangle(out, primitive[i], primitive[i + 2], primitive[i + 3]);
+                }
+                break;
+            case GL_POLYGON:
+            case GL_TRIANGLE_FAN:
+                for (int i = 1; i + 1 < n; i++) {
+                    triangle(out, primitive[0], primitive[i], primitive[i + 1]);
+                }
+                break;
+            case GL_LINES:
+                for (int i = 0; i + 1 < n; i += 2) {
+                    line(out, primitive[i], primitive[i + 1], lineWidth, lineCap);
+                }
+                break;
+            case GL_LINE_STRIP:
+                for (int i = 0; i + 1 < n; i++) {
+                    line(out, primitive[i], primitive[i + 1], lineWidth, lineCap);
+                }
+                break;
+            case GL_POINTS:
+                for (const Vertex& v : primitive) {
+                    point(out, v, 1.0f);
+                }
+                break;
+        }
+        primitive.clear();
+    }
+
+    // 绘制批次中累积的三角形；直接调用GL（文字、矩阵变换等）之前必须先调用
+    void flush() {
+        if (target != &batch || batch.empty()) return;
+        draw(GL_TRIANGLES, batch.data(), static_cast<int>(batch.size()), batchTexture);
+        batch.clear();
+    }
+
+    // 直接绘制一组点（烟花粒子）
+    void drawPoints(const Vertex* vertices, int count, float size) {
+        flush();
+        if (software) {
+            raster.drawPoints(vertices, count, size, pixelTransform());
+            drawCalls++;
+            return;
+        }
+        glPointSize(size);
+        draw(GL_POINTS, vertices, count);
+    }
+
+    // 之后提交的图元记录到静态几何体中，而不是每帧的批次
+    void beginMesh(StaticMesh& mesh) {
+        flush();
+        mesh.vertices.clear();
+        target = &mesh.vertices;
+    }
+
+    void endMesh(StaticMesh& mesh) {
+        target = &batch;
+        mesh.count = static_cast<int>(mesh.vertices.size());
+        mesh.bounds = {0, 0, -1, -1};
+        for (int i = 0; i < mesh.count; i++) {
+            const Vertex& v = mesh.vertices[i];
+            if (i == 0) mesh.bounds = {v.x, v.y, v.x, v.y};
+            mesh.bounds = {std::min(mesh.bounds.x0, v.x), std::min(mesh.bounds.y0, v.y),
+                           std::max(mesh.bounds.x1, v.x), std::max(mesh.bounds.y1, v.y)};
+        }
+        if (glGenBuffersPtr == nullptr) return;
+        if (mesh.buffer == 0) glGenBuffersPtr(1, &mesh.buffer);
+        glBindBufferPtr(GL_ARRAY_BUFFER, mesh.buffer);
+        glBufferDataPtr(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(sizeof(Vertex)) * mesh.count, mesh.vertices.data(), GL_STATIC_DRAW);
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+        mesh.vertices.clear();
+        mesh.vertices.shrink_to_fit();
+    }
+
+    void drawMesh(const StaticMesh& mesh) {
+        flush();
+        if (mesh.buffer == 0) {
+            draw(GL_TRIANGLES, mesh.vertices.data(), mesh.count);
+            return;
+        }
+        glBindBufferPtr(GL_ARRAY_BUFFER, mesh.buffer);
+        drawBound(GL_TRIANGLES, 0, mesh.count);
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+    }
+
+private:
+    enum StreamMode { STREAM_CLIENT_ARRAYS, STREAM_BUFFER_SUBDATA, STREAM_PERSISTENT };
+    static const int RING_SEGMENTS = 3;  // 三段轮流使用，GPU读取一段时CPU写另一段
+    static const int SEGMENT_VERTICES = 1 << 16;  // 每帧最多流式上传的顶点数
+
+    StreamMode streamMode = STREAM_CLIENT_ARRAYS;
+    GLuint ringBuffer = 0;
+    Vertex* mapped = nullptr;
+    GLsync fences[RING_SEGMENTS] = {};
+    int segment = 0;
+    int segmentUsed = 0;  // 本帧已使用的顶点数
+
+    GLenum primitiveMode = GL_TRIANGLES;
+    unsigned char currentColor[4] = {255, 255, 255, 255};
+    float currentTexCoord[2] = {0, 0};
+    GLuint batchTexture = 0;  // 批次中三角形使用的纹理
+    std::vector<Vertex> primitive;  // 当前 begin/end 之间的顶点
+    std::vector<Vertex> batch;  // 本帧尚未绘制的三角形
+    std::vector<Vertex>* target = &batch;
+    float lineWidth = 1;  // 线转换成四边形时的宽度（物体坐标）
+    float lineCap = 0;  // 线的两端各延长多少
+
+    bool software = false;
+    SoftwareRasterizer raster;
+    SoftwareRasterizer::Transform matrix;  // 软件光栅化时的模型视图矩阵
+    std::vector<SoftwareRasterizer::Transform> matrixStack;
+    GLfloat clearValue[4] = {0, 0, 0, 0};
+    float rasterX = 0, rasterY = 0;
+    bool rasterValid = false;
+    unsigned char rasterColour[4] = {255, 255, 255, 255};
+
+    // 投影与gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT)相同，再铺满整个帧缓冲
+    SoftwareRasterizer::Transform pixelTransform() const {
+        SoftwareRasterizer::Transform projection{static_cast<float>(raster.width()) / WINDOW_WIDTH,
+                                                 static_cast<float>(raster.height()) / WINDOW_HEIGHT, 0, 0};
+        return projection * matrix;
+    }
+
+    static void triangle(std::vector<Vertex>& out, const Vertex& a, const Vertex& b, const Vertex& c) {
+        out.push_back(a);
+        out.push_back(b);
+        out.push_back(c);
+    }
+
+    // 线段转换为四边形，宽度通常是1像素
+    static void line(std::vector<Vertex>& out, const Vertex& a, const Vertex& b, float width, float cap) {
+        float dx = b.x - a.x, dy = b.y - a.y;
+        float length = std::sqrt(dx * dx + dy * dy);
+        if (length == 0) return;
+        float nx = -dy / length * 0.5f * width, ny = dx / length * 0.5f * width;
+        float ex = dx / length * cap, ey = dy / length * cap;
+        Vertex a0 = a, a1 = a, b0 = b, b1 = b;
+        a0.x -= ex; a0.y -= ey;
+        a1.x -= ex; a1.y -= ey;
+        b0.x += ex; b0.y += ey;
+        b1.x += ex; b1.y += ey;
+        a0.x += nx; a0.y += ny;
+        a1.x -= nx; a1.y -= ny;
+        b0.x += nx; b0.y += ny;
+        b1.x -= nx; b1.y -= ny;
+        triangle(out, a0, b0, b1);
+        triangle(out, a0, b1, a1);
+    }
+
+    static void point(std::vector<Vertex>& out, const Vertex& v, float size) {
+        float h = size / 2;
+        Vertex p0 = v, p1 = v, p2 = v, p3 = v;
+        p0.x -= h; p0.y -= h;
+        p1.x += h; p1.y -= h;
+        p2.x += h; p2.y += h;
+        p3.x -= h; p3.y += h;
+        triangle(out, p0, p1, p2);
+        triangle(out, p0, p2, p3);
+    }
+
+    // 把顶点写入环形缓冲区后绘制；放不下时退回客户端数组
+    void draw(GLenum mode, const Vertex* vertices, int count, GLuint texture = 0) {
+        if (count <= 0) return;
+        if (software) {
+            raster.drawTriangles(vertices, count, pixelTransform(), static_cast<int>(texture));
+            drawCalls++;
+            return;
+        }
+        if (streamMode == STREAM_CLIENT_ARRAYS || segmentUsed + count > SEGMENT_VERTICES) {
+            drawClientArrays(mode, vertices, count, texture);
+            return;
+        }
+        int first = segment * SEGMENT_VERTICES + segmentUsed;
+        glBindBufferPtr(GL_ARRAY_BUFFER, ringBuffer);
+        if (streamMode == STREAM_PERSISTENT) {
+            std::copy(vertices, vertices + count, mapped + first);
+        } else {
+            glBufferSubDataPtr(GL_ARRAY_BUFFER, static_cast<GLintptr>(sizeof(Vertex)) * first,
+                               static_cast<GLsizeiptr>(sizeof(Vertex)) * count, vertices);
+        }
+        segmentUsed += count;
+        drawBound(mode, first, count, texture);
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+    }
+
+    void drawBound(GLenum mode, int first, int count, GLuint texture = 0) {
+        drawArrays(mode, 0, first, count, texture);
+    }
+
+    void drawClientArrays(GLenum mode, const Vertex* vertices, int count, GLuint texture) {
+        drawArrays(mode, reinterpret_cast<uintptr_t>(vertices), 0, count, texture);
+    }
+
+    // base为0时属性指针是绑定的VBO中的偏移
+    void drawArrays(GLenum mode, uintptr_t base, int first, int count, GLuint texture) {
+        auto attribute = [base](size_t offset) { return reinterpret_cast<const void*>(base + offset); };
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(Vertex), attribute(offsetof(Vertex, x)));
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), attribute(offsetof(Vertex, r)));
+        if (texture != 0) {
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+            glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), attribute(offsetof(Vertex, u)));
+        }
+        glDrawArrays(mode, first, count);
+        if (texture != 0) {
+            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glDisable(GL_TEXTURE_2D);
+        }
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        drawCalls++;
+    }
+};
+Renderer renderer;
+
+// 脏矩形：每帧各个会变化的物体报告自己画在哪里（世界坐标的外接矩形）和画成什么样（状态的散列），
+// 与上一帧逐项比较，变化了的物体的旧位置和新位置都要重画。受损的图块合并成少数几个像素矩形，
+// 每个矩形裁剪后清屏并重画整个场景。物体数量变化、视口变化、受损面积太大时整帧重画
+class DamageTracker {
+public:
+    static const int TILE = 16;  // 受损区域按图块记录（像素）
+    static const int MAX_RECTS = 8;  // 每个矩形都要重画一遍场景，太多时合并
+    static const int MARGIN = 2;  // 线和点会超出几何外接矩形一点
+    static constexpr float FULL_REDRAW_FRACTION = 0.6f;  // 受损面积超过这个比例就整帧重画
+
+    struct Rect {
+        int x0, y0, x1, y1;  // 像素坐标，左下角为原点
+        long long area() const {
+            return static_cast<long long>(x1 - x0) * (y1 - y0);
+        }
+    };
+
+    // 状态的散列：FNV-1a，逐个混入影响绘制结果的值
+    class State {
+    public:
+        State& operator<<(float value) {
+            unsigned char bytes[sizeof(float)];
+            std::memcpy(bytes, &value, sizeof(value));
+            for (unsigned char byte : bytes) {
+                hash = (hash ^ byte) * 16777619u;
+            }
+            return *this;
+        }
+        operator unsigned() const {
+            return hash;
+        }
+    private:
+        unsigned hash = 2166136261u;
+    };
+
+    void report(float x0, float y0, float x1, float y1, unsigned state) {
+        current.push_back({x0, y0, x1, y1, state});
+    }
+
+    // 本帧窗口里看到的世界范围（镜头的视野），报告的矩形按它换算成像素
+    void setView(const Bounds& bounds) {
+        view = bounds;
+    }
+
+    // 本帧不画的物体也占一项，保持前后两帧逐项对应
+    void reportNothing() {
+        current.push_back({0, 0, -1, -1, 0});
+    }
+
+    // 下一次整帧重画（画布重建、分析器显示等）
+    void invalidate() {
+        full = true;
+    }
+
+    // 结束本帧的报告，把需要重画的像素矩形写入rects（可能为空，表示画面没变）；返回false表示整帧重画
+    bool resolve(const GLint viewport[4], std::vector<Rect>& rects) {
+        rects.clear();
+        bool partial = !full && previous.size() == current.size() && std::equal(viewport, viewport + 4, lastViewport);
+        full = false;
+        std::copy(viewport, viewport + 4, lastViewport);
+        if (partial) {
+            markTiles(viewport);
+            buildRects(viewport, rects);
+            long long damaged = 0;
+            for (const Rect& rect : rects) damaged += rect.area();
+            partial = damaged <= static_cast<long long>(FULL_REDRAW_FRACTION * viewport[2] * viewport[3]);
+        }
+        previous.swap(current);
+        current.clear();
+        return partial;
+    }
+
+private:
+    struct Item {
+        float x0, y0, x1, y1;
+        unsigned state;
+    };
+
+    std::vector<Item> previous, current;
+    std::vector<unsigned char> tiles;
+    int columns = 0, rows = 0;
+    GLint lastViewport[4] = {};
+    Bounds view = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+    bool full = true;
+
+    void markTiles(const GLint viewport[4]) {
+        columns = (viewport[2] + TILE - 1) / TILE;
+        rows = (viewport[3] + TILE - 1) / TILE;
+        tiles.assign(static_cast<size_t>(columns) * rows, 0);
+        float scaleX = viewport[2] / (view.x1 - view.x0);
+        float scaleY = viewport[3] / (view.y1 - view.y0);
+        auto mark = [&](const Item& item) {
+            int x0 = static_cast<int>(std::floor((item.x0 - view.x0) * scaleX)) - MARGIN;
+            int y0 = static_cast<int>(std::floor((item.y0 - view.y0) * scaleY)) - MARGIN;
+            int x1 = static_cast<int>(std::ceil((item.x1 - view.x0) * scaleX)) + MARGIN;
+            int y1 = static_cast<int>(std::ceil((item.y1 - view.y0) * scaleY)) + MARGIN;
+            if (x1 < 0 || y1 < 0 || x0 >= viewport[2] || y0 >= viewport[3]) return;  // 完全在屏幕外
+            x0 = std::max(x0, 0) / TILE;
+            y0 = std::max(y0, 0) / TILE;
+            x1 = std::min(x1 / TILE, columns - 1);
+            y1 = std::min(y1 / TILE, rows - 1);
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    tiles[static_cast<size_t>(y) * columns + x] = 1;
+                }
+            }
+        };
+        for (size_t i = 0; i < current.size(); i++) {
+            const Item& before = previous[i];
+            const Item& now = current[i];
+            if (before.state == now.state && before.x0 == now.x0 && before.y0 == now.y0 && before.x1 == now.x1 && before.y1 == now.y1) {
+                continue;
+            }
+            mark(before);
+            mark(now);
+        }
+    }
+
+    // 每行相邻的受损图块连成一段，和上一行位置相同的段向上延长；矩形还太多时反复合并增加面积最少的一对
+    void buildRects(const GLint viewport[4], std::vector<Rect>& rects) {
+        for (int y = 0; y < rows; y++) {
+            size_t rowStart = rects.size();
+            for (int x = 0; x < columns; ) {
+                if (!tiles[static_cast<size_t>(y) * columns + x]) {
+                    x++;
+                    continue;
+                }
+                int start = x;
+                while (x < columns && tiles[static_cast<size_t>(y) * columns + x]) x++;
+                Rect rect = {start * TILE, y * TILE, std::min(x * TILE, viewport[2]), std::min((y + 1) * TILE, viewport[3])};
+                auto above = std::find_if(rects.begin(), rects.begin() + rowStart, [&](const Rect& r) {
+                    return r.x0 == rect.x0 && r.x1 == rect.x1 && r.y1 == rect.y0;
+                });
+                if (above != rects.begin() + rowStart) {
+                    above->y1 = rect.y1;
+                } else {
+                    rects.push_back(rect);
+                }
+            }
+        }
+        while (rects.size() > MAX_RECTS) {
+            size_t bestA = 0, bestB = 1;
+            long long bestCost = -1;
+            for (size_t a = 0; a < rects.size(); a++) {
+                for (size_t b = a + 1; b < rects.size(); b++) {
+                    long long cost = merged(rects[a], rects[b]).area() - rects[a].area() - rects[b].area();
+                    if (bestCost < 0 || cost < bestCost) {
+                        bestCost = cost;
+                        bestA = a;
+                        bestB = b;
+                    }
+                }
+            }
+            rects[bestA] = merged(rects[bestA], rects[bestB]);
+            rects.erase(rects.begin() + bestB);
+        }
+        for (Rect& rect : rects) {
+            rect.x0 += viewport[0];
+            rect.x1 += viewport[0];
+            rect.y0 += viewport[1];
+            rect.y1 += viewport[1];
+        }
+    }
+
+    static Rect merged(const Rect& a, const Rect& b) {
+        return {std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)};
+    }
+};
+DamageTracker damageTracker;
+
+// 位图字体的字形图集：启动时把每个字符用glBitmap画进一张纹理一次，
+// 之后每个字符只是渲染器批次里的一个贴图四边形，整段文字一次绘制
+class GlyphAtlas {
+public:
+    explicit GlyphAtlas(void* font) : font(font) {}
+
+    // 与glBitmap相同，字形放在笔位置向下取整的像素上，返回字宽；笔位置是glRasterPos那样的基线原点
+    float drawCharacter(int c, float x, float y) {
+        if (c < 1 || c >= GLYPHS) return 0;
+        if (texture == 0) build();
+        const Glyph& glyph = glyphs[c];
+        if (glyph.width > 0) {
+            float x0 = std::floor(x + 0.0001f) + glyph.left, y0 = std::floor(y + 0.0001f) + glyph.bottom;
+            renderer.texturedQuad(glyph.region, x0, y0, x0 + glyph.width, y0 + glyph.height);
+        }
+        return static_cast<float>(glyph.advance);
+    }
+
+    int advance(int c) {
+        if (c < 1 || c >= GLYPHS) return 0;
+        if (texture == 0) build();
+        return glyphs[c].advance;
+    }
+
+    // 在init里调用：没有帧缓冲对象时生成图集要借用后缓冲，不能在一帧画到一半时做
+    void prepare() {
+        if (texture == 0) build();
+    }
+
+private:
+    static const int GLYPHS = 128;
+    static const int PADDING = 4;  // 字形相对原点的偏移（xorig/yorig）不超过这个值
+
+    struct Glyph {
+        TextureRegion region;  // v0在上，与texturedQuad的约定一致
+        int advance = 0;
+        int left = 0, bottom = 0;  // 有像素部分的左下角相对笔位置的偏移
+        int width = 0, height = 0;  // 有像素部分的大小，空格等为0
+    };
+
+    void* font;
+    GLuint texture = 0;
+    Glyph glyphs[GLYPHS];
+
+    void build() {
+        int height = textBitmapHeight(font) + 2 * PADDING;
+        int positions[GLYPHS][2] = {};
+        int size = 128;
+        for (bool packed = false; !packed; size *= 2) {
+            SkylinePacker packer(size, size);
+            packed = true;
+            for (int c = 1; c < GLYPHS && packed; c++) {
+                glyphs[c].advance = textBitmapWidth(font, c);
+                glyphs[c].width = glyphs[c].advance + 2 * PADDING;
+                glyphs[c].height = height;
+                packed = packer.insert(glyphs[c].width, height, positions[c][0], positions[c][1]);
+            }
+            if (packed) break;
+        }
+
+        std::vector<unsigned char> pixels(static_cast<size_t>(size) * size * 4);
+        if (renderer.softwareMode()) {
+            drawGlyphsSoftware(size, positions, pixels);
+        } else {
+            drawGlyphs(size, positions, pixels);
+        }
+
+        // 把每个格子收缩到有像素的范围，四边形不再覆盖空白，填充的像素少得多
+        for (int c = 1; c < GLYPHS; c++) {
+            Glyph& glyph = glyphs[c];
+            int x0 = glyph.width, y0 = glyph.height, x1 = 0, y1 = 0;
+            for (int y = 0; y < glyph.height; y++) {
+                for (int x = 0; x < glyph.width; x++) {
+                    if (pixels[(static_cast<size_t>(positions[c][1] + y) * size + positions[c][0] + x) * 4 + 3] == 0) continue;
+                    x0 = std::min(x0, x);
+                    y0 = std::min(y0, y);
+                    x1 = std::max(x1, x + 1);
+                    y1 = std::max(y1, y + 1);
+                }
+            }
+            if (x1 <= x0) {
+                glyph.width = glyph.height = 0;
+                continue;
+            }
+            glyph.left = x0 - PADDING;
+            glyph.bottom = y0 - PADDING;
+            glyph.width = x1 - x0;
+            glyph.height = y1 - y0;
+            glyph.region.texture = texture;
+            glyph.region.u0 = static_cast<float>(positions[c][0] + x0) / size;
+            glyph.region.u1 = static_cast<float>(positions[c][0] + x1) / size;
+            glyph.region.v0 = static_cast<float>(positions[c][1] + y1) / size;
+            glyph.region.v1 = static_cast<float>(positions[c][1] + y0) / size;
+        }
+    }
+
+    // 用GL把字形画进纹理，再读回像素
+    void drawGlyphs(int size, const int positions[][2], std::vector<unsigned char>& pixels) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);  // 位图字体按像素对齐，不要过滤
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // 有帧缓冲对象时直接画进纹理；否则画在后缓冲左下角再复制，第一帧整帧重画时会被清掉。
+        // 后缓冲（按视口的大小算）比图集小时分块画、分块复制
+        GLuint framebuffer = 0;
+        GLint previousFramebuffer = 0;
+        if (glGenFramebuffersPtr != nullptr) {
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+            glGenFramebuffersPtr(1, &framebuffer);
+            glBindFramebufferPtr(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferTexture2DPtr(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+            if (glCheckFramebufferStatusPtr(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                glBindFramebufferPtr(GL_FRAMEBUFFER, previousFramebuffer);
+                glDeleteFramebuffersPtr(1, &framebuffer);
+                framebuffer = 0;
+            }
+        }
+        int blockWidth = size, blockHeight = size;
+        if (framebuffer == 0) {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            blockWidth = std::max(1, std::min(size, static_cast<int>(viewport[2])));
+            blockHeight = std::max(1, std::min(size, static_cast<int>(viewport[3])));
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glPushAttrib(GL_ALL_ATTRIB_BITS);
+        glDisable(GL_SCISSOR_TEST);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        glDisable(GL_BLEND);
+        glViewport(0, 0, blockWidth, blockHeight);
+        glClearColor(0, 0, 0, 0);
+        glColor4f(1, 1, 1, 1);
+        for (int blockY = 0; blockY < size; blockY += blockHeight) {
+            for (int blockX = 0; blockX < size; blockX += blockWidth) {
+                glMatrixMode(GL_PROJECTION);
+                glLoadIdentity();
+                glOrtho(blockX, blockX + blockWidth, blockY, blockY + blockHeight, -1, 1);
+                glMatrixMode(GL_MODELVIEW);
+                glClear(GL_COLOR_BUFFER_BIT);
+                for (int c = 1; c < GLYPHS; c++) {
+                    // 光栅位置先放在块的角上（总是有效的），再用空位图移到字形原点，原点在块外时字形仍会画出在块内的部分
+                    glRasterPos2i(blockX, blockY);
+                    glBitmap(0, 0, 0, 0, static_cast<GLfloat>(positions[c][0] + PADDING - blockX),
+                             static_cast<GLfloat>(positions[c][1] + PADDING - blockY), nullptr);
+                    textBitmapCharacter(font, c);
+                }
+                if (framebuffer == 0) {
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, blockX, blockY, 0, 0, std::min(blockWidth, size - blockX),
+                                        std::min(blockHeight, size - blockY));
+                    glBindTexture(GL_TEXTURE_2D, 0);
+                }
+            }
+        }
+        if (framebuffer != 0) {
+            glBindFramebufferPtr(GL_FRAMEBUFFER, previousFramebuffer);
+            glDeleteFramebuffersPtr(1, &framebuffer);
+        }
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glPopAttrib();
+
+        // 读回一次，用来收缩每个格子
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        if (framebuffer == 0) {
+            // 后缓冲不一定有alpha通道，复制来的alpha可能都是1；字形是黑底白字，改用红色作为alpha
+            for (size_t i = 0; i < pixels.size(); i += 4) {
+                pixels[i + 3] = pixels[i];
+                pixels[i] = pixels[i + 1] = pixels[i + 2] = 255;
+            }
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        }
+        glPopClientAttrib();
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // 软件光栅化时在CPU上画同样的一张图集
+    void drawGlyphsSoftware(int size, const int positions[][2], std::vector<unsigned char>& pixels) {
+        SoftwareRasterizer canvas;
+        canvas.resize(size, size);
+        const unsigned char transparent[4] = {0, 0, 0, 0}, white[4] = {255, 255, 255, 255};
+        canvas.clear(transparent);
+        for (int c = 1; c < GLYPHS; c++) {
+            BitmapGlyph glyph;
+            if (textBitmapGlyph(font, c, glyph)) {
+                canvas.drawBitmap(static_cast<float>(positions[c][0] + PADDING), static_cast<float>(positions[c][1] + PADDING), glyph, white);
+            }
+        }
+        canvas.finish();
+        canvas.read(pixels.data());
+        texture = renderer.softwareTexture(size, size, pixels.data());
+    }
+};
+GlyphAtlas letterGlyphs(GLUT_BITMAP_HELVETICA_10);
+
+// 文字排版缓存：字形位置和换行只在文字、字体或宽度变化时计算，结果相对于原点保存，
+// 移动信纸只需要在绘制时加上新的原点。文字改动时按段落（以换行符分隔）比较，只重排改动的段落；
+// 第一段的起点取决于全文最长的一行，所以它在最长行变化时也会重排
+class TextLayout {
+public:
+    struct Glyph {
+        int c;
+        float x;  // 相对原点的笔位置
+    };
+    struct Line {
+        float x, y;  // 行首的笔位置（相对原点），决定这一行是否可见
+        int first, count;  // glyphs中的范围
+    };
+
+    int reflowCount = 0;  // 重排过的段落数（性能测试用）
+
+    // 与原来的逐字排版相同：第一行从-最长行/2开始，其余行从-width/2开始，行距20；
+    // 一个字放下后超出右边就换行，换行后笔位置从左边开始，而宽度检查仍多算这个字
+    void update(const char* text, GlyphAtlas& font, float width) {
+        if (&font == layoutFont && width == layoutWidth && source == text) return;
+        if (&font != layoutFont || width != layoutWidth) paragraphs.clear();
+        layoutFont = &font;
+        layoutWidth = width;
+        source = text;
+
+        std::vector<Paragraph> previous;
+        previous.swap(paragraphs);
+        float longest = 0;
+        for (size_t start = 0; start <= source.size(); ) {
+            size_t end = std::min(source.find('\n', start), source.size());
+            Paragraph paragraph;
+            paragraph.text = source.substr(start, end - start);
+            paragraph.width = 0;
+            for (char c : paragraph.text) paragraph.width += font.advance(c);
+            longest = std::max(longest, paragraph.width);
+            paragraphs.push_back(std::move(paragraph));
+            start = end + 1;
+        }
+
+        lines.clear();
+        glyphs.clear();
+        float y = 0;
+        for (size_t i = 0; i < paragraphs.size(); i++) {
+            Paragraph& paragraph = paragraphs[i];
+            float startX = i == 0 ? -longest / 2 : -width / 2;
+            const Paragraph* reuse = nullptr;
+            for (const Paragraph& old : previous) {
+                if (old.startX == startX && old.text == paragraph.text) {
+                    reuse = &old;
+                    break;
+                }
+            }
+            if (reuse != nullptr) {
+                paragraph.lines = reuse->lines;
+                paragraph.glyphs = reuse->glyphs;
+                paragraph.startX = startX;
+            } else {
+                flow(paragraph, font, startX, width);
+            }
+            for (const Line& line : paragraph.lines) {
+                lines.push_back({line.x, y + line.y, static_cast<int>(glyphs.size()) + line.first, line.count});
+            }
+            glyphs.insert(glyphs.end(), paragraph.glyphs.begin(), paragraph.glyphs.end());
+            y -= 20 * paragraph.lines.size();
+        }
+    }
+
+    const std::vector<Line>& layoutLines() const {
+        return lines;
+    }
+
+    const std::vector<Glyph>& layoutGlyphs() const {
+        return glyphs;
+    }
+
+private:
+    struct Paragraph {
+        std::string text;
+        float width = 0;  // 不换行时的宽度
+        float startX = 0;
+        std::vector<Line> lines;  // y相对段落第一行
+        std::vector<Glyph> glyphs;
+    };
+
+    std::string source;
+    const GlyphAtlas* layoutFont = nullptr;
+    float layoutWidth = 0;
+    std::vector<Paragraph> paragraphs;
+    std::vector<Line> lines;
+    std::vector<Glyph> glyphs;
+
+    void flow(Paragraph& paragraph, GlyphAtlas& font, float startX, float width) {
+        reflowCount++;
+        paragraph.startX = startX;
+        paragraph.lines.assign(1, {startX, 0, 0, 0});
+        paragraph.glyphs.clear();
+        float textX = startX, penX = startX;
+        for (char c : paragraph.text) {
+            int advance = font.advance(c);
+            paragraph.glyphs.push_back({c, penX});
+            paragraph.lines.back().count++;
+            penX += advance;
+            if (textX + advance > width / 2) {
+                Line line = {-width / 2, paragraph.lines.back().y - 20, static_cast<int>(paragraph.glyphs.size()), 0};
+                paragraph.lines.push_back(line);
+                textX = -width / 2;
+                penX = textX;
+            }
+            textX += advance;
+        }
+    }
+};
+
+const char* SDF_VERTEX_SHADER =
+        "#version 120\n"
+        "void main() {\n"
+        "    gl_Position = ftransform();\n"
+        "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+        "    gl_FrontColor = gl_Color;\n"
+        "}\n";
+
+// 纹理里存的是到笔画中心线的距离；填充和描边各取一个阈值，fwidth给出当前缩放下一个像素的宽度用于抗锯齿。
+// 距离在spread处饱和，阈值加上抗锯齿的过渡带不能超过spread，否则远处的像素都会算成半透明，整个四边形显出来
+const char* SDF_FRAGMENT_SHADER =
+        "#version 120\n"
+        "uniform sampler2D distanceField;\n"
+        "uniform float spread;\n"
+        "uniform float fillRadius;\n"
+        "uniform float outlineRadius;\n"
+        "uniform vec4 outlineColour;\n"
+        "void main() {\n"
+        "    float d = texture2D(distanceField, gl_TexCoord[0].st).a * spread;\n"
+        "    float aa = max(fwidth(d) * 0.5, 0.0001);\n"
+        "    float limit = spread - aa;\n"
+        "    float fillAt = min(fillRadius, limit), outlineAt = min(outlineRadius, limit);\n"
+        "    float fill = 1.0 - smoothstep(fillAt - aa, fillAt + aa, d);\n"
+        "    float outline = 1.0 - smoothstep(outlineAt - aa, outlineAt + aa, d);\n"
+        "    vec4 colour = mix(outlineColour, gl_Color, fill);\n"
+        "    gl_FragColor = vec4(colour.rgb, colour.a * max(fill, outline));\n"
+        "}\n";
+
+// 笔画字体到笔画中心线的距离场（无符号）：初始化时用反馈模式（GL_FEEDBACK）截获每个字符画出的线段，
+// 对图集的每个像素算出到最近线段的距离。笔画字体的字形只是一组没有宽度的线段，没有封闭轮廓，
+// 分不出里外，所以有向距离场用不上；笔画的粗细由填充阈值决定，描边是更大的阈值。
+// 之后填充和任意宽度的描边在一个着色器里一次画完，放大缩小都保持边缘平滑。不支持着色器时ready()为false，调用者退回原来的画法
+class SDFFont {
+public:
+    static constexpr float UNITS_PER_TEXEL = 2.0f;  // 距离场的分辨率（字体单位）
+    static constexpr float SPREAD = 24.0f;  // 能表示的最大距离，也是描边半径的上限（字体单位）
+
+    explicit SDFFont(void* font) : font(font) {}
+
+    bool ready() {
+        if (!built) build();
+        return program != 0;
+    }
+
+    // 一个场景单位是一个像素时能画出的最宽描边（场景单位）：距离场只存到SPREAD，还要留出一个像素的抗锯齿过渡
+    static float maxOutline(float scale) {
+        return std::max(SPREAD * scale - 0.5f - 1.0f, 0.0f);
+    }
+
+    // 与textStrokeLength相同，单位是字体单位（多行取最长的一行）
+    float length(const char* text) {
+        if (!built) build();
+        float length = 0, line = 0;
+        for (const char* c = text; *c != '\0'; c++) {
+            if (*c == '\n') {
+                length = std::max(length, line);
+                line = 0;
+            } else if (*c > 0 && *c < GLYPHS) {
+                line += glyphs[static_cast<int>(*c)].advance;
+            }
+        }
+        return std::max(length, line);
+    }
+
+    // 在基线原点(x, y)画一行文字；scale为每个字体单位对应的场景单位，填充色取renderer的当前颜色，
+    // 笔画宽一个场景单位（与原来的线宽1像素相同），outline是描边宽度（场景单位），0表示不描边。
+    // 描边最宽是maxOutline(scale)，再宽的部分被截掉（着色器里限制阈值，不会画出整块的四边形）
+    void draw(const char* text, float x, float y, float scale, float outline, float r, float g, float b) {
+        if (!ready()) return;
+        renderer.flush();
+        glUseProgramPtr(program);
+        glUniform1fPtr(spreadLocation, SPREAD);
+        glUniform1fPtr(fillLocation, 0.5f / scale);
+        glUniform1fPtr(outlineLocation, (0.5f + outline) / scale);
+        glUniform4fPtr(outlineColourLocation, r, g, b, outline > 0 ? 1.0f : 0.0f);
+        float pen = 0;
+        for (const char* c = text; *c != '\0'; c++) {
+            if (*c <= 0 || *c >= GLYPHS) continue;
+            const Glyph& glyph = glyphs[static_cast<int>(*c)];
+            if (glyph.region.texture != 0) {
+                float x0 = x + (pen + glyph.left) * scale, y0 = y + glyph.bottom * scale;
+                renderer.texturedQuad(glyph.region, x0, y0, x0 + glyph.width * scale, y0 + glyph.height * scale);
+            }
+            pen += glyph.advance;
+        }
+        renderer.bindTexture(0);
+        glUseProgramPtr(0);
+    }
+
+private:
+    static const int GLYPHS = 128;
+
+    struct Segment {
+        float x0, y0, x1, y1;
+    };
+    struct Glyph {
+        TextureRegion region;  // 没有笔画的字符（空格）texture为0
+        float advance = 0;
+        float left = 0, bottom = 0, width = 0, height = 0;  // 距离场覆盖的矩形（字体单位，相对笔位置）
+    };
+
+    void* font;
+    bool built = false;
+    GLuint program = 0;
+    GLint spreadLocation = -1, fillLocation = -1, outlineLocation = -1, outlineColourLocation = -1;
+    Glyph glyphs[GLYPHS];
+
+    // 在一次反馈模式（GL_FEEDBACK）里画出所有字符，收集窗口坐标里的线段；每个字符前插一个
+    // glPassThrough标记来分开。投影设成窗口坐标等于物体坐标，原点移到ORIGIN避免被裁剪
+    void captureSegments(std::vector<Segment> segments[GLYPHS]) {
+        const float ORIGIN = 256.0f;
+        std::vector<GLfloat> buffer(1 << 18);
+        glFeedbackBuffer(static_cast<GLsizei>(buffer.size()), GL_2D, buffer.data());
+        glRenderMode(GL_FEEDBACK);
+        for (int c = 1; c < GLYPHS; c++) {
+            glLoadIdentity();
+            glTranslatef(ORIGIN, ORIGIN, 0);
+            glPassThrough(static_cast<GLfloat>(c));
+            textStrokeCharacter(font, c);
+            GLfloat modelview[16];
+            glGetFloatv(GL_MODELVIEW_MATRIX, modelview);  // 字符画完后平移了字宽
+            glyphs[c].advance = modelview[12] - ORIGIN;
+        }
+        int count = glRenderMode(GL_RENDER);
+
+        int c = 0;
+        for (int i = 0; i < count; ) {
+            GLenum token = static_cast<GLenum>(buffer[i++]);
+            if (token == GL_PASS_THROUGH_TOKEN) {
+                c = static_cast<int>(buffer[i++]);
+            } else if (token == GL_LINE_TOKEN || token == GL_LINE_RESET_TOKEN) {
+                segments[c].push_back({buffer[i] - ORIGIN, buffer[i + 1] - ORIGIN, buffer[i + 2] - ORIGIN, buffer[i + 3] - ORIGIN});
+                i += 4;
+            } else if (token == GL_POLYGON_TOKEN) {
+                i += 1 + static_cast<int>(buffer[i]) * 2;
+            } else {
+                i += 2;  // 点、位图和像素操作都只有一个顶点
+            }
+        }
+    }
+
+    static float segmentDistanceSquared(const Segment& s, float px, float py) {
+        float dx = s.x1 - s.x0, dy = s.y1 - s.y0;
+        float lengthSquared = dx * dx + dy * dy;
+        float t = lengthSquared > 0 ? std::min(std::max(((px - s.x0) * dx + (py - s.y0) * dy) / lengthSquared, 0.0f), 1.0f) : 0.0f;
+        float ex = s.x0 + t * dx - px, ey = s.y0 + t * dy - py;
+        return ex * ex + ey * ey;
+    }
+
+    void build() {
+        built = true;
+        if (glCreateShaderPtr == nullptr || glUniform4fPtr == nullptr) return;
+        program = compileProgram(SDF_VERTEX_SHADER, SDF_FRAGMENT_SHADER, nullptr);
+        if (program == 0) return;
+        spreadLocation = glGetUniformLocationPtr(program, "spread");
+        fillLocation = glGetUniformLocationPtr(program, "fillRadius");
+        outlineLocation = glGetUniformLocationPtr(program, "outlineRadius");
+        outlineColourLocation = glGetUniformLocationPtr(program, "outlineColour");
+
+        std::vector<Segment> segments[GLYPHS];
+        int cells[GLYPHS][2] = {};
+        glPushAttrib(GL_ALL_ATTRIB_BITS);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0, 1024, 0, 1024, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glViewport(0, 0, 1024, 1024);
+        captureSegments(segments);
+        for (int c = 1; c < GLYPHS; c++) {
+            Glyph& glyph = glyphs[c];
+            if (segments[c].empty()) continue;
+            float minX = segments[c][0].x0, maxX = minX, minY = segments[c][0].y0, maxY = minY;
+            for (const Segment& s : segments[c]) {
+                minX = std::min({minX, s.x0, s.x1});
+                maxX = std::max({maxX, s.x0, s.x1});
+                minY = std::min({minY, s.y0, s.y1});
+                maxY = std::max({maxY, s.y0, s.y1});
+            }
+            cells[c][0] = static_cast<int>(std::ceil((maxX - minX + 2 * SPREAD) / UNITS_PER_TEXEL));
+            cells[c][1] = static_cast<int>(std::ceil((maxY - minY + 2 * SPREAD) / UNITS_PER_TEXEL));
+            glyph.left = minX - SPREAD;
+            glyph.bottom = minY - SPREAD;
+            glyph.width = cells[c][0] * UNITS_PER_TEXEL;
+            glyph.height = cells[c][1] * UNITS_PER_TEXEL;
+        }
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        glPopAttrib();
+
+        // 格子之间空一个像素，线性过滤不会采到相邻字符
+        int positions[GLYPHS][2] = {};
+        int size = 256;
+        for (bool packed = false; !packed; size *= 2) {
+            SkylinePacker packer(size, size);
+            packed = true;
+            for (int c = 1; c < GLYPHS && packed; c++) {
+                if (cells[c][0] == 0) continue;
+                packed = packer.insert(cells[c][0] + 1, cells[c][1] + 1, positions[c][0], positions[c][1]);
+            }
+            if (packed) break;
+        }
+
+        // 每条线段只更新它周围SPREAD范围内的像素，比每个像素遍历所有线段快得多
+        std::vector<unsigned char> field(static_cast<size_t>(size) * size, 255);
+        std::vector<float> nearest;
+        for (int c = 1; c < GLYPHS; c++) {
+            if (cells[c][0] == 0) continue;
+            const Glyph& glyph = glyphs[c];
+            int columns = cells[c][0], rows = cells[c][1];
+            nearest.assign(static_cast<size_t>(columns) * rows, SPREAD * SPREAD);
+            for (const Segment& s : segments[c]) {
+                int tx0 = std::max(0, static_cast<int>((std::min(s.x0, s.x1) - SPREAD - glyph.left) / UNITS_PER_TEXEL));
+                int tx1 = std::min(columns - 1, static_cast<int>((std::max(s.x0, s.x1) + SPREAD - glyph.left) / UNITS_PER_TEXEL));
+                int ty0 = std::max(0, static_cast<int>((std::min(s.y0, s.y1) - SPREAD - glyph.bottom) / UNITS_PER_TEXEL));
+                int ty1 = std::min(rows - 1, static_cast<int>((std::max(s.y0, s.y1) + SPREAD - glyph.bottom) / UNITS_PER_TEXEL));
+                for (int ty = ty0; ty <= ty1; ty++) {
+                    float py = glyph.bottom + (ty + 0.5f) * UNITS_PER_TEXEL;
+                    for (int tx = tx0; tx <= tx1; tx++) {
+                        float px = glyph.left + (tx + 0.5f) * UNITS_PER_TEXEL;
+                        float& value = nearest[static_cast<size_t>(ty) * columns + tx];
+                        value = std::min(value, segmentDistanceSquared(s, px, py));
+                    }
+                }
+            }
+            for (int ty = 0; ty < rows; ty++) {
+                for (int tx = 0; tx < columns; tx++) {
+                    float distance = std::sqrt(nearest[static_cast<size_t>(ty) * columns + tx]);
+                    field[static_cast<size_t>(positions[c][1] + ty) * size + positions[c][0] + tx] =
+                            static_cast<unsigned char>(distance / SPREAD * 255.0f + 0.5f);
+                }
+            }
+        }
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA8, size, size, 0, GL_ALPHA, GL_UNSIGNED_BYTE, field.data());
+        glPopClientAttrib();
+        setTextureFilters();
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        for (int c = 1; c < GLYPHS; c++) {
+            if (cells[c][0] == 0) continue;
+            TextureRegion& region = glyphs[c].region;
+            region.texture = texture;
+            region.u0 = static_cast<float>(positions[c][0]) / size;
+            region.u1 = static_cast<float>(positions[c][0] + cells[c][0]) / size;
+            region.v0 = static_cast<float>(positions[c][1] + cells[c][1]) / size;  // 距离场按y向上存放
+            region.v1 = static_cast<float>(positions[c][1]) / size;
+        }
+    }
+};
+SDFFont bannerFont(GLUT_STROKE_ROMAN);
+
+struct ShapeAttribute {
+    const char* name;  // 着色器中的属性名
+    int size;  // 浮点数个数
+};
+
+const char* SHAPE_FRAGMENT_SHADER =
+        "#version 120\n"
+        "varying vec4 fragColour;\n"
+        "void main() { gl_FragColor = fragColour; }\n";
+
+// 实例化绘制：每种形状只有一个单位网格，加上每个实例的属性（位置、缩放、颜色等），
+// 一次 glDrawArraysInstanced 画出该形状的全部实例
+class InstancedShape {
+public:
+    static bool supported() {
+        return glDrawArraysInstancedPtr != nullptr && glVertexAttribDivisorPtr != nullptr
+               && glCreateShaderPtr != nullptr && glGenBuffersPtr != nullptr;
+    }
+
+    bool ready() const {
+        return program != 0;
+    }
+
+    // 网格的第一个属性是顶点位置；不支持实例化时返回false，调用者退回逐个绘制
+    bool init(const char* vertexSource, const std::vector<ShapeAttribute>& meshAttributes, const std::vector<float>& mesh,
+              const std::vector<ShapeAttribute>& instanceAttributes) {
+        if (!supported()) return false;
+        program = compileProgram(vertexSource, SHAPE_FRAGMENT_SHADER, meshAttributes[0].name);
+        if (program == 0) return false;
+        meshLayout = bindLayout(meshAttributes, meshStride);
+        instanceLayout = bindLayout(instanceAttributes, instanceStride);
+        vertexCount = static_cast<int>(mesh.size()) / meshStride;
+
+        glGenBuffersPtr(1, &meshBuffer);
+        glBindBufferPtr(GL_ARRAY_BUFFER, meshBuffer);
+        glBufferDataPtr(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(sizeof(float) * mesh.size()), mesh.data(), GL_STATIC_DRAW);
+        glGenBuffersPtr(1, &instanceBuffer);
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    // 上传实例数据；每帧变化的数据用 GL_STREAM_DRAW，不变的用 GL_STATIC_DRAW
+    void setInstances(const void* data, int count, GLenum usage = GL_STREAM_DRAW) {
+        instanceCount = count;
+        glBindBufferPtr(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferDataPtr(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(sizeof(float)) * instanceStride * count, data, usage);
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+    }
+
+    void draw() {
+        if (instanceCount == 0) return;
+        renderer.flush();
+        glUseProgramPtr(program);
+        enableLayout(meshBuffer, meshLayout, meshStride, 0);
+        enableLayout(instanceBuffer, instanceLayout, instanceStride, 1);
+        glDrawArraysInstancedPtr(GL_TRIANGLES, 0, vertexCount, instanceCount);
+        disableLayout(meshLayout);
+        disableLayout(instanceLayout);
+        glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+        glUseProgramPtr(0);
+        renderer.drawCalls++;
+    }
+
+private:
+    struct BoundAttribute {
+        GLint location;
+        int size;
+        int offset;  // 以浮点数为单位
+    };
+
+    GLuint program = 0;
+    GLuint meshBuffer = 0;
+    GLuint instanceBuffer = 0;
+    std::vector<BoundAttribute> meshLayout;
+    std::vector<BoundAttribute> instanceLayout;
+    int meshStride = 0;
+    int instanceStride = 0;
+    int vertexCount = 0;
+    int instanceCount = 0;
+
+    std::vector<BoundAttribute> bindLayout(const std::vector<ShapeAttribute>& attributes, int& stride) const {
+        std::vector<BoundAttribute> layout;
+        stride = 0;
+        for (const ShapeAttribute& attribute : attributes) {
+            layout.push_back({glGetAttribLocationPtr(program, attribute.name), attribute.size, stride});
+            stride += attribute.size;
+        }
+        return layout;
+    }
+
+    static void enableLayout(GLuint buffer, const std::vector<BoundAttribute>& layout, int stride, GLuint divisor) {
+        glBindBufferPtr(GL_ARRAY_BUFFER, buffer);
+        for (const BoundAttribute& attribute : layout) {
+            if (attribute.location < 0) continue;  // 被编译器优化掉的属性
+            glEnableVertexAttribArrayPtr(attribute.location);
+            glVertexAttribPointerPtr(attribute.location, attribute.size, GL_FLOAT, GL_FALSE, stride * sizeof(float),
+                                     reinterpret_cast<const void*>(attribute.offset * sizeof(float)));
+            glVertexAttribDivisorPtr(attribute.location, divisor);
+        }
+    }
+
+    static void disableLayout(const std::vector<BoundAttribute>& layout) {
+        for (const BoundAttribute& attribute : layout) {
+            if (attribute.location < 0) continue;
+            glVertexAttribDivisorPtr(attribute.location, 0);
+            glDisableVertexAttribArrayPtr(attribute.location);
+        }
+    }
+};
+
+
+// 粒子积分核心：位置 += 速度，生命周期 -= 0.01 并截断到0
+// position/velocity 为交错的 (x, y)，因此按 2 * count 个浮点数逐元素相加
+typedef void (*ParticleKernelFn)(float* position, const float* velocity, float* life, int count);
+
+void integrateParticlesScalar(float* position, const float* velocity, float* life, int count) {
+    for (int i = 0; i < count * 2; i++) {
+        position[i] += velocity[i];
+    }
+    for (int i = 0; i < count; i++) {
+        life[i] -= 0.01f;  // 减少生命周期
+        if (life[i] < 0) life[i] = 0;
+    }
+}
+
+#ifdef PARTICLE_SIMD_X86
+SIMD_TARGET("sse2")
+void integrateParticlesSSE2(float* position, const float* velocity, float* life, int count) {
+    int n = count * 2, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(position + i, _mm_add_ps(_mm_loadu_ps(position + i), _mm_loadu_ps(velocity + i)));
+    }
+    for (; i < n; i++) position[i] += velocity[i];
+
+    const __m128 decay = _mm_set1_ps(0.01f), zero = _mm_setzero_ps();
+    for (i = 0; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(life + i, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(life + i), decay), zero));
+    }
+    for (; i < count; i++) life[i] = life[i] - 0.01f < 0 ? 0 : life[i] - 0.01f;
+}
+
+SIMD_TARGET("avx")
+void integrateParticlesAVX(float* position, const float* velocity, float* life, int count) {
+    int n = count * 2, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(position + i, _mm256_add_ps(_mm256_loadu_ps(position + i), _mm256_loadu_ps(velocity + i)));
+    }
+    for (; i < n; i++) position[i] += velocity[i];
+
+    const __m256 decay = _mm256_set1_ps(0.01f), zero = _mm256_setzero_ps();
+    for (i = 0; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(life + i, _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(life + i), decay), zero));
+    }
+    for (; i < count; i++) life[i] = life[i] - 0.01f < 0 ? 0 : life[i] - 0.01f;
+}
+
+SIMD_TARGET("avx512f")
+void integrateParticlesAVX512(float* position, const float* velocity, float* life, int count) {
+    int n = count * 2, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(position + i, _mm512_add_ps(_mm512_loadu_ps(position + i), _mm512_loadu_ps(velocity + i)));
+    }
+    for (; i < n; i++) position[i] += velocity[i];
+
+    const __m512 decay = _mm512_set1_ps(0.01f), zero = _mm512_setzero_ps();
+    for (i = 0; i + 16 <= count; i += 16) {
+        _mm512_storeu_ps(life + i, _mm512_max_ps(_mm512_sub_ps(_mm512_loadu_ps(life + i), decay), zero));
+    }
+    for (; i < count; i++) life[i] = life[i] - 0.01f < 0 ? 0 : life[i] - 0.01f;
+}
+
+// 运行时检测CPU支持的指令集
+bool cpuSupports(const char* isa) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    if (std::string(isa) == "sse2") return (info[3] & (1 << 26)) != 0;
+    if (std::string(isa) == "avx") return (info[2] & (1 << 28)) != 0 && (xcr0 & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    if (std::string(isa) == "avx2") return (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    if (std::string(isa) == "avx512f") return (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    return false;
+#else
+    __builtin_cpu_init();
+    if (std::string(isa) == "sse2") return __builtin_cpu_supports("sse2");
+    if (std::string(isa) == "avx") return __builtin_cpu_supports("avx");
+    if (std::string(isa) == "avx2") return __builtin_cpu_supports("avx2");
+    if (std::string(isa) == "avx512f") return __builtin_cpu_supports("avx512f");
+    return false;
+#endif
+}
+#endif
+
+struct ParticleKernel {
+    const char* name;
+    ParticleKernelFn integrate;
+};
+
+// 当前CPU可用的全部积分核心，按从慢到快排列，第一个总是标量版本
+std::vector<ParticleKernel> availableParticleKernels() {
+    std::vector<ParticleKernel> kernels = {{"scalar", integrateParticlesScalar}};
+#ifdef PARTICLE_SIMD_X86
+    if (cpuSupports("sse2")) kernels.push_back({"sse2", integrateParticlesSSE2});
+    if (cpuSupports("avx")) kernels.push_back({"avx", integrateParticlesAVX});
+    if (cpuSupports("avx512f")) kernels.push_back({"avx512f", integrateParticlesAVX512});
+#endif
+    return kernels;
+}
+
+// 随机数：xoshiro128++，每个数只要几条整数运算，周期2^128-1，低位也足够随机（rand() % n的低位很差）。
+// 所有流都由一个主种子randomSeed加流号经splitmix64生成初始状态，同一种子每次运行的结果相同
+uint64_t randomSeed = 1;  // --seed可以修改
+
+uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+const int RANDOM_LANES = 8;  // 批量生成时并排推进的独立通道数
+
+// 批量生成核心：lanes[状态字][通道]，每组输出8个[0, 1)的浮点数，按组、组内按通道存放；
+// 各版本的结果逐位相同，换指令集不改变画面
+typedef void (*RandomFillFn)(uint32_t lanes[4][RANDOM_LANES], float* out, int groups);
+
+inline uint32_t rotateLeft(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+void fillUniformScalar(uint32_t lanes[4][RANDOM_LANES], float* out, int groups) {
+    for (int g = 0; g < groups; g++) {
+        for (int lane = 0; lane < RANDOM_LANES; lane++) {
+            uint32_t s0 = lanes[0][lane], s1 = lanes[1][lane], s2 = lanes[2][lane], s3 = lanes[3][lane];
+            uint32_t result = rotateLeft(s0 + s3, 7) + s0;
+            uint32_t t = s1 << 9;
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+            s2 ^= t;
+            s3 = rotateLeft(s3, 11);
+            lanes[0][lane] = s0;
+            lanes[1][lane] = s1;
+            lanes[2][lane] = s2;
+            lanes[3][lane] = s3;
+            out[g * RANDOM_LANES + lane] = static_cast<float>(result >> 8) * (1.0f / 16777216.0f);
+        }
+    }
+}
+
+#ifdef PARTICLE_SIMD_X86
+template <int K>
+SIMD_TARGET("sse2") inline __m128i rotateLeftSSE2(__m128i x) {
+    return _mm_or_si128(_mm_slli_epi32(x, K), _mm_srli_epi32(x, 32 - K));
+}
+
+template <int K>
+SIMD_TARGET("avx2") inline __m256i rotateLeftAVX2(__m256i x) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, K), _mm256_srli_epi32(x, 32 - K));
+}
+
+SIMD_TARGET("sse2")
+void fillUniformSSE2(uint32_t lanes[4][RANDOM_LANES], float* out, int groups) {
+    const __m128 scale = _mm_set1_ps(1.0f / 16777216.0f);
+    for (int half = 0; half < RANDOM_LANES; half += 4) {
+        __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[0] + half));
+        __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[1] + half));
+        __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[2] + half));
+        __m128i s3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes[3] + half));
+        for (int g = 0; g < groups; g++) {
+            __m128i result = _mm_add_epi32(rotateLeftSSE2<7>(_mm_add_epi32(s0, s3)), s0);
+            __m128i t = _mm_slli_epi32(s1, 9);
+            s2 = _mm_xor_si128(s2, s0);
+            s3 = _mm_xor_si128(s3, s1);
+            s1 = _mm_xor_si128(s1, s2);
+            s0 = _mm_xor_si128(s0, s3);
+            s2 = _mm_xor_si128(s2, t);
+            s3 = rotateLeftSSE2<11>(s3);
+            _mm_storeu_ps(out + g * RANDOM_LANES + half, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(result, 8)), scale));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[0] + half), s0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[1] + half), s1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[2] + half), s2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[3] + half), s3);
+    }
+}
+
+SIMD_TARGET("avx2")
+void fillUniformAVX2(uint32_t lanes[4][RANDOM_LANES], float* out, int groups) {
+    const __m256 scale = _mm256_set1_ps(1.0f / 16777216.0f);
+    __m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[0]));
+    __m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[1]));
+    __m256i s2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[2]));
+    __m256i s3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes[3]));
+    for (int g = 0; g < groups; g++) {
+        __m256i result = _mm256_add_epi32(rotateLeftAVX2<7>(_mm256_add_epi32(s0, s3)), s0);
+        __m256i t = _mm256_slli_epi32(s1, 9);
+        s2 = _mm256_xor_si256(s2, s0);
+        s3 = _mm256_xor_si256(s3, s1);
+        s1 = _mm256_xor_si256(s1, s2);
+        s0 = _mm256_xor_si256(s0, s3);
+        s2 = _mm256_xor_si256(s2, t);
+        s3 = rotateLeftAVX2<11>(s3);
+        _mm256_storeu_ps(out + g * RANDOM_LANES, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(result, 8)), scale));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[0]), s0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[1]), s1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[2]), s2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[3]), s3);
+}
+#endif
+
+struct RandomKernel {
+    const char* name;
+    RandomFillFn fill;
+};
+
+// 当前CPU可用的全部批量生成核心，按从慢到快排列，第一个总是标量版本
+std::vector<RandomKernel> availableRandomKernels() {
+    std::vector<RandomKernel> kernels = {{"scalar", fillUniformScalar}};
+#ifdef PARTICLE_SIMD_X86
+    if (cpuSupports("sse2")) kernels.push_back({"sse2", fillUniformSSE2});
+    if (cpuSupports("avx2")) kernels.push_back({"avx2", fillUniformAVX2});
+#endif
+    return kernels;
+}
+
+class Random {
+public:
+    explicit Random(uint64_t seed = randomSeed, uint64_t stream = 0) {
+        uint64_t hashed = seed;
+        mix = splitMix64(hashed) ^ stream;
+        for (int i = 0; i < 4; i += 2) {
+            uint64_t word = splitMix64(mix);
+            s[i] = static_cast<uint32_t>(word);
+            s[i + 1] = static_cast<uint32_t>(word >> 32);
+        }
+    }
+
+    uint32_t next() {
+        uint32_t result = rotateLeft(s[0] + s[3], 7) + s[0];
+        uint32_t t = s[1] << 9;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotateLeft(s[3], 11);
+        return result;
+    }
+
+    // [0, n)的整数：乘法取高位代替取余，不需要除法
+    int below(int n) {
+        return static_cast<int>((static_cast<uint64_t>(next()) * static_cast<uint32_t>(n)) >> 32);
+    }
+
+    // [0, 1)的浮点数，取高24位，正好是float的精度
+    float uniform() {
+        return static_cast<float>(next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // 批量生成count个[0, 1)的浮点数；与next()是不同的序列，通道状态在第一次用时才生成
+    void fill(float* out, int count) {
+        static const RandomFillFn kernel = availableRandomKernels().back().fill;  // 选择CPU支持的最快版本
+        fill(out, count, kernel);
+    }
+
+    void fill(float* out, int count, RandomFillFn kernel) {
+        if (!lanesReady) {
+            for (int word = 0; word < 4; word++) {
+                for (int lane = 0; lane < RANDOM_LANES; lane += 2) {
+                    uint64_t bits = splitMix64(mix);
+                    lanes[word][lane] = static_cast<uint32_t>(bits);
+                    lanes[word][lane + 1] = static_cast<uint32_t>(bits >> 32);
+                }
+            }
+            lanesReady = true;
+        }
+        int groups = count / RANDOM_LANES;
+        kernel(lanes, out, groups);
+        if (count % RANDOM_LANES != 0) {
+            float tail[RANDOM_LANES];
+            kernel(lanes, tail, 1);
+            std::copy(tail, tail + count % RANDOM_LANES, out + groups * RANDOM_LANES);
+        }
+    }
+
+private:
+    uint32_t s[4];
+    uint64_t mix;  // splitmix64的状态，继续用来生成批量通道的状态
+    bool lanesReady = false;
+    uint32_t lanes[4][RANDOM_LANES];
+};
+
+// 每个线程有自己的默认流，主线程最先用到（静态初始化时天空生成星星），是流0。
+// 并行任务的结果不能取决于由哪个线程执行，所以任务在RandomStream里换成按任务编号生成的流
+thread_local Random* activeRandom = nullptr;
+std::atomic<uint64_t> threadStreams{0};
+uint64_t nextRandomTask = 0;  // 主线程按提交顺序给并行任务编号
+const uint64_t TASK_STREAMS = 1ull << 63;  // 任务流的流号与线程流分开
+
+// 任务里必须先用RandomStream换成任务自己的流，否则结果取决于由哪个线程执行
+Random& threadRandom() {
+    assert(!runningJob || activeRandom != nullptr);
+    thread_local Random own(randomSeed, threadStreams++);
+    return activeRandom != nullptr ? *activeRandom : own;
+}
+
+// 只在主线程调用，之后的所有随机数都由新种子决定
+void seedRandom(uint64_t seed) {
+    randomSeed = seed;
+    nextRandomTask = 0;
+    threadRandom() = Random(seed, 0);
+}
+
+// 作用域内当前线程使用任务task的流，结束时换回原来的
+class RandomStream {
+public:
+    explicit RandomStream(uint64_t task) : random(randomSeed, TASK_STREAMS | task), saved(activeRandom) {
+        activeRandom = &random;
+    }
+    ~RandomStream() {
+        activeRandom = saved;
+    }
+    RandomStream(const RandomStream&) = delete;
+    RandomStream& operator=(const RandomStream&) = delete;
+
+private:
+    Random random;
+    Random* saved;
+};
+
+long long particleAllocations = 0;  // 粒子池向堆申请内存的次数，预热后应保持不变
+
+// 统计堆分配次数的分配器，用于证明烟花重生时不再申请内存
+template <typename T>
+struct CountingAllocator {
+    typedef T value_type;
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        particleAllocations++;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+const int MAX_PARTICLES_PER_FIREWORK = 200;  // 每个烟花最多200个粒子
+
+// 粒子系统：所有烟花的粒子按属性分开连续存储（SoA），便于批量更新和一次性绘制
+// 每个烟花在池中拥有固定容量的槽位，重生时复用自己的槽位，不再申请内存
+class ParticleSystem {
+public:
+    struct Emitter {
+        int first = 0;  // 该烟花的槽位在数组中的起始下标
+        int count = 0;  // 该烟花当前的粒子数量
+        float alpha = 1;  // 烟花的透明度
+    };
+
+    typedef std::vector<float, CountingAllocator<float>> FloatArray;
+    FloatArray position;  // 粒子的位置 (x, y)
+    FloatArray previous;  // 上一步模拟时粒子的位置，用于插值
+    FloatArray velocity;  // 粒子的速度 (vx, vy)
+    FloatArray life;  // 粒子的生命周期
+    FloatArray colour;  // 粒子的颜色 (r, g, b, a)，a在绘制时计算
+    std::vector<Vertex, CountingAllocator<Vertex>> vertices;  // 绘制用的插值位置和颜色
+    std::vector<Emitter, CountingAllocator<Emitter>> emitters;
+
+    // 新的烟花在池的末尾占用一段槽位，只在初始化时发生
+    int addEmitter() {
+        Emitter e;
+        e.first = static_cast<int>(life.size());
+        emitters.push_back(e);
+        position.resize(position.size() + MAX_PARTICLES_PER_FIREWORK * 2);
+        previous.resize(previous.size() + MAX_PARTICLES_PER_FIREWORK * 2);
+        velocity.resize(velocity.size() + MAX_PARTICLES_PER_FIREWORK * 2);
+        life.resize(life.size() + MAX_PARTICLES_PER_FIREWORK);
+        colour.resize(colour.size() + MAX_PARTICLES_PER_FIREWORK * 4);
+        vertices.resize(vertices.size() + MAX_PARTICLES_PER_FIREWORK, Vertex{});
+        return static_cast<int>(emitters.size()) - 1;
+    }
+
+    // 复用发射器自己的槽位，返回粒子的起始下标；未使用的槽位保持透明
+    int respawn(int emitter, int numParticles) {
+        Emitter& e = emitters[emitter];
+        e.count = std::min(numParticles, MAX_PARTICLES_PER_FIREWORK);
+        e.alpha = 1.0;
+        for (int i = e.first + e.count; i < e.first + MAX_PARTICLES_PER_FIREWORK; i++) {
+            life[i] = 0;
+            colour[i * 4 + 3] = 0;
+            vertices[i].a = 0;
+        }
+        return e.first;
+    }
+
+    ParticleKernel kernel = availableParticleKernels().back();  // 选择CPU支持的最快版本
+
+    void integrate(int first, int count) {
+        kernel.integrate(position.data() + first * 2, velocity.data() + first * 2, life.data() + first, count);
+    }
+
+    // 每个模拟步开始时记录粒子的位置
+    void snapshot() {
+        std::copy(position.begin(), position.end(), previous.begin());
+    }
+
+    // 新生成的粒子没有上一步的位置，直接使用当前位置，避免插值出拖影
+    void resetInterpolation(int first, int count) {
+        std::copy(position.begin() + first * 2, position.begin() + (first + count) * 2, previous.begin() + first * 2);
+    }
+
+    // 一次绘制整个池，未使用的槽位透明度为0
+    void draw() {
+        for (int i = 0; i < static_cast<int>(emitters.size()); i++) {
+            prepare(emitters[i]);
+        }
+        drawRange(0, static_cast<int>(life.size()));
+    }
+
+    // 只绘制给定的发射器（下标从小到大），下标相邻的合并成一次绘制
+    void draw(const std::vector<int>& visible) {
+        for (size_t i = 0; i < visible.size(); ) {
+            size_t last = i;
+            prepare(emitters[visible[i]]);
+            while (last + 1 < visible.size() && visible[last + 1] == visible[last] + 1) {
+                prepare(emitters[visible[++last]]);
+            }
+            int first = emitters[visible[i]].first;
+            drawRange(first, emitters[visible[last]].first + emitters[visible[last]].count - first);
+            i = last + 1;
+        }
+    }
+
+    void drawEmitter(int emitter) {
+        prepare(emitters[emitter]);
+        drawRange(emitters[emitter].first, emitters[emitter].count);
+    }
+
+    // 每个烟花报告可见粒子（插值后的位置）的外接矩形，状态包括每个粒子的位置和透明度
+    void reportDamage(DamageTracker& damage) const {
+        for (const Emitter& e : emitters) {
+            float x0 = WINDOW_WIDTH, y0 = WINDOW_HEIGHT, x1 = 0, y1 = 0;
+            DamageTracker::State state;
+            for (int i = e.first; i < e.first + e.count; i++) {
+                float alpha = e.alpha * life[i];
+                if (colorToByte(alpha) == 0) continue;
+                float x = previous[i * 2] + (position[i * 2] - previous[i * 2]) * interpolationAlpha;
+                float y = previous[i * 2 + 1] + (position[i * 2 + 1] - previous[i * 2 + 1]) * interpolationAlpha;
+                x0 = std::min(x0, x);
+                y0 = std::min(y0, y);
+                x1 = std::max(x1, x);
+                y1 = std::max(y1, y);
+                state << x << y << alpha;
+            }
+            if (x1 < x0) {
+                damage.reportNothing();
+            } else {
+                damage.report(x0 - 2, y0 - 2, x1 + 2, y1 + 2, state);  // 点的大小是3
+            }
+        }
+    }
+
+private:
+    void prepare(const Emitter& e) {
+        for (int i = e.first; i < e.first + e.count; i++) {
+            colour[i * 4 + 3] = e.alpha * life[i];  // 使用透明度
+            Vertex& v = vertices[i];
+            v.x = previous[i * 2] + (position[i * 2] - previous[i * 2]) * interpolationAlpha;
+            v.y = previous[i * 2 + 1] + (position[i * 2 + 1] - previous[i * 2 + 1]) * interpolationAlpha;
+            v.r = colorToByte(colour[i * 4]);
+            v.g = colorToByte(colour[i * 4 + 1]);
+            v.b = colorToByte(colour[i * 4 + 2]);
+            v.a = colorToByte(colour[i * 4 + 3]);
+        }
+    }
+
+    void drawRange(int first, int count) const {
+        renderer.drawPoints(vertices.data() + first, count, 3.0);
+    }
+};
+ParticleSystem particleSystem;
+
+struct Leaf {
+    float x, y;  // 叶子的位置
+    float width, height;  // 叶子的大小
+    float r, g, b;  // 叶子的颜色
+};
+class Tree {
+private:
+    int x, y;
+    std::vector<Leaf> leaves;
+
+public:
+    Tree(int x, int y) : x(x), y(y) {
+        generateLeaves();
+    }
+
+    // 每片叶子5个随机数，一次批量生成；位置和大小取整，叶子对齐像素
+    void generateLeaves() {
+        Random& random = threadRandom();
+        int numLeaves = 100 + random.below(10);  // 生成100到110片叶子
+        float u[110 * 5];
+        random.fill(u, numLeaves * 5);
+        for (int i = 0; i < numLeaves; i++) {
+            const float* v = u + i * 5;
+            float leafX = x + std::floor(v[0] * 100) - 50;  // 叶子的x坐标在树干的左右50像素内
+            float leafY = y + std::floor(v[1] * 200);  // 叶子的y坐标在树干的上方200像素内
+            float leafWidth = std::floor(v[2] * 10) + 5;  // 叶子的宽度在5到15像素之间
+            float leafHeight = std::floor(v[3] * 10) + 5;  // 叶子的高度在5到15像素之间
+            Leaf leaf = {
+                    leafX, leafY,
+                    leafWidth, leafHeight,
+                    0.0, v[4], 0.0  // 叶子的颜色为随机的绿色
+            };
+            leaves.push_back(leaf);
+        }
+    }
+
+    void draw() const {
+//        std::cout << "Drawing a tree at position (" << x << ", " << y << ")" << std::endl;
+        drawTrunk();
+        drawLeaves();
+    }
+
+    // 树干宽20高200，叶子在树干左右50、上方200以内，最大15x15
+    Bounds bounds() const {
+        return {x - 60.0f, y - 10.0f, x + 60.0f, y + 210.0f};
+    }
+
+    void drawTrunk() const {
+        // 绘制树干
+        renderer.color(0.5, 0.35, 0.05);  // 棕色
+        renderer.begin(GL_QUADS);
+        renderer.vertex(x - 10, y);
+        renderer.vertex(x + 10, y);
+        renderer.vertex(x + 10, y + 200);
+        renderer.vertex(x - 10, y + 200);
+        renderer.end();
+    }
+
+    void drawLeaves() const {
+        // 绘制叶子
+        for (const Leaf& leaf : leaves) {
+            renderer.color(leaf.r, leaf.g, leaf.b);
+            renderer.begin(GL_QUADS);
+            renderer.vertex(leaf.x - leaf.width / 2, leaf.y - leaf.height / 2);
+            renderer.vertex(leaf.x + leaf.width / 2, leaf.y - leaf.height / 2);
+            renderer.vertex(leaf.x + leaf.width / 2, leaf.y + leaf.height / 2);
+            renderer.vertex(leaf.x - leaf.width / 2, leaf.y + leaf.height / 2);
+            renderer.end();
+        }
+    }
+
+    // 实例化绘制用的数据：每片叶子的位置、大小和颜色
+    void appendLeafInstances(std::vector<float>& out) const {
+        for (const Leaf& leaf : leaves) {
+            out.insert(out.end(), {leaf.x, leaf.y, leaf.width, leaf.height, leaf.r, leaf.g, leaf.b});
+        }
+    }
+};
+
+// 一朵花：茎、叶子、花蕊，开放时加上花瓣。bloomFactor为0表示完全闭合的花苞，1表示完全开放的花
+void drawFlowerShape(float x, float y, float bloomFactor, bool isBlooming) {
+    // 绘制茎
+    renderer.color(0.0, 0.5, 0.0);  // 绿色茎
+    renderer.begin(GL_LINES);
+    renderer.vertex(x, y - 5);
+    renderer.vertex(x, y - 25);
+    renderer.end();
+
+    // 绘制叶子
+    renderer.color(0.0, 0.5, 0.0);  // 绿色叶子
+    renderer.begin(GL_POLYGON);
+    renderer.vertex(x - 5, y - 20);
+    renderer.vertex(x + 5, y - 20);
+    renderer.vertex(x, y - 30);
+    renderer.end();
+    renderer.begin(GL_POLYGON);
+    renderer.vertex(x - 5, y - 10);
+    renderer.vertex(x + 5, y - 10);
+    renderer.vertex(x, y - 20);
+    renderer.end();
+
+    // 绘制花蕊
+    renderer.color(1.0, 1.0, 0.0);  // 黄色花蕊
+    renderer.begin(GL_POLYGON);
+    for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+        float xOffset = bloomFactor * 10 * CIRCLE_10.x[i];
+        float yOffset = bloomFactor * 10 * CIRCLE_10.y[i];
+        renderer.vertex(x + xOffset, y + yOffset);
+    }
+    renderer.end();
+
+    if (isBlooming)
+    {
+        // 绘制花蕊
+        renderer.color(1.0, 1.0, 0.0);  // 黄色花蕊
+        renderer.begin(GL_POLYGON);
+        for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+            float xOffset = bloomFactor * 10 * CIRCLE_10.x[i];
+            float yOffset = bloomFactor * 10 * CIRCLE_10.y[i];
+            renderer.vertex(x + xOffset, y + yOffset);
+        }
+        renderer.end();
+        // 绘制花瓣
+        renderer.color(1.0, 0.5, 1.0);  // 粉红色花瓣
+        for (int petal = 0; petal < 8; petal++) {
+            renderer.begin(GL_POLYGON);
+            for (int i = 0; i < CIRCLE_45.SEGMENTS; i++) {
+                int k = (i + petal) % CIRCLE_45.SEGMENTS;  // 每片花瓣旋转45度，正好错开一格
+                float xOffset = bloomFactor * 20 * CIRCLE_45.x[k];
+                float yOffset = bloomFactor * 20 * CIRCLE_45.y[k];
+                renderer.vertex(x + xOffset, y + yOffset);
+            }
+            renderer.end();
+        }
+
+    }
+}
+
+class Letter {
+public:
+    float x, y; // 信纸的位置
+    float width = 200.0f, height = 300.0f; // 信纸的大小
+    bool isVisible; // 是否可见
+    TextLayout layout;  // 信上文字的排版缓存
+
+    Letter() {
+        x = WINDOW_WIDTH / 2; // 初始位置为屏幕中央
+        y = 0; // 初始位置在屏幕上方，确保开始时不可见
+        isVisible = false;
+    }
+
+    void setPosition(float newX, float newY){
+        x = newX;
+        y = newY;
+    }
+
+    // 字形来自图集，整封信是一个贴图批次；排版结果缓存在layout里，每帧只加上信纸的位置。
+    // 行首在视口外时原来的光栅位置无效，这一行不显示，也照原样保留
+    void drawText(const char* text) {
+        layout.update(text, letterGlyphs, width);
+        float originX = x, originY = y + height / 2 - 20;
+
+        renderer.color(0, 0, 0); // 设置文字颜色为黑色
+        RasterClip clip;
+        const std::vector<TextLayout::Glyph>& glyphs = layout.layoutGlyphs();
+        for (const TextLayout::Line& line : layout.layoutLines()) {
+            if (!clip.valid(originX + line.x, originY + line.y)) continue;
+            for (int i = line.first; i < line.first + line.count; i++) {
+                letterGlyphs.drawCharacter(glyphs[i].c, originX + glyphs[i].x, originY + line.y);
+            }
+        }
+        renderer.bindTexture(0);
+    }
+
+    // 与glRasterPos的判断相同：经过当前矩阵变换后在裁剪体内才有效；矩阵只在构造时读取一次
+    struct RasterClip {
+        GLfloat modelview[16], projection[16];
+
+        RasterClip() {
+            if (renderer.softwareMode()) return;
+            glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+            glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        }
+
+        bool valid(float px, float py) const {
+            if (renderer.softwareMode()) return renderer.rasterVisible(px, py);
+            float eye[4], clip[4];
+            for (int i = 0; i < 4; i++) {
+                eye[i] = modelview[i] * px + modelview[4 + i] * py + modelview[12 + i];
+            }
+            for (int i = 0; i < 4; i++) {
+                clip[i] = projection[i] * eye[0] + projection[4 + i] * eye[1] + projection[8 + i] * eye[2] + projection[12 + i] * eye[3];
+            }
+            for (int i = 0; i < 3; i++) {
+                if (clip[i] < -clip[3] || clip[i] > clip[3]) return false;
+            }
+            return true;
+        }
+    };
+
+
+
+    void draw() {
+        if (isVisible) {
+            renderer.color(1.0, 1.0, 1.0); // 设置信纸颜色为白色
+            renderer.begin(GL_QUADS);
+            renderer.vertex(x - width / 2, y - height / 2);
+            renderer.vertex(x + width / 2, y - height / 2);
+            renderer.vertex(x + width / 2, y + height / 2);
+            renderer.vertex(x - width / 2, y + height / 2);
+            renderer.end();
+            drawDetails();
+        }
+    }
+
+    void drawDetails() {
+        //TODO 绘制信纸的细节
+        renderer.color(0.8, 0.8, 0.8); // 设置线条颜色为浅灰色
+        for (float i = y - height / 2 + 10; i < y + height / 2; i += 10) {
+            renderer.begin(GL_LINES);
+            renderer.vertex(x - width / 2 + 10, i);
+            renderer.vertex(x + width / 2 - 10, i);
+            renderer.end();
+        }
+    }
+
+    void show() {
+        isVisible = true;
+    }
+};
+Letter letter;
+
+// 普通气球：弯曲的绳子（拉着字时是直的）、椭圆形的气球和高光
+void drawBalloonShape(float x, float drawY, float r, float g, float b, float controlPointOffset, bool isHoldingText) {
+    if (!isHoldingText == true) {
+        //绘制弯曲的绳子
+        renderer.color(0.5, 0.5, 0.5);  // 灰色
+        float controlX = x + controlPointOffset;
+        float controlY = drawY - 40;  // 控制点
+
+        renderer.begin(GL_LINE_STRIP);  // 使用GL_LINE_STRIP来绘制连续的线段
+        renderer.vertex(x, drawY);  // 起点
+        // 使用贝塞尔曲线的公式来绘制曲线
+        for (float t = 0; t <= 1; t += 0.01) {
+            float pointX = (1 - t) * (1 - t) * x + 2 * (1 - t) * t * controlX + t * t * x;
+            float pointY = (1 - t) * (1 - t) * drawY + 2 * (1 - t) * t * controlY + t * t * (drawY - 80);
+            renderer.vertex(pointX, pointY);
+        }
+        renderer.end();
+    }
+    else
+    {
+        // 绘制绳子
+        renderer.color(0.5, 0.5, 0.5);  // 灰色
+        renderer.begin(GL_LINES);
+        renderer.vertex(x, drawY - 30);  // 气球底部
+        renderer.vertex(x, drawY - 80);  // 绳子的末端
+        renderer.end();
+    }
+    // 绘制气球
+    renderer.color(r, g, b);  // 红色
+    renderer.begin(GL_POLYGON);
+    for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+        renderer.vertex(x + CIRCLE_10.x[i] * 20, drawY + CIRCLE_10.y[i] * 30);  // 椭圆形的气球
+    }
+    renderer.end();
+
+    // 绘制高光
+    float highlightWidth = 10.0f;  // 高光的宽度
+    float highlightHeight = 5.0f;  // 高光的高度
+    float highlightX = x;  // 高光X
+    float highlightY = drawY + 15.0f;  // 高光Y
+
+    renderer.begin(GL_TRIANGLE_FAN);
+    renderer.color(1.0f, 1.0f, 1.0f, 0.6f);  // 高光颜色
+    renderer.vertex(highlightX, highlightY);  // 高光中心点
+    for (int i = 0; i <= CIRCLE_10.SEGMENTS; i++) {  // 高光的边缘
+        renderer.color(1.0f, 1.0f, 1.0f, 0.0f);  // 高光的边缘颜色
+        renderer.vertex(highlightX + CIRCLE_10.x[i] * highlightWidth, highlightY + CIRCLE_10.y[i] * highlightHeight);
+    }
+    renderer.end();
+}
+
+// 特殊气球的基类；场景里的普通气球是实体组件存储中的实体，不再是这个类的对象
+class Balloon {
+protected:
+    float x,y;
+    float speed;
+    float r, g, b;
+    float controlPointOffset = 0.0f;
+    bool isHoldingText;
+    float windTime = 0.0f; // 是否拉着字上升
+    float prevY = 0.0f;  // 上一步模拟时的高度，用于插值
+
+public:
+    Balloon() {
+        Random& random = threadRandom();
+        x = static_cast<float>(random.below(WINDOW_WIDTH));
+        y = -100;
+        prevY = y;
+        r = random.uniform();
+        g = random.uniform();
+        b = random.uniform();
+        isHoldingText = false;
+        speed = 1.0f + static_cast<float>(random.below(3));  // 随机速度
+    }
+
+    float getY() const {
+        return y;
+    }
+
+    void setY(float newY) {
+        y = newY;
+    }
+
+    // 每个模拟步开始时记录当前高度
+    void snapshot() {
+        prevY = y;
+    }
+
+    float renderY() const {
+        return prevY + (y - prevY) * interpolationAlpha;
+    }
+
+    virtual void draw() {
+        drawBalloonShape(x, renderY(), r, g, b, controlPointOffset, isHoldingText);
+    }
+};
+class SpecialBalloon : public Balloon {
+protected:
+    float speed =0.5;
+public:
+    bool isActive;
+
+    SpecialBalloon() : Balloon() {
+        x = WINDOW_WIDTH/2;  // 屏幕中央
+        y = 0.0f;  // 屏幕中央
+        prevY = y;
+        r = 1.0f;  // 红色
+        g = 0.0f;
+        b = 0.0f;
+    }
+
+    void rise() {
+        if (isActive) {
+            y += speed;// 气球上升
+        }
+    }
+
+    void activate() {
+        isActive = true; // 激活气球
+    }
+
+    void update() {
+        y += speed;
+        windTime += 0.1f;  // 偏移程度
+        controlPointOffset = sin(windTime) * 5.0f;  // 调风速
+    }
+
+    virtual void draw() override {
+        float drawY = renderY();  // 插值后的高度
+        //绘制弯曲的绳子
+        renderer.color(0.5, 0.5, 0.5);  // 灰色
+        float controlX = x + controlPointOffset;
+        float controlY = drawY - 80;  // 控制点
+
+        renderer.begin(GL_LINE_STRIP);  // 使用GL_LINE_STRIP来绘制连续的线段
+        renderer.vertex(x, drawY);  // 起点
+        // 使用贝塞尔曲线的公式来绘制曲线
+        for (float t = 0; t <= 1; t += 0.01) {
+            float pointX = (1 - t) * (1 - t) * x + 2 * (1 - t) * t * controlX + t * t * x;
+            float pointY = (1 - t) * (1 - t) * drawY + 2 * (1 - t) * t * controlY + t * t * (drawY - 200);
+            renderer.vertex(pointX, pointY);
+        }
+        renderer.end();
+
+        renderer.color(1.0, 0.0, 0.0);  // 红色
+        float balloonRadiusX = 60.0f;  // 特殊气球的X轴半径
+        float balloonRadiusY = 90.0f;  // 特殊气球的Y轴半径
+        renderer.begin(GL_POLYGON);
+        for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+            renderer.vertex(x + CIRCLE_10.x[i] * balloonRadiusX, drawY + CIRCLE_10.y[i] * balloonRadiusY);  // 椭圆形的气球
+        }
+        renderer.end();
+
+        // 绘制高光
+        float highlightWidth = 30.0f;  // 高光的宽度
+        float highlightHeight = 15.0f;  // 高光的高度
+        float highlightX = x;  // 高光X
+        float highlightY = drawY + 45.0f;  // 高光Y
+
+        renderer.begin(GL_TRIANGLE_FAN);
+        renderer.color(1.0f, 1.0f, 1.0f, 0.6f);  // 高光颜色
+        renderer.vertex(highlightX, highlightY);  // 高光中心点
+        for (int i = 0; i <= CIRCLE_10.SEGMENTS; i++) {  // 高光的边缘
+            renderer.color(1.0f, 1.0f, 1.0f, 0.0f);  // 高光的边缘颜色
+            renderer.vertex(highlightX + CIRCLE_10.x[i] * highlightWidth, highlightY + CIRCLE_10.y[i] * highlightHeight);
+        }
+        renderer.end();
+
+        if (drawY >=200) {
+            if (letter.y >= WINDOW_HEIGHT / 2) {
+                letter.y = WINDOW_HEIGHT / 2;  // 保持信纸在屏幕中心
+            } else {
+                // 更新信纸的位置
+                float letterX = x;
+                float letterY = drawY - 250;  // 信纸位于绳子的末端
+                letter.setPosition(letterX, letterY);
+            }
+        }
+        letter.show();
+
+    }
+};
+
+struct Star {
+    float x, y;  // 星星的位置
+    float brightness;  // 星星的亮度
+};
+struct Cloud {
+    float x, y;  // 云朵的位置
+    float width, height;  // 云朵的大小
+    float prevX = 0;  // 上一步模拟时的位置，用于插值
+};
+class Sky {
+private:
+    float red, green, blue;
+    std::vector<Star> stars;
+    std::vector<Cloud> clouds;
+
+public:
+    Sky() : red(0.0), green(0.0), blue(0.5) {
+        initStars();
+        initClouds();
+    }
+
+    void darken() {
+        blue -= 0.005;  // 每次减少的量，可以根据需要调整
+        if (blue < 0.2) blue = 0.2;  // 设置最小值为偏蓝黑的黑色
+    }
+
+    float getColor() const {
+        return skyColor;
+    }
+
+    void draw() const {
+        for (const Star& star : stars) {
+            drawStar(star);
+        }
+
+        for (const Cloud& cloud : clouds) {
+            drawCloud(cloud);
+        }
+    }
+
+    // 星星按亮度、云按插值后的位置报告
+    void reportDamage(DamageTracker& damage) const {
+        for (const Star& star : stars) {
+            damage.report(star.x - 2, star.y - 2, star.x + 2, star.y + 2, DamageTracker::State() << star.brightness);
+        }
+        for (const Cloud& cloud : clouds) {
+            float x = cloud.prevX + (cloud.x - cloud.prevX) * interpolationAlpha;
+            damage.report(x, cloud.y, x + cloud.width, cloud.y + cloud.height, 0);
+        }
+    }
+
+    float getRed() const {
+        return red;
+    }
+
+    float getGreen() const {
+        return green;
+    }
+
+    float getBlue() const {
+        return blue;
+    }
+
+    // 每个模拟步开始时记录云朵的位置
+    void snapshot() {
+        for (auto& cloud : clouds) {
+            cloud.prevX = cloud.x;
+        }
+    }
+
+    void updateClouds() {
+        for (auto& cloud : clouds) {
+            cloud.x -= 0.5;  // 平移速度，可以根据需要调整
+
+            // 如果云朵完全移出屏幕，生成一个新的云朵
+            if (cloud.x + cloud.width < 0) {
+                cloud.x = WINDOW_WIDTH;
+                Random& random = threadRandom();
+                cloud.y = static_cast<float>(random.below(WINDOW_HEIGHT / 2) + (WINDOW_HEIGHT / 4));
+                cloud.width = 50 + static_cast<float>(random.below(100));
+                cloud.height = 20 + static_cast<float>(random.below(40));
+                cloud.prevX = cloud.x;
+            }
+        }
+    }
+
+    void updateStars() {
+        Random& random = threadRandom();
+        for (auto& star : stars) {
+            star.brightness += (random.below(3) - 1) * 0.05;  // 随机增加或减少亮度
+            if (star.brightness < 0) star.brightness = 0;
+            if (star.brightness > 1) star.brightness = 1;
+        }
+    }
+
+    void specialUpdateClouds(float balloonY) {
+        float cloudYLimit = WINDOW_HEIGHT - (balloonY / 2);  // 根据气球的高度调整云朵的上限
+
+        for (auto& cloud : clouds) {
+            cloud.x -= 0.5;  // 平移速度，可以根据需要调整
+
+            // 如果云朵完全移出屏幕，生成一个新的云朵
+            if (cloud.x + cloud.width < 0) {
+                cloud.x = WINDOW_WIDTH;
+                Random& random = threadRandom();
+                cloud.y = static_cast<float>(random.below(static_cast<int>(cloudYLimit)));
+                cloud.width = 50 + static_cast<float>(random.below(100));
+                cloud.height = 20 + static_cast<float>(random.below(40));
+                cloud.prevX = cloud.x;
+            }
+        }
+    }
+
+    void specialUpdateStars(float balloonY) {
+        float starYLimit = WINDOW_HEIGHT - (balloonY / 3);  // 根据气球的高度调整星星的上限
+
+        Random& random = threadRandom();
+        for (auto& star : stars) {
+            star.brightness += (random.below(3) - 1) * 0.05;  // 随机增加或减少亮度
+            if (star.brightness < 0) star.brightness = 0;
+            if (star.brightness > 1) star.brightness = 1;
+
+            // 确保星星始终在指定的上限范围内
+            if (star.y > starYLimit) {
+                star.y = static_cast<float>(random.below(static_cast<int>(starYLimit)));
+            }
+        }
+    }
+
+    // 换成场景文件里的星星和云，文件里没有的（nullptr）保留随机生成的
+    void load(const Star* newStars, int starCount, const Cloud* newClouds, int cloudCount) {
+        if (newStars != nullptr) stars.assign(newStars, newStars + starCount);
+        if (newClouds != nullptr) clouds.assign(newClouds, newClouds + cloudCount);
+    }
+
+private:
+    void initStars() {
+        Random& random = threadRandom();
+        for (int i = 0; i < 100; i++) {  // 创建100颗星星
+            Star star = {
+                    static_cast<float>(random.below(WINDOW_WIDTH)),
+                    static_cast<float>(random.below(WINDOW_HEIGHT / 2) + (WINDOW_HEIGHT / 2)),  // 在屏幕的上四分之一到上四分之三之间创建星星
+                    random.uniform()  // 随机亮度
+            };
+            stars.push_back(star);
+        }
+    }
+
+    void initClouds() {
+        Random& random = threadRandom();
+        for (int i = 0; i < 5; i++) {  // 创建5朵云
+            Cloud cloud = {
+                    static_cast<float>(random.below(WINDOW_WIDTH)),
+                    static_cast<float>(random.below(WINDOW_HEIGHT / 2) + (WINDOW_HEIGHT / 4)),  // 在屏幕的上四分之一到上二分之一之间创建云朵
+                    50 + static_cast<float>(random.below(100)),  // 随机宽度
+                    20 + static_cast<float>(random.below(40))  // 随机高度
+            };
+            cloud.prevX = cloud.x;
+            clouds.push_back(cloud);
+        }
+    }
+
+    void drawStar(const Star& star) const {
+        renderer.color(star.brightness, star.brightness, star.brightness);
+        renderer.begin(GL_LINES);
+        renderer.vertex(star.x, star.y - 2);
+        renderer.vertex(star.x, star.y + 2);
+        renderer.vertex(star.x - 2, star.y);
+        renderer.vertex(star.x + 2, star.y);
+        renderer.end();
+    }
+
+    void drawCloud(const Cloud& cloud) const{
+        float x = cloud.prevX + (cloud.x - cloud.prevX) * interpolationAlpha;  // 插值后的位置
+        renderer.color(0.9, 0.9, 0.9);  // 云朵的颜色
+        renderer.begin(GL_QUADS);
+        renderer.vertex(x, cloud.y);
+        renderer.vertex(x + cloud.width, cloud.y);
+        renderer.vertex(x + cloud.width, cloud.y + cloud.height);
+        renderer.vertex(x, cloud.y + cloud.height);
+        renderer.end();
+    }
+
+};
+
+
+
+
+
+// 建筑物本身和未点亮的窗户不会变化，只在初始化时记录为静态几何体
+void drawBuilding() {
+    //Todo 美化建筑物，纹理和细化，逻辑修改和贴图等
+    // Main building
+    renderer.color(0.6, 0.6, 0.6);
+    renderer.begin(GL_QUADS);
+    renderer.vertex(150, 100);
+    renderer.vertex(450, 100);
+    renderer.vertex(450, 500);
+    renderer.vertex(150, 500);
+    renderer.end();
+
+    renderer.color(0.3, 0.3, 0.3);
+    for (int i = 160; i < 440; i += 60) {
+        for (int j = 120; j < 480; j += 60) {
+            renderer.begin(GL_QUADS);
+            renderer.vertex(i, j);
+            renderer.vertex(i + 40, j);
+            renderer.vertex(i + 40, j + 40);
+            renderer.vertex(i, j + 40);
+            renderer.end();
+        }
+    }
+}
+
+// 点击后闪烁的黄色窗户和感叹号，每帧绘制在静态的建筑物之上
+void drawBuildingLights() {
+    if (!windowsActivated) return;
+    int i = 280;
+    for (int j = 120; j < 480; j += 60) {
+        if (j == 180) continue;
+        if (windowsVisible) {  // 仅当windowsVisible为true时绘制黄色窗户
+            renderer.color(1.0, 1.0, 0.0);  // Yellow for activated windows
+            renderer.begin(GL_QUADS);
+            renderer.vertex(i, j);
+            renderer.vertex(i + 40, j);
+            renderer.vertex(i + 40, j + 40);
+            renderer.vertex(i, j + 40);
+            renderer.end();
+        }
+        // 绘制感叹号
+        renderer.color(0.0, 0.0, 0.0);
+        renderer.begin(GL_LINES);
+        renderer.vertex(i + 20, j + 10);
+        renderer.vertex(i + 20, j + 25);
+        renderer.end();
+        renderer.begin(GL_POINTS);
+        renderer.vertex(i + 20, j + 5);
+        renderer.end();
+    }
+}
+
+void drawGround() {
+    renderer.color(0.0, 0.6, 0.0);  // 深绿色
+    renderer.begin(GL_QUADS);
+    renderer.vertex(0, 0);
+    renderer.vertex(WINDOW_WIDTH, 0);
+    renderer.vertex(WINDOW_WIDTH, 100);  // 地面的高度，可以根据需要调整
+    renderer.vertex(0, 100);
+    renderer.end();
+}
+
+void drawArtisticText(float x, float y, const char* text) {
+    if (bannerFont.ready()) {
+        // 笔画字体缩放到与18号Helvetica差不多高，蓝字白边一次画完
+        renderer.color(0.0, 0.0, 1.0);
+        bannerFont.draw(text, x, y, 0.14f, 2.0f, 1.0f, 1.0f, 1.0f);
+        return;
+    }
+    // Blue bold text with white outline
+    renderer.color(1.0, 1.0, 1.0);
+    for (int dx = -2; dx <= 2; dx++) {
+        for (int dy = -2; dy <= 2; dy++) {
+            renderer.rasterPos(static_cast<int>(x + dx), static_cast<int>(y + dy));
+            for (const char* c = text; *c != '\0'; c++) {
+                renderer.bitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+            }
+        }
+    }
+    renderer.color(0.0, 0.0, 1.0);
+    renderer.rasterPos(static_cast<int>(x), static_cast<int>(y));
+    for (const char* c = text; *c != '\0'; c++) {
+        renderer.bitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+    }
+}
+
+void drawCenteredText(float y, const char* text) {
+    float scaleFactor = 0.2;
+    if (bannerFont.ready()) {
+        // 距离场字体：填充和2像素的白色描边在一个着色器里画完，不用把整行文字画25遍
+        renderer.color(0.0, 0.0, 1.0);
+        bannerFont.draw(text, (WINDOW_WIDTH - bannerFont.length(text) * scaleFactor) / 2, y, scaleFactor, 2.0f, 1.0f, 1.0f, 1.0f);
+        return;
+    }
+    float textWidth = textStrokeLength(GLUT_STROKE_ROMAN, text) * scaleFactor;
+
+    // 描边 (白色)
+    renderer.color(1.0, 1.0, 1.0);
+    for (int dx = -2; dx <= 2; dx++) {
+        for (int dy = -2; dy <= 2; dy++) {
+            if (renderer.softwareMode() && (dx != 0 || dy != 0)) continue;
+            renderer.pushMatrix();
+            renderer.translate((WINDOW_WIDTH - textWidth) / 2 + dx, y + dy);
+            renderer.scale(scaleFactor);
+            for (const char* c = text; *c != '\0'; c++) {
+                // 软件光栅化时不错开画25遍，而是把笔画加粗4个单位画一遍，三角形少得多
+                renderer.strokeCharacter(GLUT_STROKE_ROMAN, *c, renderer.softwareMode() ? 4 / scaleFactor : 0);
+            }
+            renderer.popMatrix();
+        }
+    }
+
+    renderer.color(0.0, 0.0, 1.0);
+    renderer.pushMatrix();
+    renderer.translate((WINDOW_WIDTH - textWidth) / 2, y);
+    renderer.scale(scaleFactor);
+    for (const char* c = text; *c != '\0'; c++) {
+        renderer.strokeCharacter(GLUT_STROKE_ROMAN, *c);
+    }
+    renderer.popMatrix();
+}
+
+void drawInvitationButton() {
+    // Red carpet
+    renderer.color(0.8, 0.2, 0.2);
+    renderer.begin(GL_QUADS);
+    renderer.vertex(200, 0);
+    renderer.vertex(400, 0);
+    renderer.vertex(400, 100);
+    renderer.vertex(200, 100);
+    renderer.end();
+
+    // Vertical "Invitation" text
+    const char* text = "You Have an";
+    int yStart = 70;
+    drawArtisticText(250, yStart, text);
+    text = "Invitation!";
+    drawArtisticText(260, yStart - 20, text);
+}
+
+// 分阶段的帧分析器：PROFILE_SCOPE统计所在作用域的CPU耗时，多个线程里的同一阶段会累加。
+// 按P键显示最近HISTORY帧的统计，--profile-csv把每帧每个阶段的耗时写到CSV。
+// 没有打开时每个作用域只多一次判断；定义CPT205_NO_PROFILER则完全不编译
+class FrameProfiler {
+public:
+    static const int MAX_STAGES = 32;
+    static constexpr int HISTORY = 120;
+
+    FrameProfiler() {
+        frameStage = stage("frame");
+    }
+
+    // 按名字注册阶段，返回编号；PROFILE_SCOPE里用静态变量保存，每处只注册一次
+    int stage(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int count = stageCount.load();
+        for (int i = 0; i < count; i++) {
+            if (names[i] == name) return i;
+        }
+        if (count == MAX_STAGES) return -1;
+        names[count] = name;
+        history[count].assign(HISTORY, 0.0f);
+        stageCount.store(count + 1);
+        return count;
+    }
+
+    bool enabled() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    void add(int stage, long long nanoseconds) {
+        elapsed[stage].fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    bool hudVisible() const {
+        return hud;
+    }
+
+    void toggleHud() {
+        hud = !hud;
+        updateActive();
+    }
+
+    bool openCsv(const char* path) {
+        csv.open(path);
+        if (!csv) {
+            std::cerr << "Failed to open " << path << std::endl;
+            return false;
+        }
+        csv << "frame,stage,ms\n";
+        updateActive();
+        return true;
+    }
+
+    void beginFrame() {
+        if (enabled()) frameStart = std::chrono::steady_clock::now();
+    }
+
+    // 把这一帧各阶段的累计耗时放进历史记录并清零
+    void endFrame() {
+        if (!enabled()) return;
+        add(frameStage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frameStart).count());
+        int count = stageCount.load();
+        for (int i = 0; i < count; i++) {
+            float ms = elapsed[i].exchange(0) / 1.0e6f;
+            history[i][position] = ms;
+            if (csv.is_open() && ms > 0) {
+                csv << frame << "," << names[i] << "," << ms << "\n";
+            }
+        }
+        position = (position + 1) % HISTORY;
+        samples = std::min(samples + 1, HISTORY);
+        frame++;
+    }
+
+    // 左上角的统计表：平均值、中位数、p99、最大值（毫秒）
+    void drawHud() {
+        if (!hud || samples == 0) return;
+        int count = stageCount.load();
+        const float left = 5, top = WINDOW_HEIGHT - 5, lineHeight = 12;
+        renderer.color(0.0f, 0.0f, 0.0f, 0.6f);
+        renderer.begin(GL_QUADS);
+        renderer.vertex(left, top);
+        renderer.vertex(left + 300, top);
+        renderer.vertex(left + 300, top - (count + 1) * lineHeight - 6);
+        renderer.vertex(left, top - (count + 1) * lineHeight - 6);
+        renderer.end();
+
+        renderer.color(1.0f, 1.0f, 1.0f);
+        const char* header[] = {"stage (CPU ms)", "mean", "p50", "p99", "max"};
+        drawRow(left + 4, top - lineHeight, header);
+        std::vector<float> sorted;
+        for (int i = 0; i < count; i++) {
+            sorted.assign(history[i].begin(), history[i].begin() + samples);
+            std::sort(sorted.begin(), sorted.end());
+            float sum = 0;
+            for (float ms : sorted) sum += ms;
+            char mean[16], p50[16], p99[16], max[16];
+            snprintf(mean, sizeof(mean), "%.3f", sum / samples);
+            snprintf(p50, sizeof(p50), "%.3f", sorted[samples / 2]);
+            snprintf(p99, sizeof(p99), "%.3f", sorted[std::min(samples - 1, samples * 99 / 100)]);
+            snprintf(max, sizeof(max), "%.3f", sorted.back());
+            const char* row[] = {names[i].c_str(), mean, p50, p99, max};
+            drawRow(left + 4, top - (i + 2) * lineHeight, row);
         }
     }
-};
 
-class Flower {
 private:
-    float x, y;
-    float bloomFactor;  // 0表示完全闭合的花苞，1表示完全开放的花
-    bool isBlooming;
+    std::mutex mutex;
+    std::string names[MAX_STAGES];
+    std::atomic<long long> elapsed[MAX_STAGES] = {};
+    std::vector<float> history[MAX_STAGES];
+    std::atomic<int> stageCount{0};
+    std::atomic<bool> active{false};
+    bool hud = false;
+    std::ofstream csv;
+    int frameStage;
+    int position = 0, samples = 0;
+    long long frame = 0;
+    std::chrono::steady_clock::time_point frameStart;
+
+    void updateActive() {
+        active.store(hud || csv.is_open());
+    }
 
-public:
-    Flower(float x, float y) : x(x), y(y), bloomFactor(0.0f), isBlooming(false) {}
+    void drawRow(float x, float y, const char* const* columns) {
+        const float offsets[] = {0, 120, 165, 210, 255};
+        for (int i = 0; i < 5; i++) {
+            renderer.rasterPos(x + offsets[i], y);
+            for (const char* c = columns[i]; *c != '\0'; c++) {
+                renderer.bitmapCharacter(GLUT_BITMAP_HELVETICA_10, *c);
+            }
+        }
+    }
+};
+FrameProfiler frameProfiler;
 
-    void startBlooming() {
-        isBlooming = true;
+class ProfileScope {
+public:
+    explicit ProfileScope(int stage) : stage(frameProfiler.enabled() ? stage : -1) {
+        if (this->stage >= 0) start = std::chrono::steady_clock::now();
     }
 
-    void update() {
-        if (isBlooming && bloomFactor < 1.0f) {
-            bloomFactor += 0.005f;  // 调整这个值以改变花朵开放的速度
+    ~ProfileScope() {
+        if (stage >= 0) {
+            frameProfiler.add(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
         }
     }
 
-    void draw() const {
-        // 绘制茎
-        glColor3f(0.0, 0.5, 0.0);  // 绿色茎
-        glBegin(GL_LINES);
-        glVertex2f(x, y - 5);
-        glVertex2f(x, y - 25);
-        glEnd();
+private:
+    int stage;
+    std::chrono::steady_clock::time_point start;
+};
 
-        // 绘制叶子
-        glColor3f(0.0, 0.5, 0.0);  // 绿色叶子
-        glBegin(GL_POLYGON);
-        glVertex2f(x - 5, y - 20);
-        glVertex2f(x + 5, y - 20);
-        glVertex2f(x, y - 30);
-        glEnd();
-        glBegin(GL_POLYGON);
-        glVertex2f(x - 5, y - 10);
-        glVertex2f(x + 5, y - 10);
-        glVertex2f(x, y - 20);
-        glEnd();
+#ifdef CPT205_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) \
+    static const int PROFILE_CONCAT(profileStage, __LINE__) = frameProfiler.stage(name); \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileStage, __LINE__))
+#endif
 
-        // 绘制花蕊
-        glColor3f(1.0, 1.0, 0.0);  // 黄色花蕊
-        glBegin(GL_POLYGON);
-        for (int i = 0; i < 360; i += 10) {
-            float theta = i * 3.14159 / 180;
-            float xOffset = bloomFactor * 10 * cos(theta);
-            float yOffset = bloomFactor * 10 * sin(theta);
-            glVertex2f(x + xOffset, y + yOffset);
-        }
-        glEnd();
+std::vector<Tree> trees;
+Sky sky;
+SpecialBalloon specialBalloon;
+StaticMesh backgroundMesh;  // 地面和建筑物
+StaticMesh treeMesh;  // 树干和叶子
+bool specialBalloonRising = false;  // 特殊气球本帧是否仍在上升（上升时才绘制）
 
-        if (isBlooming)
-        {
-            // 绘制花蕊
-            glColor3f(1.0, 1.0, 0.0);  // 黄色花蕊
-            glBegin(GL_POLYGON);
-            for (int i = 0; i < 360; i += 10) {
-                float theta = i * 3.14159 / 180;
-                float xOffset = bloomFactor * 10 * cos(theta);
-                float yOffset = bloomFactor * 10 * sin(theta);
-                glVertex2f(x + xOffset, y + yOffset);
-            }
-            glEnd();
-            // 绘制花瓣
-            glColor3f(1.0, 0.5, 1.0);  // 粉红色花瓣
-            for (int petal = 0; petal < 8; petal++) {
-                float angleOffset = petal * 45 * 3.14159 / 180;
-                glBegin(GL_POLYGON);
-                for (int i = 0; i < 360; i += 45) {
-                    float theta = i * 3.14159 / 180 + angleOffset;
-                    float xOffset = bloomFactor * 20 * cos(theta);
-                    float yOffset = bloomFactor * 20 * sin(theta);
-                    glVertex2f(x + xOffset, y + yOffset);
-                }
-                glEnd();
-            }
+const double SIMULATION_STEP = 1.0 / 60.0;  // 固定的模拟步长（秒）
+const int MAX_SIMULATION_STEPS = 5;  // 每帧最多补几步，慢帧时丢弃多余的时间而不是越积越多
 
-        }
+// 模拟时钟：把真实经过的时间累积成固定步长的模拟步，与重绘频率无关
+class SimulationClock {
+private:
+    double lastTime = -1;
+    double accumulator = 0;
+
+public:
+    // 返回到 now（秒）为止需要执行的模拟步数
+    int advance(double now) {
+        if (lastTime < 0) lastTime = now;
+        accumulator += now - lastTime;
+        lastTime = now;
+        int steps = static_cast<int>(accumulator / SIMULATION_STEP);
+        accumulator -= steps * SIMULATION_STEP;
+        return std::min(steps, MAX_SIMULATION_STEPS);
+    }
+
+    // 剩余不足一步的时间占一步的比例，用于绘制插值
+    float alpha() const {
+        return static_cast<float>(accumulator / SIMULATION_STEP);
     }
 };
+SimulationClock simulationClock;
 
-class Letter {
+// 均匀网格空间索引：世界按固定大小的格子划分，每个实体登记在它的边界覆盖的所有格子里，网格外的登记在边缘的格子里。
+// 实体移动时只有跨过格子边界才改动格子；查询只访问与视野相交的格子，代价随可见的部分而不是整个世界增长
+class SpatialGrid {
 public:
-    float x, y; // 信纸的位置
-    float width = 200.0f, height = 300.0f; // 信纸的大小
-    bool isVisible; // 是否可见
+    SpatialGrid(float originX, float originY, float cellSize, int columns, int rows)
+            : originX(originX), originY(originY), cellSize(cellSize), columns(columns), rows(rows),
+              cells(static_cast<size_t>(columns) * rows) {}
 
-    Letter() {
-        x = WINDOW_WIDTH / 2; // 初始位置为屏幕中央
-        y = 0; // 初始位置在屏幕上方，确保开始时不可见
-        isVisible = false;
+    int size() const {
+        return static_cast<int>(entries.size());
     }
 
-    void setPosition(float newX, float newY){
-        x = newX;
-        y = newY;
+    // 实体数量变化时清空，之后每个实体都要重新move一次
+    void reset(int count) {
+        for (std::vector<int>& cell : cells) {
+            cell.clear();
+        }
+        entries.assign(count, Entry());
+        marks.assign(count, 0);
     }
 
-    void drawText(const char* text) {
-        float textWidth = glutBitmapLength(GLUT_BITMAP_HELVETICA_10, (const unsigned char*)text);
-        float textX = x - textWidth / 2;
-        float textY = y + height / 2 - 20;
-
-        glColor3f(0, 0, 0); // 设置文字颜色为黑色
-        glRasterPos2f(textX, textY);
-        for (const char* c = text; *c != '\0'; c++) {
-            // 检查当前字符是否为换行符
-            if (*c == '\n') {
-                textY -= 20; // 根据字体大小调整换行的距离
-                textX = x - width / 2;
-                glRasterPos2f(textX, textY);
-                continue; // 跳过当前循环迭代，处理下一个字符
-            }
-
-            glutBitmapCharacter(GLUT_BITMAP_HELVETICA_10, *c);
-            // 如果文字宽度超过信纸的宽度，进行换行
-            if (textX + glutBitmapWidth(GLUT_BITMAP_HELVETICA_10, *c) > x + width / 2) {
-                textY -= 20; // 根据字体大小调整换行的距离
-                textX = x - width / 2;
-                glRasterPos2f(textX, textY);
-            }
-            textX += glutBitmapWidth(GLUT_BITMAP_HELVETICA_10, *c);
+    void move(int id, const Bounds& bounds) {
+        Entry& entry = entries[id];
+        CellRange range = cellsOf(bounds);
+        entry.bounds = bounds;
+        if (entry.registered && range == entry.cells) return;
+        if (entry.registered) {
+            forEachCell(entry.cells, [&](std::vector<int>& cell) {
+                cell.erase(std::find(cell.begin(), cell.end(), id));
+            });
         }
+        forEachCell(range, [&](std::vector<int>& cell) {
+            cell.push_back(id);
+        });
+        entry.cells = range;
+        entry.registered = true;
     }
 
+    // 把边界与view相交的实体按编号从小到大写入out，保持原来的绘制顺序
+    void query(const Bounds& view, std::vector<int>& out) {
+        out.clear();
+        if (++mark == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            mark = 1;
+        }
+        forEachCell(cellsOf(view), [&](std::vector<int>& cell) {
+            for (int id : cell) {
+                if (marks[id] == mark) continue;  // 跨多个格子的实体只看一次
+                marks[id] = mark;
+                if (entries[id].bounds.overlaps(view)) out.push_back(id);
+            }
+        });
+        std::sort(out.begin(), out.end());
+    }
 
+private:
+    struct CellRange {
+        int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
 
-    void draw() {
-        if (isVisible) {
-            glColor3f(1.0, 1.0, 1.0); // 设置信纸颜色为白色
-            glBegin(GL_QUADS);
-            glVertex2f(x - width / 2, y - height / 2);
-            glVertex2f(x + width / 2, y - height / 2);
-            glVertex2f(x + width / 2, y + height / 2);
-            glVertex2f(x - width / 2, y + height / 2);
-            glEnd();
-            drawDetails();
+        bool operator==(const CellRange& other) const {
+            return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1;
         }
+    };
+
+    struct Entry {
+        Bounds bounds = {0, 0, -1, -1};
+        CellRange cells;
+        bool registered = false;
+    };
+
+    float originX, originY, cellSize;
+    int columns, rows;
+    std::vector<std::vector<int>> cells;
+    std::vector<Entry> entries;
+    std::vector<unsigned> marks;  // 查询时去重：本次查询已经看过的实体记为mark
+    unsigned mark = 0;
+
+    int clampedCell(float coordinate, float origin, int count) const {
+        int cell = static_cast<int>(std::floor((coordinate - origin) / cellSize));
+        return std::min(std::max(cell, 0), count - 1);
     }
 
-    void drawDetails() {
-        //TODO 绘制信纸的细节
-        glColor3f(0.8, 0.8, 0.8); // 设置线条颜色为浅灰色
-        for (float i = y - height / 2 + 10; i < y + height / 2; i += 10) {
-            glBegin(GL_LINES);
-            glVertex2f(x - width / 2 + 10, i);
-            glVertex2f(x + width / 2 - 10, i);
-            glEnd();
-        }
+    CellRange cellsOf(const Bounds& bounds) const {
+        CellRange range;
+        range.x0 = clampedCell(bounds.x0, originX, columns);
+        range.y0 = clampedCell(bounds.y0, originY, rows);
+        range.x1 = clampedCell(bounds.x1, originX, columns);
+        range.y1 = clampedCell(bounds.y1, originY, rows);
+        return range;
     }
 
-    void show() {
-        isVisible = true;
+    template <typename Visit>
+    void forEachCell(const CellRange& range, Visit&& visit) {
+        for (int y = range.y0; y <= range.y1; y++) {
+            for (int x = range.x0; x <= range.x1; x++) {
+                visit(cells[static_cast<size_t>(y) * columns + x]);
+            }
+        }
     }
 };
-Letter letter;
 
-class Balloon {
-protected:
-    float x,y;
-    float speed;
+// 实体组件存储（按原型组织）：组件组合和形状都相同的实体属于同一个原型，原型里每种组件一个连续数组，
+// 各数组的第row行属于同一个实体。系统只访问自己需要的组件数组，按行线性遍历；
+// 新的实体种类只是新的组件组合或形状，不必在display里再写一遍循环。场景里的实体只增不删，行号不变
+struct Transform {
+    float x, y;
+    float prevY;  // 上一步模拟时的高度，用于插值
+};
+
+struct Motion {
+    float speed;  // 每步上升的距离
+    float windTime;  // 风的相位
+    float windStep;  // 每步相位的增量
+    float sway;  // 绳子控制点的偏移
+};
+
+struct Colour {
     float r, g, b;
-    float controlPointOffset;
-    bool isHoldingText;
-    float windTime = 0.0f; // 是否拉着字上升
+};
 
+struct Shape {
+    int variant;  // 气球：1表示拉着字；烟花：粒子系统中的发射器
+};
+
+struct Lifetime {
+    float progress;  // 花的开放程度，0表示完全闭合的花苞，1表示完全开放的花
+    bool running;  // 花是否在开放
+    int age;  // 经过的模拟步数，烟花这一轮爆炸的时间
+};
+
+enum ComponentMask : unsigned {
+    COMPONENT_TRANSFORM = 1 << 0,
+    COMPONENT_MOTION = 1 << 1,
+    COMPONENT_COLOUR = 1 << 2,
+    COMPONENT_SHAPE = 1 << 3,
+    COMPONENT_LIFETIME = 1 << 4,
+};
+
+// 怎样画、怎样计算边界由形状决定
+enum ShapeKind {
+    SHAPE_BALLOON,
+    SHAPE_FLOWER,
+    SHAPE_FIREWORK,
+};
+
+struct Entity {
+    int archetype = -1;
+    int row = -1;
+};
+
+struct Archetype {
+    unsigned components;
+    ShapeKind kind;
+    int size = 0;
+    std::vector<Transform> transform;
+    std::vector<Motion> motion;
+    std::vector<Colour> colour;
+    std::vector<Shape> shape;
+    std::vector<Lifetime> lifetime;
+    // 行号的空间索引：格子100x100，覆盖地面以下300到特殊气球模式镜头的最高处。移动过的原型在下次查询前重新登记
+    SpatialGrid grid = SpatialGrid(-100, -300, 100, 8, 23);
+    bool moved = true;
+};
+
+class World {
 public:
-    Balloon(float x, float y, float r, float g, float b, bool isHoldingText = false)
-            : x(x), y(y), r(r), g(g), b(b), isHoldingText(isHoldingText) {
-        speed = isHoldingText ? 2.0f : 1.0f + static_cast<float>(rand() % 3);  // 如果拉着字，速度固定为2.0，否则随机速度
+    // 新实体的组件都是零，由调用者填写
+    Entity create(unsigned components, ShapeKind kind) {
+        return append(components, kind, 1);
     }
 
-    Balloon() {
-        x = static_cast<float>(rand() % WINDOW_WIDTH);
-        y = -100;
-        r = static_cast<float>(rand()) / RAND_MAX;
-        g = static_cast<float>(rand()) / RAND_MAX;
-        b = static_cast<float>(rand()) / RAND_MAX;
-        isHoldingText = false;
-        speed = 1.0f + static_cast<float>(rand() % 3);  // 随机速度
+    // 一次加入count个实体，返回第一个；组件都是零，由调用者整块填写
+    Entity append(unsigned components, ShapeKind kind, int count) {
+        Entity entity;
+        entity.archetype = find(components, kind);
+        Archetype& type = archetypes[entity.archetype];
+        size_t size = static_cast<size_t>(type.size) + count;
+        if (components & COMPONENT_TRANSFORM) type.transform.resize(size);
+        if (components & COMPONENT_MOTION) type.motion.resize(size);
+        if (components & COMPONENT_COLOUR) type.colour.resize(size);
+        if (components & COMPONENT_SHAPE) type.shape.resize(size);
+        if (components & COMPONENT_LIFETIME) type.lifetime.resize(size);
+        entity.row = type.size;
+        type.size += count;
+        type.moved = true;
+        return entity;
     }
 
-    void update() {
-        y += speed;
-        windTime += 0.05f;  // 偏移程度
-        controlPointOffset = sin(windTime) * 5.0f;  // 调风速
+    Archetype& archetype(Entity entity) {
+        return archetypes[entity.archetype];
     }
 
-    void setSpeed(float newSpeed) {
-        speed = newSpeed;
+    Transform& transform(Entity entity) {
+        return archetypes[entity.archetype].transform[entity.row];
     }
 
+    // 对每个包含这些组件（且形状相同）的原型调用system
+    template <typename System>
+    void each(unsigned components, System&& system) {
+        for (Archetype& type : archetypes) {
+            if ((type.components & components) == components) system(type);
+        }
+    }
 
-    bool holdingText() const {
-        return isHoldingText;
+    template <typename System>
+    void each(unsigned components, ShapeKind kind, System&& system) {
+        for (Archetype& type : archetypes) {
+            if ((type.components & components) == components && type.kind == kind) system(type);
+        }
     }
 
-    void setColor(float newR, float newG, float newB) {
-        r = newR;
-        g = newG;
-        b = newB;
+    int count(ShapeKind kind) const {
+        int total = 0;
+        for (const Archetype& type : archetypes) {
+            if (type.kind == kind) total += type.size;
+        }
+        return total;
     }
 
+private:
+    std::vector<Archetype> archetypes;
 
-    float getY() const {
-        return y;
+    int find(unsigned components, ShapeKind kind) {
+        for (size_t i = 0; i < archetypes.size(); i++) {
+            if (archetypes[i].components == components && archetypes[i].kind == kind) return static_cast<int>(i);
+        }
+        Archetype type;
+        type.components = components;
+        type.kind = kind;
+        archetypes.push_back(type);
+        return static_cast<int>(archetypes.size()) - 1;
     }
+};
+World world;
+Entity bannerBalloon;  // 左边拉着字的气球，横幅的高度跟着它
 
-    void setY(float newY) {
-        y = newY;
-    }
+const unsigned BALLOON_COMPONENTS = COMPONENT_TRANSFORM | COMPONENT_MOTION | COMPONENT_COLOUR | COMPONENT_SHAPE;
+const unsigned FLOWER_COMPONENTS = COMPONENT_TRANSFORM | COMPONENT_LIFETIME;
+const unsigned FIREWORK_COMPONENTS = COMPONENT_TRANSFORM | COMPONENT_SHAPE | COMPONENT_LIFETIME;
 
-    virtual void draw() {
-        if (!isHoldingText == true) {
-            //绘制弯曲的绳子
-            glColor3f(0.5, 0.5, 0.5);  // 灰色
-            float controlX = x + controlPointOffset;
-            float controlY = y - 40;  // 控制点
-
-            glBegin(GL_LINE_STRIP);  // 使用GL_LINE_STRIP来绘制连续的线段
-            glVertex2f(x, y);  // 起点
-            // 使用贝塞尔曲线的公式来绘制曲线
-            for (float t = 0; t <= 1; t += 0.01) {
-                float pointX = (1 - t) * (1 - t) * x + 2 * (1 - t) * t * controlX + t * t * x;
-                float pointY = (1 - t) * (1 - t) * y + 2 * (1 - t) * t * controlY + t * t * (y - 80);
-                glVertex2f(pointX, pointY);
-            }
-            glEnd();
-        }
-        else
-        {
-            // 绘制绳子
-            glColor3f(0.5, 0.5, 0.5);  // 灰色
-            glBegin(GL_LINES);
-            glVertex2f(x, y - 30);  // 气球底部
-            glVertex2f(x, y - 80);  // 绳子的末端
-            glEnd();
-        }
-        // 绘制气球
-        glColor3f(r, g, b);  // 红色
-        glBegin(GL_POLYGON);
-        for (int i = 0; i < 360; i += 10) {
-            float degInRad = i * 3.14159 / 180;
-            glVertex2f(x + cos(degInRad) * 20, y + sin(degInRad) * 30);  // 椭圆形的气球
-        }
-        glEnd();
+float renderY(const Transform& transform) {
+    return transform.prevY + (transform.y - transform.prevY) * interpolationAlpha;
+}
 
-    // 绘制高光
-        float highlightWidth = 10.0f;  // 高光的宽度
-        float highlightHeight = 5.0f;  // 高光的高度
-        float highlightX = x;  // 高光X
-        float highlightY = y + 15.0f;  // 高光Y
+// 拉着字的气球速度固定为2，其他的随机为1到3
+Entity spawnBalloon(float x, float y, float r, float g, float b, bool isHoldingText = false) {
+    Entity entity = world.create(BALLOON_COMPONENTS, SHAPE_BALLOON);
+    Archetype& type = world.archetype(entity);
+    type.transform[entity.row] = {x, y, y};
+    type.motion[entity.row] = {isHoldingText ? 2.0f : 1.0f + static_cast<float>(threadRandom().below(3)), 0.0f, 0.05f, 0.0f};
+    type.colour[entity.row] = {r, g, b};
+    type.shape[entity.row].variant = isHoldingText ? 1 : 0;
+    return entity;
+}
 
-        glBegin(GL_TRIANGLE_FAN);
-        glColor4f(1.0f, 1.0f, 1.0f, 0.6f);  // 高光颜色
-        glVertex2f(highlightX, highlightY);  // 高光中心点
-        for (int i = 0; i <= 360; i += 10) {  // 高光的边缘
-            glColor4f(1.0f, 1.0f, 1.0f, 0.0f);  // 高光的边缘颜色
-            float degInRad = i * DEG2RAD;
-            glVertex2f(highlightX + cos(degInRad) * highlightWidth, highlightY + sin(degInRad) * highlightHeight);
-        }
-        glEnd();
+Entity spawnFlower(float x, float y) {
+    Entity entity = world.create(FLOWER_COMPONENTS, SHAPE_FLOWER);
+    world.transform(entity) = {x, y, y};
+    return entity;
+}
 
+// 烟花在随机位置重新爆炸，复用自己发射器的粒子槽位；每个粒子5个随机数（速度、方向、颜色），一次批量生成
+void respawnFirework(Archetype& type, int row) {
+    Random& random = threadRandom();
+    Transform& transform = type.transform[row];
+    transform.x = static_cast<float>(random.below(WINDOW_WIDTH));
+    transform.y = static_cast<float>(500 + random.below(300));
+    transform.prevY = transform.y;
+    type.lifetime[row].age = 0;
+    int emitter = type.shape[row].variant;
+    int numParticles = 100 + random.below(100);  // 生成100到200个粒子
+    int first = particleSystem.respawn(emitter, numParticles);
+    int count = particleSystem.emitters[emitter].count;
+    float u[MAX_PARTICLES_PER_FIREWORK * 5];
+    random.fill(u, count * 5);
+    for (int i = first; i < first + count; i++) {
+        const float* v = u + (i - first) * 5;
+        float speed = 1.0f + v[0];  // 速度范围：1到2
+        float angle = v[1] * static_cast<float>(2 * TABLE_PI);  // 随机方向
+        particleSystem.position[i * 2] = transform.x;
+        particleSystem.position[i * 2 + 1] = transform.y;
+        particleSystem.velocity[i * 2] = speed * cos(angle);
+        particleSystem.velocity[i * 2 + 1] = speed * sin(angle);
+        particleSystem.life[i] = 2.0;  // 初始生命周期为2
+        particleSystem.colour[i * 4] = v[2];
+        particleSystem.colour[i * 4 + 1] = v[3];
+        particleSystem.colour[i * 4 + 2] = v[4];
+    }
+    particleSystem.resetInterpolation(first, particleSystem.emitters[emitter].count);
+}
 
+Entity spawnFirework() {
+    Entity entity = world.create(FIREWORK_COMPONENTS, SHAPE_FIREWORK);
+    Archetype& type = world.archetype(entity);
+    type.shape[entity.row].variant = particleSystem.addEmitter();
+    respawnFirework(type, entity.row);
+    return entity;
+}
 
+// 系统：每个系统处理一个原型中[begin, end)的行，可以分块并行
 
+// 上升并随风摆动
+void motionSystem(Archetype& type, int begin, int end) {
+    Transform* transform = type.transform.data();
+    Motion* motion = type.motion.data();
+    for (int i = begin; i < end; i++) {
+        transform[i].y += motion[i].speed;
+        motion[i].windTime += motion[i].windStep;  // 偏移程度
+        motion[i].sway = sin(motion[i].windTime) * 5.0f;  // 调风速
     }
-};
-class SpecialBalloon : public Balloon {
-protected:
-    float speed =0.5;
-public:
-    bool isActive;
+}
 
-    SpecialBalloon() : Balloon() {
-        x = WINDOW_WIDTH/2;  // 屏幕中央
-        y = 0.0f;  // 屏幕中央
-        r = 1.0f;  // 红色
-        g = 0.0f;
-        b = 0.0f;
+// 气球放飞后额外上升：拉着字的固定速度，其他的随机1到3
+void riseSystem(Archetype& type, int begin, int end) {
+    Random& random = threadRandom();
+    Transform* transform = type.transform.data();
+    const Shape* shape = type.shape.data();
+    for (int i = begin; i < end; i++) {
+        if (shape[i].variant) {
+            transform[i].y = transform[i].y + 2;
+        } else {
+            transform[i].y = transform[i].y + 1 + random.below(3);
+        }
     }
+}
 
-    void rise() {
-        if (isActive) {
-            y += speed;// 气球上升
+// 飞出屏幕的气球从底部重新出现并换一种颜色；拉着字的气球到达屋顶后停止上升
+void recycleSystem(Archetype& type, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        Transform& transform = type.transform[i];
+        if (transform.y <= WINDOW_HEIGHT) continue;
+        if (type.shape[i].variant) {
+            type.motion[i].speed = 0;
+            continue;
         }
+        transform.y = -100;
+        transform.prevY = transform.y;
+        Random& random = threadRandom();
+        type.colour[i] = {random.uniform(), random.uniform(), random.uniform()};
     }
+}
 
-    void activate() {
-        isActive = true; // 激活气球
+void bloomSystem(Archetype& type, int begin, int end) {
+    Lifetime* lifetime = type.lifetime.data();
+    for (int i = begin; i < end; i++) {
+        if (lifetime[i].running && lifetime[i].progress < 1.0f) {
+            lifetime[i].progress += 0.005f;  // 调整这个值以改变花朵开放的速度
+        }
     }
+}
 
-    void update() {
-        y += speed;
-        windTime += 0.1f;  // 偏移程度
-        controlPointOffset = sin(windTime) * 5.0f;  // 调风速
+// 粒子积分、淡出，完全透明后重新爆炸
+void fireworkSystem(Archetype& type, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        ParticleSystem::Emitter& e = particleSystem.emitters[type.shape[i].variant];
+        particleSystem.integrate(e.first, e.count);
+        type.lifetime[i].age++;
+        e.alpha -= 0.01;  // 减少烟花的透明度
+        if (e.alpha <= 0) {
+            respawnFirework(type, i);
+        }
     }
+}
 
-    virtual void draw() override {
-        //绘制弯曲的绳子
-        glColor3f(0.5, 0.5, 0.5);  // 灰色
-        float controlX = x + controlPointOffset;
-        float controlY = y - 80;  // 控制点
+// 每个模拟步开始时记录会移动的实体的高度
+void snapshotSystem(Archetype& type) {
+    for (int i = 0; i < type.size; i++) {
+        type.transform[i].prevY = type.transform[i].y;
+    }
+}
 
-        glBegin(GL_LINE_STRIP);  // 使用GL_LINE_STRIP来绘制连续的线段
-        glVertex2f(x, y);  // 起点
-        // 使用贝塞尔曲线的公式来绘制曲线
-        for (float t = 0; t <= 1; t += 0.01) {
-            float pointX = (1 - t) * (1 - t) * x + 2 * (1 - t) * t * controlX + t * t * x;
-            float pointY = (1 - t) * (1 - t) * y + 2 * (1 - t) * t * controlY + t * t * (y - 200);
-            glVertex2f(pointX, pointY);
-        }
-        glEnd();
+// 实体可能覆盖的区域。气球包括插值范围（上一步到当前步）、半宽20、上沿30、长80并随风摆动最多5的绳子；
+// 花完全开放时花瓣半径20，叶子到y-30；烟花的粒子从起点沿直线飞出，每步最多移动2，点的大小是3
+Bounds entityBounds(const Archetype& type, int row) {
+    const Transform& t = type.transform[row];
+    switch (type.kind) {
+    case SHAPE_BALLOON:
+        return {t.x - 25, std::min(t.prevY, t.y) - 80, t.x + 25, std::max(t.prevY, t.y) + 30};
+    case SHAPE_FLOWER:
+        return {t.x - 20, t.y - 30, t.x + 20, t.y + 20};
+    case SHAPE_FIREWORK:
+    default: {
+        float radius = 2.0f * type.lifetime[row].age + 2;
+        return {t.x - radius, t.y - radius, t.x + radius, t.y + radius};
+    }
+    }
+}
 
-        glColor3f(1.0, 0.0, 0.0);  // 红色
-        float balloonRadiusX = 60.0f;  // 特殊气球的X轴半径
-        float balloonRadiusY = 90.0f;  // 特殊气球的Y轴半径
-        glBegin(GL_POLYGON);
-        for (int i = 0; i < 360; i += 10) {
-            float degInRad = i * 3.14159 / 180;
-            glVertex2f(x + cos(degInRad) * balloonRadiusX, y + sin(degInRad) * balloonRadiusY);  // 椭圆形的气球
-        }
-        glEnd();
+// 把原型的每一行按当前边界登记到它的网格里
+void indexSystem(Archetype& type) {
+    if (type.grid.size() != type.size) type.grid.reset(type.size);
+    for (int i = 0; i < type.size; i++) {
+        type.grid.move(i, entityBounds(type, i));
+    }
+    type.moved = false;
+}
 
-        // 绘制高光
-        float highlightWidth = 30.0f;  // 高光的宽度
-        float highlightHeight = 15.0f;  // 高光的高度
-        float highlightX = x;  // 高光X
-        float highlightY = y + 45.0f;  // 高光Y
+std::vector<int> visibleScratch;  // 每次查询可见实体的临时数组
+
+// 场景文件：文本格式用来编写，每行一条，#之后是注释：
+//   seed N               下面的随机条目用的种子（默认1）
+//   star x y 亮度         stars N    随机放N颗星星
+//   cloud x y 宽 高       clouds N
+//   tree x y
+//   banner x y r g b     拉着横幅的气球，横幅跟着第一个
+//   balloon x y r g b    balloons N
+//   flower x y           flowers N
+//   fireworks N          烟花每轮在随机位置爆炸，只记数量
+// 没写星星或云时保留天空自己随机生成的。编译成.cscene：头、段目录、按16字节对齐的数据段，
+// 每段是一个数组，随机条目在编译时已经展开，元素布局与内存中的Star、Cloud和各组件相同，
+// 加载时映射文件后每段整块复制，不逐个实体解析
+struct SceneFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t sections;
+    uint32_t fireworks;
+    uint32_t bannerBalloon;  // 横幅跟着的气球在气球数组中的位置
+    uint32_t reserved;
+    uint64_t sourceSize;  // 源文件的大小和修改时间，变了就重新编译
+    int64_t sourceTime;
+};
 
-        glBegin(GL_TRIANGLE_FAN);
-        glColor4f(1.0f, 1.0f, 1.0f, 0.6f);  // 高光颜色
-        glVertex2f(highlightX, highlightY);  // 高光中心点
-        for (int i = 0; i <= 360; i += 10) {  // 高光的边缘
-            glColor4f(1.0f, 1.0f, 1.0f, 0.0f);  // 高光的边缘颜色
-            float degInRad = i * 3.14159 / 180;
-            glVertex2f(highlightX + cos(degInRad) * highlightWidth, highlightY + sin(degInRad) * highlightHeight);
-        }
-        glEnd();
+struct SceneFileSection {
+    uint32_t content;
+    uint32_t kind;  // 组件段：实体的形状和组件
+    uint32_t component;
+    uint32_t count;
+    uint64_t offset, size;
+};
 
-        if (y >=200) {
-            if (letter.y >= WINDOW_HEIGHT / 2) {
-                letter.y = WINDOW_HEIGHT / 2;  // 保持信纸在屏幕中心
-            } else {
-                // 更新信纸的位置
-                float letterX = x;
-                float letterY = y - 250;  // 信纸位于绳子的末端
-                letter.setPosition(letterX, letterY);
-            }
-        }
-        letter.show();
+enum SceneFileContent : uint32_t { SCENE_STARS = 0, SCENE_CLOUDS = 1, SCENE_TREES = 2, SCENE_COMPONENT = 3 };
+const uint32_t SCENE_FILE_VERSION = 2;  // 2：随机条目改用xoshiro128++生成器，旧缓存展开的内容不同，需要重新编译
 
-    }
+struct SceneTree {
+    int32_t x, y;
 };
 
-struct Star {
-    float x, y;  // 星星的位置
-    float brightness;  // 星星的亮度
-};
-struct Cloud {
-    float x, y;  // 云朵的位置
-    float width, height;  // 云朵的大小
-};
-class Sky {
-private:
-    float red, green, blue;
+// 编译中的场景，每个数组对应文件里的一段
+struct SceneSource {
     std::vector<Star> stars;
     std::vector<Cloud> clouds;
+    std::vector<SceneTree> trees;
+    std::vector<Transform> balloonTransforms;
+    std::vector<Motion> balloonMotions;
+    std::vector<Colour> balloonColours;
+    std::vector<Shape> balloonShapes;
+    std::vector<Transform> flowerTransforms;
+    std::vector<Lifetime> flowerLifetimes;
+    uint32_t fireworks = 0;
+    int bannerBalloon = -1;
+};
 
-public:
-    Sky() : red(0.0), green(0.0), blue(0.5) {
-        initStars();
-        initClouds();
-    }
-
-    void darken() {
-        blue -= 0.005;  // 每次减少的量，可以根据需要调整
-        if (blue < 0.2) blue = 0.2;  // 设置最小值为偏蓝黑的黑色
-    }
-
-    float getColor() const {
-        return skyColor;
+// 随机条目的分布与默认场景相同；出错时报告文件名和行号
+bool parseSceneText(const char* source, SceneSource& scene) {
+    std::ifstream in(source);
+    if (!in) {
+        std::cerr << "Failed to open scene file: " << source << std::endl;
+        return false;
     }
+    static const std::unordered_map<std::string, int> ARGUMENTS = {
+            {"seed", 1}, {"star", 3}, {"stars", 1}, {"cloud", 4}, {"clouds", 1}, {"tree", 2}, {"banner", 5},
+            {"balloon", 5}, {"balloons", 1}, {"flower", 2}, {"flowers", 1}, {"fireworks", 1}};
+    Random random(1);  // 与--seed无关，同一个场景文件总是编译出同样的结果
+    auto below = [&random](int n) { return static_cast<float>(random.below(n)); };
+    auto unit = [&random]() { return random.uniform(); };
+    auto addBalloon = [&](float x, float y, float r, float g, float b, bool isHoldingText) {
+        if (isHoldingText && scene.bannerBalloon < 0) scene.bannerBalloon = static_cast<int>(scene.balloonTransforms.size());
+        scene.balloonTransforms.push_back({x, y, y});
+        scene.balloonMotions.push_back({isHoldingText ? 2.0f : 1.0f + below(3), 0.0f, 0.05f, 0.0f});
+        scene.balloonColours.push_back({r, g, b});
+        scene.balloonShapes.push_back({isHoldingText ? 1 : 0});
+    };
 
-    void draw() const {
-        for (const Star& star : stars) {
-            drawStar(star);
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string keyword, extra;
+        if (!(words >> keyword)) continue;
+        auto arguments = ARGUMENTS.find(keyword);
+        float v[5];
+        int n = 0;
+        while (arguments != ARGUMENTS.end() && n < arguments->second && words >> v[n]) n++;
+        if (arguments == ARGUMENTS.end() || n != arguments->second || words >> extra ||
+            (n == 1 && (v[0] < 0 || v[0] > 1e7f || v[0] != std::floor(v[0])))) {
+            std::cerr << source << ":" << number << ": invalid line: " << line << std::endl;
+            return false;
         }
-
-        for (const Cloud& cloud : clouds) {
-            drawCloud(cloud);
+        int count = static_cast<int>(v[0]);
+        if (keyword == "seed") {
+            random = Random(static_cast<uint64_t>(count));
+        } else if (keyword == "star") {
+            scene.stars.push_back({v[0], v[1], v[2]});
+        } else if (keyword == "stars") {
+            for (int i = 0; i < count; i++) {
+                float x = below(WINDOW_WIDTH), y = below(WINDOW_HEIGHT / 2) + WINDOW_HEIGHT / 2;
+                scene.stars.push_back({x, y, unit()});
+            }
+        } else if (keyword == "cloud") {
+            scene.clouds.push_back({v[0], v[1], v[2], v[3], v[0]});
+        } else if (keyword == "clouds") {
+            for (int i = 0; i < count; i++) {
+                float x = below(WINDOW_WIDTH), y = below(WINDOW_HEIGHT / 2) + WINDOW_HEIGHT / 4;
+                float width = 50 + below(100), height = 20 + below(40);
+                scene.clouds.push_back({x, y, width, height, x});
+            }
+        } else if (keyword == "tree") {
+            scene.trees.push_back({static_cast<int32_t>(v[0]), static_cast<int32_t>(v[1])});
+        } else if (keyword == "banner" || keyword == "balloon") {
+            addBalloon(v[0], v[1], v[2], v[3], v[4], keyword == "banner");
+        } else if (keyword == "balloons") {
+            for (int i = 0; i < count; i++) {
+                float x = below(WINDOW_WIDTH), r = unit(), g = unit(), b = unit();
+                addBalloon(x, -100, r, g, b, false);
+            }
+        } else if (keyword == "flower") {
+            scene.flowerTransforms.push_back({v[0], v[1], v[1]});
+            scene.flowerLifetimes.push_back(Lifetime());  // 值初始化，填充字节也是零
+        } else if (keyword == "flowers") {
+            for (int i = 0; i < count; i++) {
+                float x = below(WINDOW_WIDTH), y = below(100);
+                scene.flowerTransforms.push_back({x, y, y});
+                scene.flowerLifetimes.push_back(Lifetime());
+            }
+        } else {
+            scene.fireworks += count;
         }
     }
-
-    float getRed() const {
-        return red;
+    if (scene.bannerBalloon < 0) {
+        std::cerr << source << ": scene needs a banner balloon" << std::endl;
+        return false;
     }
+    return true;
+}
 
-    float getGreen() const {
-        return green;
+// 场景文本 -> .cscene文件的全部内容
+bool buildSceneFile(const char* source, std::vector<unsigned char>& bytes) {
+    SceneSource scene;
+    SceneFileHeader header{};
+    memcpy(header.magic, "CSCN", 4);
+    header.version = SCENE_FILE_VERSION;
+    if (!parseSceneText(source, scene) || !readSourceStamp(source, header.sourceSize, header.sourceTime)) {
+        std::cerr << "Failed to compile scene file: " << source << std::endl;
+        return false;
+    }
+    header.fireworks = scene.fireworks;
+    header.bannerBalloon = static_cast<uint32_t>(scene.bannerBalloon);
+
+    std::vector<SceneFileSection> directory;
+    std::vector<const void*> arrays;
+    auto add = [&](uint32_t content, uint32_t kind, uint32_t component, const auto& items) {
+        if (items.empty()) return;
+        directory.push_back({content, kind, component, static_cast<uint32_t>(items.size()), 0, sizeof(items[0]) * items.size()});
+        arrays.push_back(items.data());
+    };
+    add(SCENE_STARS, 0, 0, scene.stars);
+    add(SCENE_CLOUDS, 0, 0, scene.clouds);
+    add(SCENE_TREES, 0, 0, scene.trees);
+    add(SCENE_COMPONENT, SHAPE_BALLOON, COMPONENT_TRANSFORM, scene.balloonTransforms);
+    add(SCENE_COMPONENT, SHAPE_BALLOON, COMPONENT_MOTION, scene.balloonMotions);
+    add(SCENE_COMPONENT, SHAPE_BALLOON, COMPONENT_COLOUR, scene.balloonColours);
+    add(SCENE_COMPONENT, SHAPE_BALLOON, COMPONENT_SHAPE, scene.balloonShapes);
+    add(SCENE_COMPONENT, SHAPE_FLOWER, COMPONENT_TRANSFORM, scene.flowerTransforms);
+    add(SCENE_COMPONENT, SHAPE_FLOWER, COMPONENT_LIFETIME, scene.flowerLifetimes);
+    header.sections = static_cast<uint32_t>(directory.size());
+
+    auto align = [](uint64_t offset) { return (offset + 15) & ~static_cast<uint64_t>(15); };
+    uint64_t offset = align(sizeof(header) + sizeof(SceneFileSection) * directory.size());
+    for (SceneFileSection& section : directory) {
+        section.offset = offset;
+        offset = align(offset + section.size);
     }
 
-    float getBlue() const {
-        return blue;
+    bytes.assign(offset, 0);
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + sizeof(header), directory.data(), sizeof(SceneFileSection) * directory.size());
+    for (size_t i = 0; i < directory.size(); i++) {
+        memcpy(bytes.data() + directory[i].offset, arrays[i], directory[i].size);
     }
+    return true;
+}
 
-    void updateClouds() {
-        for (auto& cloud : clouds) {
-            cloud.x -= 0.5;  // 平移速度，可以根据需要调整
+// 离线/首次运行的编译，写到target
+bool compileSceneFile(const char* source, const char* target) {
+    std::vector<unsigned char> bytes;
+    return buildSceneFile(source, bytes) && writeFileAtomically(target, bytes);
+}
 
-            // 如果云朵完全移出屏幕，生成一个新的云朵
-            if (cloud.x + cloud.width < 0) {
-                cloud.x = WINDOW_WIDTH;
-                cloud.y = static_cast<float>(rand() % (WINDOW_HEIGHT / 2) + (WINDOW_HEIGHT / 4));
-                cloud.width = 50 + static_cast<float>(rand() % 100);
-                cloud.height = 20 + static_cast<float>(rand() % 40);
-            }
+// 段的元素大小，0表示不认识的段
+size_t sceneElementSize(const SceneFileSection& section) {
+    switch (section.content) {
+    case SCENE_STARS: return sizeof(Star);
+    case SCENE_CLOUDS: return sizeof(Cloud);
+    case SCENE_TREES: return sizeof(SceneTree);
+    case SCENE_COMPONENT:
+        if (section.kind != SHAPE_BALLOON && section.kind != SHAPE_FLOWER) return 0;
+        switch (section.component) {
+        case COMPONENT_TRANSFORM: return sizeof(Transform);
+        case COMPONENT_MOTION: return sizeof(Motion);
+        case COMPONENT_COLOUR: return sizeof(Colour);
+        case COMPONENT_SHAPE: return sizeof(Shape);
+        case COMPONENT_LIFETIME: return sizeof(Lifetime);
         }
     }
+    return 0;
+}
 
-    void updateStars() {
-        for (auto& star : stars) {
-            star.brightness += (rand() % 3 - 1) * 0.05;  // 随机增加或减少亮度
-            if (star.brightness < 0) star.brightness = 0;
-            if (star.brightness > 1) star.brightness = 1;
-        }
+SceneFileSection sceneSection(const unsigned char* data, uint32_t index) {
+    SceneFileSection section;
+    memcpy(&section, data + sizeof(SceneFileHeader) + sizeof(section) * index, sizeof(section));
+    return section;
+}
+
+// 检查.cscene的内容是否完整、与源文件一致；同一形状的组件段行数必须相同，组件组合必须是系统认识的
+bool validSceneFile(const unsigned char* data, size_t size, const char* source) {
+    if (size < sizeof(SceneFileHeader)) return false;
+    SceneFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    if (memcmp(header.magic, "CSCN", 4) != 0 || header.version != SCENE_FILE_VERSION || header.sections > 64) return false;
+    if (readSourceStamp(source, sourceSize, sourceTime) && (sourceSize != header.sourceSize || sourceTime != header.sourceTime)) return false;
+    if (size < sizeof(header) + sizeof(SceneFileSection) * header.sections) return false;
+    unsigned components[2] = {0, 0};
+    uint32_t rows[2] = {0, 0};
+    for (uint32_t i = 0; i < header.sections; i++) {
+        SceneFileSection section = sceneSection(data, i);
+        size_t elementSize = sceneElementSize(section);
+        if (elementSize == 0 || section.offset % 16 != 0 || section.offset > size || section.size > size - section.offset ||
+            section.size != static_cast<uint64_t>(elementSize) * section.count) return false;
+        if (section.content != SCENE_COMPONENT) continue;
+        if ((components[section.kind] & section.component) != 0 || (components[section.kind] != 0 && rows[section.kind] != section.count)) return false;
+        components[section.kind] |= section.component;
+        rows[section.kind] = section.count;
     }
+    return components[SHAPE_BALLOON] == BALLOON_COMPONENTS && (components[SHAPE_FLOWER] == 0 || components[SHAPE_FLOWER] == FLOWER_COMPONENTS) &&
+           header.bannerBalloon < rows[SHAPE_BALLOON];
+}
 
-    void specialUpdateClouds(float balloonY) {
-        float cloudYLimit = WINDOW_HEIGHT - (balloonY / 2);  // 根据气球的高度调整云朵的上限
+void* componentRows(Archetype& type, uint32_t component, int row) {
+    switch (component) {
+    case COMPONENT_TRANSFORM: return &type.transform[row];
+    case COMPONENT_MOTION: return &type.motion[row];
+    case COMPONENT_COLOUR: return &type.colour[row];
+    case COMPONENT_SHAPE: return &type.shape[row];
+    default: return &type.lifetime[row];
+    }
+}
 
-        for (auto& cloud : clouds) {
-            cloud.x -= 0.5;  // 平移速度，可以根据需要调整
+bool sceneLoaded = false;  // 加载了场景文件时init不再生成默认场景
+
+// 加载场景文件对应的二进制缓存（同目录下的<文件名>.cscene），没有或过期时先编译；源文件不在时只要缓存完整也能加载。
+// 目录不可写时直接用内存里编译的结果，只是下次还要再编译。要在init之前调用，树的静态几何体在init里生成
+bool loadCachedScene(const char* filename) {
+    std::string cachePath = std::string(filename) + ".cscene";
+    MappedFile file;
+    std::vector<unsigned char> compiled;
+    const unsigned char* data = nullptr;
+    if (file.open(cachePath.c_str()) && validSceneFile(file.data(), file.size(), filename)) {
+        file.prefetch();
+        data = file.data();
+    } else {
+        file = MappedFile();
+        if (!buildSceneFile(filename, compiled) || !validSceneFile(compiled.data(), compiled.size(), filename)) return false;
+        if (!writeFileAtomically(cachePath.c_str(), compiled)) {
+            std::cerr << "Using " << filename << " without a scene cache" << std::endl;
+        }
+        data = compiled.data();
+    }
 
-            // 如果云朵完全移出屏幕，生成一个新的云朵
-            if (cloud.x + cloud.width < 0) {
-                cloud.x = WINDOW_WIDTH;
-                cloud.y = static_cast<float>(rand() % static_cast<int>(cloudYLimit));
-                cloud.width = 50 + static_cast<float>(rand() % 100);
-                cloud.height = 20 + static_cast<float>(rand() % 40);
+    SceneFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    const Star* stars = nullptr;
+    const Cloud* clouds = nullptr;
+    int starCount = 0, cloudCount = 0;
+    Entity first[2];
+    for (uint32_t i = 0; i < header.sections; i++) {
+        SceneFileSection section = sceneSection(data, i);
+        const unsigned char* items = data + section.offset;
+        int count = static_cast<int>(section.count);
+        if (section.content == SCENE_STARS) {
+            stars = reinterpret_cast<const Star*>(items);
+            starCount = count;
+        } else if (section.content == SCENE_CLOUDS) {
+            clouds = reinterpret_cast<const Cloud*>(items);
+            cloudCount = count;
+        } else if (section.content == SCENE_TREES) {
+            for (int j = 0; j < count; j++) {
+                SceneTree tree;
+                memcpy(&tree, items + sizeof(tree) * j, sizeof(tree));
+                trees.push_back(Tree(tree.x, tree.y));
             }
+        } else {
+            ShapeKind kind = static_cast<ShapeKind>(section.kind);
+            if (first[kind].archetype < 0) {
+                first[kind] = world.append(kind == SHAPE_BALLOON ? BALLOON_COMPONENTS : FLOWER_COMPONENTS, kind, count);
+            }
+            memcpy(componentRows(world.archetype(first[kind]), section.component, first[kind].row), items, section.size);
         }
     }
+    sky = Sky();  // 文件里没有的星星或云按--seed重新生成
+    sky.load(stars, starCount, clouds, cloudCount);
+    for (uint32_t i = 0; i < header.fireworks; i++) {
+        spawnFirework();
+    }
+    bannerBalloon = {first[SHAPE_BALLOON].archetype, first[SHAPE_BALLOON].row + static_cast<int>(header.bannerBalloon)};
+    sceneLoaded = true;
+    return true;
+}
 
-    void specialUpdateStars(float balloonY) {
-        float starYLimit = WINDOW_HEIGHT - (balloonY / 3);  // 根据气球的高度调整星星的上限
+const float CAMERA_MIN_ZOOM = 0.5f;
+const float CAMERA_MAX_ZOOM = 4.0f;
 
-        for (auto& star : stars) {
-            star.brightness += (rand() % 3 - 1) * 0.05;  // 随机增加或减少亮度
-            if (star.brightness < 0) star.brightness = 0;
-            if (star.brightness > 1) star.brightness = 1;
+// 摄像机：视野中心、缩放和跟随的目标。世界到窗口的变换放进模型视图矩阵，视野范围用于裁剪。
+// 中心限制在场景范围内：最低能看到地面以下停着的气球，最高与特殊气球模式镜头的最高处相同
+class Camera {
+public:
+    float x = WINDOW_WIDTH / 2.0f;
+    float y = WINDOW_HEIGHT / 2.0f;
+    float zoom = 1.0f;
+
+    void pan(float dx, float dy) {
+        x += dx / zoom;
+        y += dy / zoom;
+        clamp();
+    }
 
-            // 确保星星始终在指定的上限范围内
-            if (star.y > starYLimit) {
-                star.y = static_cast<float>(rand() % static_cast<int>(starYLimit));
-            }
-        }
+    void zoomBy(float factor) {
+        zoom = std::min(std::max(zoom * factor, CAMERA_MIN_ZOOM), CAMERA_MAX_ZOOM);
     }
 
+    // 目标点放在视野中心
+    void follow(float targetX, float targetY) {
+        x = targetX;
+        y = targetY;
+        clamp();
+    }
 
-private:
-    void initStars() {
-        for (int i = 0; i < 100; i++) {  // 创建100颗星星
-            Star star = {
-                    static_cast<float>(rand() % WINDOW_WIDTH),
-                    static_cast<float>(rand() % (WINDOW_HEIGHT / 2) + (WINDOW_HEIGHT / 2)),  // 在屏幕的上四分之一到上四分之三之间创建星星
-                    static_cast<float>(rand()) / RAND_MAX  // 随机亮度
-            };
-            stars.push_back(star);
-        }
+    void reset() {
+        x = WINDOW_WIDTH / 2.0f;
+        y = WINDOW_HEIGHT / 2.0f;
+        zoom = 1.0f;
     }
 
-    void initClouds() {
-        for (int i = 0; i < 5; i++) {  // 创建5朵云
-            Cloud cloud = {
-                    static_cast<float>(rand() % WINDOW_WIDTH),
-                    static_cast<float>(rand() % (WINDOW_HEIGHT / 2) + (WINDOW_HEIGHT / 4)),  // 在屏幕的上四分之一到上二分之一之间创建云朵
-                    50 + static_cast<float>(rand() % 100),  // 随机宽度
-                    20 + static_cast<float>(rand() % 40)  // 随机高度
-            };
-            clouds.push_back(cloud);
+    void apply() const {
+        if (zoom == 1.0f) {
+            renderer.translate(WINDOW_WIDTH / 2.0f - x, WINDOW_HEIGHT / 2.0f - y);  // 不缩放时只平移，静态图层仍可整像素合成
+            return;
         }
+        renderer.translate(WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f);
+        renderer.scale(zoom);
+        renderer.translate(-x, -y);
     }
 
-    void drawStar(const Star& star) const {
-        glColor3f(star.brightness, star.brightness, star.brightness);
-        glBegin(GL_LINES);
-        glVertex2f(star.x, star.y - 2);
-        glVertex2f(star.x, star.y + 2);
-        glVertex2f(star.x - 2, star.y);
-        glVertex2f(star.x + 2, star.y);
-        glEnd();
+    // 窗口里能看到的世界范围
+    Bounds view() const {
+        float halfWidth = WINDOW_WIDTH / 2.0f / zoom;
+        float halfHeight = WINDOW_HEIGHT / 2.0f / zoom;
+        return {x - halfWidth, y - halfHeight, x + halfWidth, y + halfHeight};
     }
 
-    void drawCloud(const Cloud& cloud) const{
-        glColor3f(0.9, 0.9, 0.9);  // 云朵的颜色
-        glBegin(GL_QUADS);
-        glVertex2f(cloud.x, cloud.y);
-        glVertex2f(cloud.x + cloud.width, cloud.y);
-        glVertex2f(cloud.x + cloud.width, cloud.y + cloud.height);
-        glVertex2f(cloud.x, cloud.y + cloud.height);
-        glEnd();
+    bool sees(const Bounds& bounds) const {
+        return view().overlaps(bounds);
     }
 
+private:
+    void clamp() {
+        x = std::min(std::max(x, 0.0f), static_cast<float>(WINDOW_WIDTH));
+        y = std::min(std::max(y, WINDOW_HEIGHT / 2.0f - 200), 700 + WINDOW_HEIGHT / 2.0f);
+    }
 };
+Camera camera;
+
+// 实例化绘制的单位网格，坐标相对于实例的位置
+// 气球：顶点为 (位置, 绳子弯曲系数, 颜色, 是否使用实例颜色, 变体)，变体1只用于普通气球的弯绳，2只用于拉字气球的直绳
+std::vector<float> balloonMesh() {
+    std::vector<float> mesh;
+    auto vertex = [&mesh](float x, float y, float bend, float r, float g, float b, float a, float tinted, float variant) {
+        mesh.insert(mesh.end(), {x, y, bend, r, g, b, a, tinted, variant});
+    };
+    // 弯曲的绳子：二次贝塞尔曲线化简后 x = 2(1-t)t * 控制点偏移, y = -80t
+    for (int i = 0; i < 100; i++) {
+        float t0 = i / 100.0f, t1 = (i + 1) / 100.0f;
+        float b0 = 2 * (1 - t0) * t0, b1 = 2 * (1 - t1) * t1;
+        vertex(-0.5f, -80 * t0, b0, 0.5, 0.5, 0.5, 1, 0, 1);
+        vertex(0.5f, -80 * t0, b0, 0.5, 0.5, 0.5, 1, 0, 1);
+        vertex(0.5f, -80 * t1, b1, 0.5, 0.5, 0.5, 1, 0, 1);
+        vertex(-0.5f, -80 * t0, b0, 0.5, 0.5, 0.5, 1, 0, 1);
+        vertex(0.5f, -80 * t1, b1, 0.5, 0.5, 0.5, 1, 0, 1);
+        vertex(-0.5f, -80 * t1, b1, 0.5, 0.5, 0.5, 1, 0, 1);
+    }
+    // 拉字气球的直绳
+    vertex(-0.5f, -30, 0, 0.5, 0.5, 0.5, 1, 0, 2);
+    vertex(0.5f, -30, 0, 0.5, 0.5, 0.5, 1, 0, 2);
+    vertex(0.5f, -80, 0, 0.5, 0.5, 0.5, 1, 0, 2);
+    vertex(-0.5f, -30, 0, 0.5, 0.5, 0.5, 1, 0, 2);
+    vertex(0.5f, -80, 0, 0.5, 0.5, 0.5, 1, 0, 2);
+    vertex(-0.5f, -80, 0, 0.5, 0.5, 0.5, 1, 0, 2);
+    // 椭圆形的气球，颜色来自实例
+    for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+        vertex(0, 0, 0, 1, 1, 1, 1, 1, 0);
+        vertex(CIRCLE_10.x[i] * 20, CIRCLE_10.y[i] * 30, 0, 1, 1, 1, 1, 1, 0);
+        vertex(CIRCLE_10.x[i + 1] * 20, CIRCLE_10.y[i + 1] * 30, 0, 1, 1, 1, 1, 1, 0);
+    }
+    // 高光：中心半透明，边缘完全透明
+    for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+        vertex(0, 15, 0, 1, 1, 1, 0.6, 0, 0);
+        vertex(CIRCLE_10.x[i] * 10, 15 + CIRCLE_10.y[i] * 5, 0, 1, 1, 1, 0, 0, 0);
+        vertex(CIRCLE_10.x[i + 1] * 10, 15 + CIRCLE_10.y[i + 1] * 5, 0, 1, 1, 1, 0, 0, 0);
+    }
+    return mesh;
+}
 
+// 花朵：顶点为 (固定偏移, 随开放程度缩放的偏移, 颜色, 是否只在开放时绘制)
+std::vector<float> flowerMesh() {
+    std::vector<float> mesh;
+    auto vertex = [&mesh](float x, float y, float radialX, float radialY, float r, float g, float b, float bloomOnly) {
+        mesh.insert(mesh.end(), {x, y, radialX, radialY, r, g, b, 1, bloomOnly});
+    };
+    // 扇形三角形直接取自单位圆表，rotate为起始点在表里的偏移
+    auto disc = [&vertex](const float* cx, const float* cy, int segments, float radius, int rotate, float r, float g, float b, float bloomOnly) {
+        for (int i = 0; i < segments; i++) {
+            int k0 = (i + rotate) % segments, k1 = k0 + 1;
+            vertex(0, 0, 0, 0, r, g, b, bloomOnly);
+            vertex(0, 0, cx[k0] * radius, cy[k0] * radius, r, g, b, bloomOnly);
+            vertex(0, 0, cx[k1] * radius, cy[k1] * radius, r, g, b, bloomOnly);
+        }
+    };
+    // 绿色茎
+    vertex(-0.5f, -5, 0, 0, 0, 0.5, 0, 0);
+    vertex(0.5f, -5, 0, 0, 0, 0.5, 0, 0);
+    vertex(0.5f, -25, 0, 0, 0, 0.5, 0, 0);
+    vertex(-0.5f, -5, 0, 0, 0, 0.5, 0, 0);
+    vertex(0.5f, -25, 0, 0, 0, 0.5, 0, 0);
+    vertex(-0.5f, -25, 0, 0, 0, 0.5, 0, 0);
+    // 绿色叶子
+    vertex(-5, -20, 0, 0, 0, 0.5, 0, 0);
+    vertex(5, -20, 0, 0, 0, 0.5, 0, 0);
+    vertex(0, -30, 0, 0, 0, 0.5, 0, 0);
+    vertex(-5, -10, 0, 0, 0, 0.5, 0, 0);
+    vertex(5, -10, 0, 0, 0, 0.5, 0, 0);
+    vertex(0, -20, 0, 0, 0, 0.5, 0, 0);
+    disc(CIRCLE_10.x, CIRCLE_10.y, CIRCLE_10.SEGMENTS, 10, 0, 1, 1, 0, 0);  // 黄色花蕊
+    disc(CIRCLE_10.x, CIRCLE_10.y, CIRCLE_10.SEGMENTS, 10, 0, 1, 1, 0, 1);
+    for (int petal = 0; petal < 8; petal++) {  // 粉红色花瓣
+        disc(CIRCLE_45.x, CIRCLE_45.y, CIRCLE_45.SEGMENTS, 20, petal, 1, 0.5, 1, 1);
+    }
+    return mesh;
+}
 
+// 叶子：中心在原点的单位正方形
+std::vector<float> leafMesh() {
+    return {-0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f};
+}
 
+const char* BALLOON_VERTEX_SHADER =
+        "#version 120\n"
+        "attribute vec2 local;\n"
+        "attribute float bend;\n"
+        "attribute vec4 colour;\n"
+        "attribute float tinted;\n"
+        "attribute float variant;\n"
+        "attribute vec2 instancePosition;\n"
+        "attribute vec2 instanceScale;\n"
+        "attribute vec3 instanceColour;\n"
+        "attribute float instanceControlOffset;\n"
+        "attribute float instanceHoldingText;\n"
+        "varying vec4 fragColour;\n"
+        "void main() {\n"
+        "    float wanted = instanceHoldingText > 0.5 ? 2.0 : 1.0;\n"
+        "    if (variant > 0.5 && abs(variant - wanted) > 0.5) {\n"
+        "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"  // 不属于这个气球的绳子，移出裁剪空间
+        "        fragColour = vec4(0.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    vec2 p = instancePosition + local * instanceScale + vec2(bend * instanceControlOffset, 0.0);\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);\n"
+        "    fragColour = mix(colour, vec4(instanceColour, 1.0), tinted);\n"
+        "}\n";
+
+const char* FLOWER_VERTEX_SHADER =
+        "#version 120\n"
+        "attribute vec2 local;\n"
+        "attribute vec2 radial;\n"
+        "attribute vec4 colour;\n"
+        "attribute float bloomOnly;\n"
+        "attribute vec2 instancePosition;\n"
+        "attribute float instanceBloomFactor;\n"
+        "attribute float instanceBlooming;\n"
+        "varying vec4 fragColour;\n"
+        "void main() {\n"
+        "    if (bloomOnly > 0.5 && instanceBlooming < 0.5) {\n"
+        "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+        "        fragColour = vec4(0.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    vec2 p = instancePosition + local + radial * instanceBloomFactor;\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);\n"
+        "    fragColour = colour;\n"
+        "}\n";
+
+const char* LEAF_VERTEX_SHADER =
+        "#version 120\n"
+        "attribute vec2 local;\n"
+        "attribute vec2 instancePosition;\n"
+        "attribute vec2 instanceScale;\n"
+        "attribute vec3 instanceColour;\n"
+        "varying vec4 fragColour;\n"
+        "void main() {\n"
+        "    gl_Position = gl_ModelViewProjectionMatrix * vec4(instancePosition + local * instanceScale, 0.0, 1.0);\n"
+        "    fragColour = vec4(instanceColour, 1.0);\n"
+        "}\n";
+
+InstancedShape balloonShape;
+InstancedShape flowerShape;
+InstancedShape leafShape;
+std::vector<float> instanceScratch;  // 每帧填充实例数据的临时数组
+
+void initInstancedShapes() {
+    balloonShape.init(BALLOON_VERTEX_SHADER,
+                      {{"local", 2}, {"bend", 1}, {"colour", 4}, {"tinted", 1}, {"variant", 1}}, balloonMesh(),
+                      {{"instancePosition", 2}, {"instanceScale", 2}, {"instanceColour", 3},
+                       {"instanceControlOffset", 1}, {"instanceHoldingText", 1}});
+    flowerShape.init(FLOWER_VERTEX_SHADER,
+                     {{"local", 2}, {"radial", 2}, {"colour", 4}, {"bloomOnly", 1}}, flowerMesh(),
+                     {{"instancePosition", 2}, {"instanceBloomFactor", 1}, {"instanceBlooming", 1}});
+    leafShape.init(LEAF_VERTEX_SHADER, {{"local", 2}}, leafMesh(),
+                   {{"instancePosition", 2}, {"instanceScale", 2}, {"instanceColour", 3}});
+}
 
+// 原型中镜头看得到的行，按行号从小到大（保持原来的绘制顺序）；实体移动过时先更新网格
+std::vector<int>& visibleRows(Archetype& type) {
+    if (type.moved || type.grid.size() != type.size) indexSystem(type);
+    type.grid.query(camera.view(), visibleScratch);
+    return visibleScratch;
+}
 
-void drawBuilding() {
-    //Todo 美化建筑物，纹理和细化，逻辑修改和贴图等
-    // Main building
-    glColor3f(0.6, 0.6, 0.6);
-    glBegin(GL_QUADS);
-    glVertex2i(150, 100);
-    glVertex2i(450, 100);
-    glVertex2i(450, 500);
-    glVertex2i(150, 500);
-    glEnd();
-
-    glColor3f(0.3, 0.3, 0.3);
-    for (int i = 160; i < 440; i += 60) {
-        for (int j = 120; j < 480; j += 60) {
-            if (windowsActivated && i == 280 && j != 180 && windowsVisible) {  // 仅当windowsVisible为true时绘制黄色窗户
-                glColor3f(1.0, 1.0, 0.0);  // Yellow for activated windows
-            } else {
-                glColor3f(0.3, 0.3, 0.3);
+// 只提交镜头看得到的花；不支持实例化时逐个绘制
+void drawFlowers() {
+    world.each(FLOWER_COMPONENTS, SHAPE_FLOWER, [](Archetype& type) {
+        const std::vector<int>& rows = visibleRows(type);
+        if (!flowerShape.ready()) {
+            for (int i : rows) {
+                drawFlowerShape(type.transform[i].x, type.transform[i].y, type.lifetime[i].progress, type.lifetime[i].running);
             }
-            glBegin(GL_QUADS);
-            glVertex2i(i, j);
-            glVertex2i(i + 40, j);
-            glVertex2i(i + 40, j + 40);
-            glVertex2i(i, j + 40);
-            glEnd();
-            if (windowsActivated && i == 280 && j != 180) {  // 绘制感叹号
-                glColor3f(0.0, 0.0, 0.0);
-                glBegin(GL_LINES);
-                glVertex2i(i + 20, j + 10);
-                glVertex2i(i + 20, j + 25);
-                glEnd();
-                glBegin(GL_POINTS);
-                glVertex2i(i + 20, j + 5);
-                glEnd();
+            return;
+        }
+        instanceScratch.clear();
+        for (int i : rows) {
+            // 实例化绘制用的数据：位置、开放程度、是否开放
+            instanceScratch.insert(instanceScratch.end(), {type.transform[i].x, type.transform[i].y,
+                                                           type.lifetime[i].progress, type.lifetime[i].running ? 1.0f : 0.0f});
+        }
+        flowerShape.setInstances(instanceScratch.data(), static_cast<int>(rows.size()));
+        flowerShape.draw();
+    });
+}
+
+// 停在地面以下等待升起的气球不提交
+void drawBalloons() {
+    world.each(BALLOON_COMPONENTS, SHAPE_BALLOON, [](Archetype& type) {
+        const std::vector<int>& rows = visibleRows(type);
+        if (!balloonShape.ready()) {
+            for (int i : rows) {
+                const Colour& c = type.colour[i];
+                drawBalloonShape(type.transform[i].x, renderY(type.transform[i]), c.r, c.g, c.b, type.motion[i].sway, type.shape[i].variant != 0);
             }
+            return;
+        }
+        instanceScratch.clear();
+        for (int i : rows) {
+            // 实例化绘制用的数据：位置、缩放、颜色、绳子的偏移、是否拉着字
+            const Colour& c = type.colour[i];
+            instanceScratch.insert(instanceScratch.end(), {type.transform[i].x, renderY(type.transform[i]), 1.0f, 1.0f, c.r, c.g, c.b,
+                                                           type.motion[i].sway, type.shape[i].variant ? 1.0f : 0.0f});
+        }
+        balloonShape.setInstances(instanceScratch.data(), static_cast<int>(rows.size()));
+        balloonShape.draw();
+    });
+}
+
+// 只准备和绘制镜头看得到的烟花的粒子
+void drawFireworks() {
+    world.each(FIREWORK_COMPONENTS, SHAPE_FIREWORK, [](Archetype& type) {
+        std::vector<int>& rows = visibleRows(type);
+        for (int& i : rows) {
+            i = type.shape[i].variant;  // 换成发射器的下标
         }
+        std::sort(rows.begin(), rows.end());
+        particleSystem.draw(rows);
+    });
+}
+
+// 两棵树的树干和叶子都在静态几何体或只上传一次的实例数据里，只能整体裁剪
+Bounds treeBounds() {
+    Bounds area = {0, 0, -1, -1};
+    for (size_t i = 0; i < trees.size(); i++) {
+        Bounds tree = trees[i].bounds();
+        area = i == 0 ? tree : Bounds{std::min(area.x0, tree.x0), std::min(area.y0, tree.y0),
+                                      std::max(area.x1, tree.x1), std::max(area.y1, tree.y1)};
     }
+    return area;
 }
 
-void drawGround() {
-    glColor3f(0.0, 0.6, 0.0);  // 深绿色
-    glBegin(GL_QUADS);
-    glVertex2i(0, 0);
-    glVertex2i(WINDOW_WIDTH, 0);
-    glVertex2i(WINDOW_WIDTH, 100);  // 地面的高度，可以根据需要调整
-    glVertex2i(0, 100);
-    glEnd();
+// 树干在静态几何体中；叶子不变，实例数据只上传一次
+void drawTrees() {
+    renderer.drawMesh(treeMesh);
+    if (leafShape.ready()) {
+        leafShape.draw();
+    }
 }
 
-void drawArtisticText(float x, float y, const char* text) {
-    // Blue bold text with white outline
-    glColor3f(1.0, 1.0, 1.0);
-    for (int dx = -2; dx <= 2; dx++) {
-        for (int dy = -2; dy <= 2; dy++) {
-            glRasterPos2i(x + dx, y + dy);
-            while (*text) {
-                glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *text++);
+// 静态图层缓存：把不常变化的内容画进离屏纹理，之后每帧只合成贴图矩形。
+// 每个状态键各缓存一张纹理，键变化时只需换纹理；视口大小变化时全部作废。
+// 画好后读回一次alpha，只合成有内容的图块（同一行相邻的同类图块合并成一条）：
+// 完全不透明的直接从图层的帧缓冲复制像素，部分透明的才用贴图矩形混合，软件光栅化时也不必每帧填满全屏。
+// 图层里存的是预乘alpha的颜色（alpha单独按GL_ONE累加），合成时用GL_ONE混合，半透明边缘不会被alpha乘两次
+class LayerCache {
+public:
+    static const int MAX_STATES = 4;
+    static const int TILE = 16;  // 图块边长（像素）
+
+    // 合成状态key对应的图层，没有缓存时先用render画一遍；不支持帧缓冲对象时返回false，调用者应直接绘制
+    bool draw(int key, const std::function<void()>& render) {
+        if (glGenFramebuffersPtr == nullptr || glBlendFuncSeparatePtr == nullptr || unsupported || key < 0 || key >= MAX_STATES) return false;
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        if (viewport[2] != width || viewport[3] != height) {
+            invalidate();
+            width = viewport[2];
+            height = viewport[3];
+        }
+        int dx, dy;
+        if (!pixelOffset(viewport, dx, dy)) return false;
+        Layer& layer = layers[key];
+        if (layer.texture == 0 && !renderLayer(layer, viewport, render)) return false;
+
+        renderer.flush();
+        if (glBlitFramebufferPtr != nullptr) {
+            GLint previousRead = 0;
+            glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+            glBindFramebufferPtr(GL_READ_FRAMEBUFFER, layer.framebuffer);
+            for (const Span& span : layer.spans) {
+                if (!span.opaque) continue;
+                int x = viewport[0] + dx, y = viewport[1] + dy;
+                glBlitFramebufferPtr(span.x0, span.y0, span.x1, span.y1, x + span.x0, y + span.y0, x + span.x1, y + span.y1,
+                                     GL_COLOR_BUFFER_BIT, GL_NEAREST);
             }
+            glBindFramebufferPtr(GL_READ_FRAMEBUFFER, previousRead);
         }
+
+        float scaleX = static_cast<float>(WINDOW_WIDTH) / width;
+        float scaleY = static_cast<float>(WINDOW_HEIGHT) / height;
+        TextureRegion region;
+        region.texture = layer.texture;
+        renderer.color(1.0, 1.0, 1.0);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);  // 纹理颜色已经乘过alpha
+        for (const Span& span : layer.spans) {
+            if (span.opaque && glBlitFramebufferPtr != nullptr) continue;
+            region.u0 = static_cast<float>(span.x0) / width;
+            region.u1 = static_cast<float>(span.x1) / width;
+            region.v0 = static_cast<float>(span.y1) / height;  // 纹理第0行是画面底部
+            region.v1 = static_cast<float>(span.y0) / height;
+            renderer.texturedQuad(region, span.x0 * scaleX, span.y0 * scaleY, span.x1 * scaleX, span.y1 * scaleY);
+        }
+        renderer.flush();
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        renderer.bindTexture(0);
+        return true;
     }
-    glColor3f(0.0, 0.0, 1.0);
-    glRasterPos2i(x, y);
-    while (*text) {
-        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *text++);
+
+    void invalidate() {
+        for (Layer& layer : layers) {
+            if (layer.framebuffer != 0) glDeleteFramebuffersPtr(1, &layer.framebuffer);
+            if (layer.texture != 0) glDeleteTextures(1, &layer.texture);
+            layer.framebuffer = 0;
+            layer.texture = 0;
+            layer.spans.clear();
+        }
     }
-}
 
-void drawCenteredText(float y, const char* text) {
-    float scaleFactor = 0.2;
-    float textWidth = glutStrokeLength(GLUT_STROKE_ROMAN, (unsigned char*)text) * scaleFactor;
+    int renderCount = 0;  // 实际重画图层的次数
 
-    // 描边 (白色)
-    glColor3f(1.0, 1.0, 1.0);
-    for (int dx = -2; dx <= 2; dx++) {
-        for (int dy = -2; dy <= 2; dy++) {
+private:
+    struct Span {
+        int x0, y0, x1, y1;  // 像素坐标，左下角为原点
+        bool opaque;
+    };
+
+    struct Layer {
+        GLuint texture = 0;
+        GLuint framebuffer = 0;  // 保留下来作为复制像素的来源
+        std::vector<Span> spans;
+    };
+
+    Layer layers[MAX_STATES];
+    int width = 0, height = 0;
+    bool unsupported = false;
+
+    // 图层按像素采样，只有当前变换把场景平移整数个像素时才和直接绘制完全一致（特殊模式镜头滚动时不是）；
+    // 返回这个平移量
+    bool pixelOffset(const GLint viewport[4], int& dx, int& dy) const {
+        GLfloat modelview[16];
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        if (modelview[0] != 1 || modelview[5] != 1 || modelview[1] != 0 || modelview[4] != 0) return false;
+        float x = modelview[12] * viewport[2] / WINDOW_WIDTH;
+        float y = modelview[13] * viewport[3] / WINDOW_HEIGHT;
+        dx = static_cast<int>(std::lround(x));
+        dy = static_cast<int>(std::lround(y));
+        return std::fabs(x - dx) < 0.001f && std::fabs(y - dy) < 0.001f;
+    }
+
+    bool renderLayer(Layer& layer, const GLint viewport[4], const std::function<void()>& render) {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // 精度不低于窗口（有的窗口每通道10位），否则合成后颜色会差一点；
+        // 不用GL_RGB10_A2，它的alpha只有2位，半透明的边缘会变样
+        GLint redBits = 8;
+        glGetIntegerv(GL_RED_BITS, &redBits);
+        GLenum format = redBits > 8 ? GL_RGBA16 : GL_RGBA8;
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);  // 与屏幕像素一一对应
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        renderer.flush();
+        GLint previousFramebuffer = 0;
+        GLuint framebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffersPtr(1, &framebuffer);
+        glBindFramebufferPtr(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2DPtr(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        bool complete = glCheckFramebufferStatusPtr(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (complete) {
+            // 透明底色上按场景坐标绘制；不透明像素的alpha为1，合成时原样覆盖天空。
+            // 颜色照常按源alpha混合，alpha通道按GL_ONE累加，得到的就是预乘alpha的图层。
+            // 可能正在局部重画某个矩形，图层本身要完整画出来
+            GLfloat clearColor[4];
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+            GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+            glDisable(GL_SCISSOR_TEST);
+            glViewport(0, 0, width, height);
+            glClearColor(0, 0, 0, 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glMatrixMode(GL_MODELVIEW);
             glPushMatrix();
-            glTranslatef((WINDOW_WIDTH - textWidth) / 2 + dx, y + dy, 0);
-            glScalef(scaleFactor, scaleFactor, 1);
-            for (const char* c = text; *c != '\0'; c++) {
-                glutStrokeCharacter(GLUT_STROKE_ROMAN, *c);
-            }
+            glLoadIdentity();
+            glBlendFuncSeparatePtr(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            render();
+            renderer.flush();
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
             glPopMatrix();
+            glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            if (scissor) glEnable(GL_SCISSOR_TEST);
+        }
+        glBindFramebufferPtr(GL_FRAMEBUFFER, previousFramebuffer);
+        if (!complete) {
+            glDeleteFramebuffersPtr(1, &framebuffer);
+            glDeleteTextures(1, &texture);
+            unsupported = true;  // 不可用就不再尝试，以后一直直接绘制
+            return false;
         }
+        layer.texture = texture;
+        layer.framebuffer = framebuffer;
+        findSpans(layer);
+        renderCount++;
+        return true;
     }
 
-    glColor3f(0.0, 0.0, 1.0);
-    glPushMatrix();
-    glTranslatef((WINDOW_WIDTH - textWidth) / 2, y, 0);
-    glScalef(scaleFactor, scaleFactor, 1);
-    for (const char* c = text; *c != '\0'; c++) {
-        glutStrokeCharacter(GLUT_STROKE_ROMAN, *c);
+    void findSpans(Layer& layer) {
+        std::vector<unsigned char> pixels(static_cast<size_t>(width) * height);
+        glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, layer.texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_ALPHA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPopClientAttrib();
+
+        // 每个图块分为空、完全不透明、部分透明三类，同一行里相邻的同类图块合并；
+        // 和上一行位置、类别都相同的段再向上延长，整块地面或墙面只剩一个矩形
+        enum { EMPTY, OPAQUE, PARTIAL };
+        layer.spans.clear();
+        for (int ty = 0; ty < height; ty += TILE) {
+            size_t currentRow = layer.spans.size();
+            int y1 = std::min(ty + TILE, height);
+            int spanStart = 0;
+            int spanKind = EMPTY;
+            for (int tx = 0; tx < width + TILE; tx += TILE) {  // 多走一格，收尾最后一段
+                int kind = EMPTY;
+                if (tx < width) {
+                    bool any = false, all = true;
+                    for (int y = ty; y < y1; y++) {
+                        const unsigned char* row = pixels.data() + static_cast<size_t>(y) * width;
+                        for (int x = tx; x < std::min(tx + TILE, width); x++) {
+                            any = any || row[x] != 0;
+                            all = all && row[x] == 255;
+                        }
+                    }
+                    kind = all ? OPAQUE : (any ? PARTIAL : EMPTY);
+                }
+                if (kind == spanKind) continue;
+                if (spanKind != EMPTY) {
+                    Span span = {spanStart, ty, std::min(tx, width), y1, spanKind == OPAQUE};
+                    auto rowStart = layer.spans.begin() + currentRow;
+                    auto above = std::find_if(layer.spans.begin(), rowStart, [&](const Span& s) {
+                        return s.x0 == span.x0 && s.x1 == span.x1 && s.y1 == ty && s.opaque == span.opaque;
+                    });
+                    if (above != rowStart) {
+                        above->y1 = y1;
+                    } else {
+                        layer.spans.push_back(span);
+                    }
+                }
+                spanStart = tx;
+                spanKind = kind;
+            }
+        }
     }
-    glPopMatrix();
-}
+};
 
-void drawInvitationButton() {
-    // Red carpet
-    glColor3f(0.8, 0.2, 0.2);
-    glBegin(GL_QUADS);
-    glVertex2i(200, 0);
-    glVertex2i(400, 0);
-    glVertex2i(400, 100);
-    glVertex2i(200, 100);
-    glEnd();
+// 地面和建筑物（含窗户灯光）只依赖窗户是否点亮和本帧是否可见；树完全不变，
+// 但盛开的花会盖住一点树叶，所以单独一层画在花之后
+LayerCache backgroundLayer;
+LayerCache treeLayer;
 
-    // Vertical "Invitation" text
-    const char* text = "You Have an";
-    int yStart = 70;
-    drawArtisticText(250, yStart, text);
-    text = "Invitation!";
-    drawArtisticText(260, yStart - 20, text);
+int backgroundLayerKey() {
+    if (!windowsActivated) return 0;
+    return windowsVisible ? 1 : 2;
 }
 
-std::vector<Balloon> balloons;
-std::vector<Tree> trees;
-std::vector<Firework> fireworks;
-std::vector<Flower> flowers;
-Sky sky;
-SpecialBalloon specialBalloon;
+void drawGroundAndBuilding() {
+    renderer.drawMesh(backgroundMesh);  // 地面和建筑物
+    drawBuildingLights();
+}
 
-void init() {
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+// 局部重画需要上一帧的画面。交换缓冲之后后缓冲的内容不确定，所以窗口模式下画在一个帧缓冲对象里，
+// 每帧整张复制到窗口；无窗口模式的离屏表面不交换，直接画在上面
+class SceneCanvas {
+public:
+    // 开始一帧的绘制；返回false表示上一帧的画面没有保留，必须整帧重画
+    bool begin() {
+        if (presentKeepsFrame()) return true;
+        if (glGenFramebuffersPtr == nullptr || glBlitFramebufferPtr == nullptr || unsupported) return false;
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        bool retained = framebuffer != 0 && viewport[0] + viewport[2] == width && viewport[1] + viewport[3] == height;
+        if (!retained && !create()) return false;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &windowFramebuffer);
+        glBindFramebufferPtr(GL_FRAMEBUFFER, framebuffer);
+        active = true;
+        return retained;
+    }
 
+    // 把画布复制到窗口，之后的绘制（分析器）直接画在窗口上
+    void end() {
+        if (!active) return;
+        active = false;
+        renderer.flush();
+        glBindFramebufferPtr(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebufferPtr(GL_DRAW_FRAMEBUFFER, windowFramebuffer);
+        int x0 = viewport[0], y0 = viewport[1], x1 = viewport[0] + viewport[2], y1 = viewport[1] + viewport[3];
+        glBlitFramebufferPtr(x0, y0, x1, y1, x0, y0, x1, y1, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebufferPtr(GL_FRAMEBUFFER, windowFramebuffer);
+    }
+
+private:
+    GLuint framebuffer = 0;
+    GLuint texture = 0;
+    GLint windowFramebuffer = 0;
+    GLint viewport[4] = {};
+    int width = 0, height = 0;
+    bool active = false;
+    bool unsupported = false;
+
+    bool create() {
+        if (framebuffer != 0) glDeleteFramebuffersPtr(1, &framebuffer);
+        if (texture != 0) glDeleteTextures(1, &texture);
+        width = viewport[0] + viewport[2];
+        height = viewport[1] + viewport[3];
+        GLint redBits = 8;
+        glGetIntegerv(GL_RED_BITS, &redBits);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, redBits > 8 ? GL_RGB10_A2 : GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffersPtr(1, &framebuffer);
+        glBindFramebufferPtr(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2DPtr(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        bool complete = glCheckFramebufferStatusPtr(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebufferPtr(GL_FRAMEBUFFER, previousFramebuffer);
+        if (!complete) {
+            glDeleteFramebuffersPtr(1, &framebuffer);
+            glDeleteTextures(1, &texture);
+            framebuffer = texture = 0;
+            unsupported = true;  // 以后每帧都直接整帧画在窗口上
+        }
+        return complete;
+    }
+};
+SceneCanvas sceneCanvas;
+
+// 没有场景文件时的默认场景，布局与scenes/ceremony.scene相同（随机的位置和颜色不同）
+void createDefaultScene() {
+    sky = Sky();  // 静态初始化时生成的星星和云还没有用上--seed
     trees.push_back(Tree(100, 100));
     trees.push_back(Tree(500, 100));
     // Initialize balloons with random positions and bright colors
-    balloons.push_back(Balloon(250, -100, 1.0, 0.0, 0.0, true));  // Left balloon (bright red)
-    balloons.push_back(Balloon(350, -100, 1.0, 0.0, 0.0, true));  // Right balloon (bright red)
+    bannerBalloon = spawnBalloon(250, -100, 1.0, 0.0, 0.0, true);  // Left balloon (bright red)
+    spawnBalloon(350, -100, 1.0, 0.0, 0.0, true);  // Right balloon (bright red)
+    Random& random = threadRandom();
     for (int i = 0; i < 20; i++){
-        balloons.push_back({static_cast<float>(rand() % WINDOW_WIDTH), -100,
-                            static_cast<float>(rand()) / RAND_MAX,
-                            static_cast<float>(rand()) / RAND_MAX,
-                            static_cast<float>(rand()) / RAND_MAX});
+        float x = static_cast<float>(random.below(WINDOW_WIDTH));
+        float r = random.uniform(), g = random.uniform(), b = random.uniform();
+        spawnBalloon(x, -100, r, g, b);
     }
     //初始化烟花
     for (int i = 0; i < 5; i++) {
-        fireworks.push_back(Firework());
+        spawnFirework();
     }
     // 初始化花朵
     for (int i = 0; i < 50; i++) {
-        flowers.push_back(Flower(static_cast<float>(rand() % WINDOW_WIDTH), static_cast<float>(rand() % 100)));
+        float x = static_cast<float>(random.below(WINDOW_WIDTH)), y = static_cast<float>(random.below(100));
+        spawnFlower(x, y);
     }
 }
 
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glPushMatrix();
+void init() {
+    if (!renderer.softwareMode()) {
+        glMatrixMode(GL_PROJECTION);
+        glLoadIdentity();
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+    }
+    renderer.init();
+    initInstancedShapes();
+    bannerFont.ready();  // 距离场在启动时生成，第一次显示横幅时不卡顿
+    letterGlyphs.prepare();
 
-    // 如果特殊气球是活跃的
-    if (specialBalloon.isActive) {
-        sky.specialUpdateClouds(specialBalloon.getY());
-        sky.specialUpdateStars(specialBalloon.getY());
-        glClearColor(sky.getRed(), sky.getGreen(), sky.getBlue(), 1.0);
-        letter.draw();
-        letter.drawText(text);
-        sky.draw();
-        //绘制特殊气球
-        if (specialBalloon.getY() < 900) {
-            specialBalloon.update();
-            specialBalloon.draw();
-//          specialBalloon.rise();
-        }
-        // 调整摄像机位置跟随气球上升
-        if (specialBalloon.getY() < 700){
-            glTranslatef(0.0, -specialBalloon.getY(), 0.0);
+    if (!sceneLoaded) {
+        createDefaultScene();
+    }
+
+    // 静态几何体只上传一次
+    renderer.beginMesh(backgroundMesh);
+    drawGround();
+    drawBuilding();
+    renderer.endMesh(backgroundMesh);
+    renderer.beginMesh(treeMesh);
+    for (const Tree& tree : trees) {
+        if (leafShape.ready()) {
+            tree.drawTrunk();
         } else {
-            glTranslatef(0.0, -700, 0.0);
-        }
-        drawGround();
-        drawBuilding();
-        // 绘制花朵
-        for (Flower& flower : flowers) {
-            flower.update();
-            flower.draw();
+            tree.draw();
         }
-        // 绘制树
+    }
+    renderer.endMesh(treeMesh);
+    if (leafShape.ready()) {
+        instanceScratch.clear();
         for (const Tree& tree : trees) {
-            tree.draw();
+            tree.appendLeafInstances(instanceScratch);
         }
-    } else {
-        // 更新云朵的位置
-        sky.updateClouds();
-        // 更新星星的位置
-        sky.updateStars();
-        if (fireworksStarted) {
-            sky.darken();
-        }
-        glClearColor(sky.getRed(), sky.getGreen(), sky.getBlue(), 1.0);
-        sky.draw();
-        drawGround();
-        drawBuilding();
+        leafShape.setInstances(instanceScratch.data(), static_cast<int>(instanceScratch.size()) / 7, GL_STATIC_DRAW);
+    }
+}
 
-        // 绘制花朵
-        for (Flower& flower : flowers) {
-            flower.update();
-            flower.draw();
+// 把系统分块并行地用在原型的所有行上；系统会移动实体，之后查询前要重新登记网格。
+// 每块用按任务编号和起始行生成的随机数流，结果与分给哪个线程无关
+template <typename System>
+void runSystem(Archetype& type, int chunkSize, System system) {
+    Archetype* rows = &type;
+    type.moved = true;
+    uint64_t task = nextRandomTask++;
+    jobSystem.parallelFor(type.size, chunkSize, [rows, system, task](int begin, int end) {
+        RandomStream stream(task << 32 | static_cast<uint32_t>(begin));
+        system(*rows, begin, end);
+    });
+}
+
+// 更新整个场景的模拟状态，不调用任何GL函数；各原型分块并行更新，最后统一等待
+void updateScene() {
+    uint64_t skyTask = nextRandomTask++ << 32;
+    if (specialBalloon.isActive) {
+        // 天空按气球这一步之前的高度更新；先在主线程读出来，任务里不碰下面正在上升的气球
+        float balloonY = specialBalloon.getY();
+        jobSystem.submit([skyTask, balloonY]() {
+            RandomStream stream(skyTask);
+            PROFILE_SCOPE("update.sky");
+            sky.specialUpdateClouds(balloonY);
+            sky.specialUpdateStars(balloonY);
+        });
+        specialBalloonRising = balloonY < 900;
+        if (specialBalloonRising) {
+            PROFILE_SCOPE("update.specialBalloon");
+            specialBalloon.update();
         }
-        // 绘制树
-        for (const Tree& tree : trees) {
-            tree.draw();
+    } else {
+        jobSystem.submit([skyTask]() {
+            RandomStream stream(skyTask);
+            PROFILE_SCOPE("update.sky");
+            // 更新云朵的位置
+            sky.updateClouds();
+            // 更新星星的位置
+            sky.updateStars();
+            if (fireworksStarted) {
+                sky.darken();
+            }
+        });
+        world.each(COMPONENT_TRANSFORM | COMPONENT_MOTION, [](Archetype& type) {
+            runSystem(type, 256, [](Archetype& rows, int begin, int end) {
+                PROFILE_SCOPE("update.motion");
+                motionSystem(rows, begin, end);
+                if (balloonsFlying && rows.kind == SHAPE_BALLOON) {
+                    riseSystem(rows, begin, end);
+                }
+            });
+        });
+    }
+    world.each(COMPONENT_LIFETIME, SHAPE_FLOWER, [](Archetype& type) {
+        runSystem(type, 256, [](Archetype& rows, int begin, int end) {
+            PROFILE_SCOPE("update.flowers");
+            bloomSystem(rows, begin, end);
+        });
+    });
+    jobSystem.wait();
+
+    // 横幅到达楼顶后开始放烟花
+    if (!specialBalloon.isActive && balloonsFlying && world.transform(bannerBalloon).y + bannerYOffset >= 500) {
+        fireworksStarted = true;
+        world.each(FIREWORK_COMPONENTS, SHAPE_FIREWORK, [](Archetype& type) {
+            runSystem(type, 16, [](Archetype& rows, int begin, int end) {
+                PROFILE_SCOPE("update.fireworks");
+                fireworkSystem(rows, begin, end);  // 更新烟花的状态
+            });
+        });
+        jobSystem.wait();
+    }
+}
+
+// 执行一个固定步长的模拟步
+void stepSimulation() {
+    world.each(COMPONENT_TRANSFORM | COMPONENT_MOTION, [](Archetype& type) {
+        snapshotSystem(type);
+        type.moved = true;
+    });
+    specialBalloon.snapshot();
+    sky.snapshot();
+    particleSystem.snapshot();
+
+    updateScene();
+
+    if (!timerStarted) {
+        return;
+    }
+    frameCounter++;
+
+    // 更新气球
+    world.each(BALLOON_COMPONENTS, SHAPE_BALLOON, [](Archetype& type) {
+        runSystem(type, 256, [](Archetype& rows, int begin, int end) {
+            PROFILE_SCOPE("update.recycle");
+            recycleSystem(rows, begin, end);
+        });
+    });
+    jobSystem.wait();
+
+    // 每30帧切换一次窗户的可见性
+    if (frameCounter >= 30) {
+        windowsVisible = !windowsVisible;
+        frameCounter = 0;
+    }
+}
+
+// 两种模式共用的地面、建筑、花和树
+void drawBackground() {
+    // 镜头升高后地面、建筑物和树整个离开视野
+    if (camera.sees(backgroundMesh.bounds)) {
+        PROFILE_SCOPE("draw.ground+building");
+        if (!backgroundLayer.draw(backgroundLayerKey(), drawGroundAndBuilding)) {
+            drawGroundAndBuilding();
         }
-        for (Balloon& balloon : balloons) {
-            balloon.update();
+    }
+    {
+        PROFILE_SCOPE("draw.flowers");
+        drawFlowers();
+    }
+    if (camera.sees(treeBounds())) {
+        PROFILE_SCOPE("draw.trees");
+        if (!treeLayer.draw(0, drawTrees)) {
+            drawTrees();
         }
-        if (balloonsFlying) {
-            for (int i = 0; i < balloons.size(); i++) {
-                auto& balloon = balloons[i];
-                balloon.draw();  // 使用Balloon类的draw方法绘制气球
+    }
+}
 
-                if (balloon.holdingText()) {  // 如果气球拉着字，使用固定速度
-                    balloon.setY(balloon.getY() + 2);
-                } else {
-                    balloon.setY(balloon.getY() + 1 + (rand() % 3));  // Random speed between 1 and 3
-                }
-            }
+// 普通模式的整个场景；局部重画时每个受损矩形各画一遍
+void drawScene() {
+    {
+        PROFILE_SCOPE("draw.sky");
+        sky.draw();
+    }
+    drawBackground();
+    if (balloonsFlying) {
+        {
+            PROFILE_SCOPE("draw.balloons");
+            drawBalloons();
+        }
 
-            if (balloons[0].getY() + bannerYOffset < 500) {
-                drawCenteredText(balloons[0].getY() + bannerYOffset + 15, "2024 XJTLU Graduation Ceremony");
+        float bannerY = renderY(world.transform(bannerBalloon)) + bannerYOffset;
+        {
+            PROFILE_SCOPE("draw.banner");
+            if (bannerY < 500) {
+                drawCenteredText(bannerY + 15, "2024 XJTLU Graduation Ceremony");
             } else {
                 drawCenteredText(515, "2024 XJTLU Graduation Ceremony");  // Centered on the building top
+            }
+        }
 
-                if (!fireworksStarted) {
-                    fireworksStarted = true;
-                }
-                if (fireworksStarted) {
-                    glEnable(GL_BLEND);  // 启用混合
-                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  // 设置混合模式
-                    for (Firework& firework : fireworks) {
-                        firework.update();  // 更新烟花的状态
-                        firework.draw();
-                    }
-                }
+        if (bannerY >= 500 && fireworksStarted) {
+            PROFILE_SCOPE("draw.fireworks");
+            if (!renderer.softwareMode()) {
+                glEnable(GL_BLEND);  // 启用混合
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);  // 设置混合模式
             }
+            drawFireworks();  // 视野内的烟花一次绘制
         }
+    }
 
+    {
+        PROFILE_SCOPE("draw.button");
         drawInvitationButton();
     }
-
-    glPopMatrix();
-    glutSwapBuffers();
 }
 
-void timer(int) {
-    if (!timerStarted) {
-        return;
-    }
-    frameCounter++;
-
-    // 更新气球
-    for (auto& balloon : balloons) {
-        if (balloon.getY() > WINDOW_HEIGHT) {
-            if (!balloon.holdingText()) {  // 只有不拉着字的气球才重新初始化
-                // 重新初始化气球的位置和颜色
-                balloon.setY(-100);  // 使气球从屏幕底部重新出现
-                balloon.setColor(static_cast<float>(rand()) / RAND_MAX,
-                                 static_cast<float>(rand()) / RAND_MAX,
-                                 static_cast<float>(rand()) / RAND_MAX);  // 设置随机颜色
-            } else {
-                // 如果气球拉着字并且到达屋顶，停止上升
-                balloon.setSpeed(0);
+// 与drawScene的内容一一对应，每帧报告的项数必须相同；地面、建筑物、树和按钮不会变化，不用报告
+void reportSceneDamage() {
+    GLfloat clearColor[4];
+    renderer.getClearColor(clearColor);  // 天空颜色或镜头变化时整帧重画
+    Bounds view = camera.view();
+    damageTracker.setView(view);
+    damageTracker.report(view.x0, view.y0, view.x1, view.y1,
+                         DamageTracker::State() << clearColor[0] << clearColor[1] << clearColor[2] << view.x0 << view.y0 << view.x1 << view.y1);
+    sky.reportDamage(damageTracker);
+    damageTracker.report(280, 120, 320, 480, backgroundLayerKey());  // 点亮的窗户
+    world.each(FLOWER_COMPONENTS, SHAPE_FLOWER, [](Archetype& type) {
+        for (int i = 0; i < type.size; i++) {
+            Bounds area = entityBounds(type, i);
+            damageTracker.report(area.x0, area.y0, area.x1, area.y1,
+                                 DamageTracker::State() << type.lifetime[i].progress << (type.lifetime[i].running ? 1.0f : 0.0f));
+        }
+    });
+    float bannerY = renderY(world.transform(bannerBalloon)) + bannerYOffset;
+    world.each(BALLOON_COMPONENTS, SHAPE_BALLOON, [](Archetype& type) {
+        for (int i = 0; i < type.size; i++) {
+            if (!balloonsFlying) {
+                damageTracker.reportNothing();
+                continue;
             }
+            // 插值后的位置：气球半宽20、上沿30，绳子长80并随风摆动最多5
+            float x = type.transform[i].x;
+            float drawY = renderY(type.transform[i]);
+            const Colour& c = type.colour[i];
+            damageTracker.report(x - 25, drawY - 80, x + 25, drawY + 30, DamageTracker::State() << c.r << c.g << c.b << type.motion[i].sway);
+        }
+    });
+    if (balloonsFlying) {
+        float textY = bannerY < 500 ? bannerY + 15 : 515;
+        damageTracker.report(0, textY - 15, WINDOW_WIDTH, textY + 40, DamageTracker::State() << textY);  // 横幅文字连同描边
+    } else {
+        damageTracker.reportNothing();
+    }
+    if (balloonsFlying && bannerY >= 500 && fireworksStarted) {
+        particleSystem.reportDamage(damageTracker);
+    } else {
+        for (size_t i = 0; i < particleSystem.emitters.size(); i++) {
+            damageTracker.reportNothing();
         }
     }
+}
 
-    // 更新烟花
-    for (Firework& firework : fireworks) {
-        firework.update();  // 使用Firework类的update方法更新烟花状态
+std::vector<DamageTracker::Rect> damageRects;
 
-        // 如果烟花完全淡出，重新初始化
-        if (firework.isFadedOut()) {  //使用Firework类的isFadedOut方法来检查烟花是否已经完全淡出
-            firework.init();  // 使用Firework类的init方法重新初始化烟花
+void display() {
+    frameProfiler.beginFrame();
+    int steps = simulationClock.advance(elapsedSeconds());
+    {
+        PROFILE_SCOPE("simulation");
+        for (int i = 0; i < steps; i++) {
+            stepSimulation();
         }
     }
+    interpolationAlpha = simulationClock.alpha();
 
-    // 每30帧切换一次窗户的可见性
-    if (frameCounter >= 30) {
-        windowsVisible = !windowsVisible;
-        frameCounter = 0;
+    // 后台纹理上传每帧只占用固定的预算
+    if (textureUploader.busy()) {
+        PROFILE_SCOPE("textures");
+        textureUploader.pump();
     }
 
-    glutPostRedisplay();
-    glutTimerFunc(1000/60, timer, 0);  // 60 FPS
+    renderer.beginFrame();
+    // 镜头跟随特殊气球移动、分析器画在画面上、画布刚建立时整帧重画
+    if (!sceneCanvas.begin() || specialBalloon.isActive || frameProfiler.hudVisible()) {
+        damageTracker.invalidate();
+    }
+    bool partial = false;
+    if (!specialBalloon.isActive) {
+        PROFILE_SCOPE("damage");
+        reportSceneDamage();
+        GLint viewport[4];
+        renderer.viewport(viewport);
+        partial = damageTracker.resolve(viewport, damageRects);
+    }
+
+    if (partial) {
+        // 只清除并重画受损的矩形，没有受损时画面保持上一帧
+        renderer.pushMatrix();
+        camera.apply();
+        for (const DamageTracker::Rect& rect : damageRects) {
+            renderer.scissor(rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+            renderer.clear();
+            drawScene();
+            renderer.flush();
+        }
+        renderer.disableScissor();
+        renderer.popMatrix();
+        renderer.clearColor(sky.getRed(), sky.getGreen(), sky.getBlue(), 1.0);
+    } else {
+        renderer.clear();
+        renderer.pushMatrix();
+        renderer.clearColor(sky.getRed(), sky.getGreen(), sky.getBlue(), 1.0);
+
+        // 如果特殊气球是活跃的
+        if (specialBalloon.isActive) {
+            {
+                PROFILE_SCOPE("draw.letter");
+                letter.draw();
+                letter.drawText(text);
+            }
+            {
+                PROFILE_SCOPE("draw.sky");
+                sky.draw();
+            }
+            //绘制特殊气球
+            if (specialBalloonRising) {
+                PROFILE_SCOPE("draw.specialBalloon");
+                specialBalloon.draw();
+            }
+            // 调整摄像机位置跟随气球上升，最高升到700
+            renderer.flush();
+            camera.follow(WINDOW_WIDTH / 2.0f, specialBalloon.renderY() + WINDOW_HEIGHT / 2.0f);
+            camera.apply();
+            drawBackground();
+        } else {
+            camera.apply();
+            drawScene();
+        }
+
+        renderer.popMatrix();
+    }
+    sceneCanvas.end();
+    {
+        PROFILE_SCOPE("profiler.hud");
+        frameProfiler.drawHud();
+    }
+    {
+        PROFILE_SCOPE("present");
+        renderer.endFrame();
+        presentFrame();
+    }
+    frameProfiler.endFrame();
+}
+
+// 定时器只负责按60 FPS请求重绘，模拟由display中的模拟时钟推进
+void timer(int) {
+    requestRedisplay();
+    scheduleTimer(1000/60, timer);  // 60 FPS
 }
 
 void mouse(int button, int state, int x, int y) {
@@ -999,14 +6590,15 @@ void mouse(int button, int state, int x, int y) {
         float glX = (float)x / (float)WINDOW_WIDTH * 2.0 - 1.0;
         float glY = 1.0 - (float)y / (float)WINDOW_HEIGHT * 2.0;
         timerStarted = true;
-        glutTimerFunc(0, timer, 0);
         balloonsFlying = true;
         windowsActivated = true;
-        for (Flower& flower : flowers) {
-            flower.startBlooming();
-        }
+        world.each(FLOWER_COMPONENTS, SHAPE_FLOWER, [](Archetype& type) {
+            for (Lifetime& lifetime : type.lifetime) {
+                lifetime.running = true;
+            }
+        });
     }
-    glutPostRedisplay();
+    requestRedisplay();
     if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN)
     {
         specialBalloon.activate();
@@ -1014,18 +6606,84 @@ void mouse(int button, int state, int x, int y) {
 
 }
 
+void keyboard(unsigned char key, int, int) {
+    if (key == 'p' || key == 'P') {
+        frameProfiler.toggleHud();  // 显示或隐藏帧分析器
+        damageTracker.invalidate();  // 分析器画在画面上，隐藏后要整帧重画
+    }
+    // 镜头：+/-缩放，0复位
+    if (key == '+' || key == '=') {
+        camera.zoomBy(1.25f);
+    } else if (key == '-') {
+        camera.zoomBy(0.8f);
+    } else if (key == '0') {
+        camera.reset();
+    }
+}
+
+// 方向键平移镜头
+void specialKey(int key, int, int) {
+    if (key == GLUT_KEY_LEFT) camera.pan(-20, 0);
+    if (key == GLUT_KEY_RIGHT) camera.pan(20, 0);
+    if (key == GLUT_KEY_UP) camera.pan(0, 20);
+    if (key == GLUT_KEY_DOWN) camera.pan(0, -20);
+}
+
 
+#ifndef CPT205_NO_MAIN
 int main(int argc, char** argv) {
+    // 离线转换纹理，不打开窗口：--convert-textures [--compress] a.ppm b.ppm ...，结果写在a.ppm.ctex等
+    if (argc > 1 && std::string(argv[1]) == "--convert-textures") {
+        bool compress = false;
+        int failures = 0;
+        for (int i = 2; i < argc; i++) {
+            if (std::string(argv[i]) == "--compress") {
+                compress = true;
+            } else if (!convertPPMToTextureFile(argv[i], (std::string(argv[i]) + ".ctex").c_str(), compress)) {
+                failures++;
+            }
+        }
+        return failures == 0 ? 0 : 1;
+    }
+    // 离线编译场景文件：--compile-scene a.scene b.scene ...，结果写在a.scene.cscene等
+    if (argc > 1 && std::string(argv[1]) == "--compile-scene") {
+        int failures = 0;
+        for (int i = 2; i < argc; i++) {
+            if (!compileSceneFile(argv[i], (std::string(argv[i]) + ".cscene").c_str())) {
+                failures++;
+            }
+        }
+        return failures == 0 ? 0 : 1;
+    }
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
     glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
     glutCreateWindow("XJTLU Graduation Ceremony Invitation Card");
 
+    // glutInit已经去掉了glut自己的参数；场景在读完--seed之后再加载
+    const char* scene = nullptr;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--profile-csv") {
+            frameProfiler.openCsv(argv[++i]);
+        } else if (std::string(argv[i]) == "--scene") {
+            scene = argv[++i];
+        } else if (std::string(argv[i]) == "--seed") {
+            seedRandom(strtoull(argv[++i], nullptr, 10));
+        }
+    }
+    if (scene != nullptr && !loadCachedScene(scene)) {
+        return 1;
+    }
+
     init();  // 初始化OpenGL和场景
     glutDisplayFunc(display);  // 设置显示回调函数
     glutMouseFunc(mouse);  // 设置鼠标回调函数
+    glutKeyboardFunc(keyboard);  // P键显示帧分析器，+/-/0缩放镜头
+    glutSpecialFunc(specialKey);  // 方向键平移镜头
     glutTimerFunc(0, timer, 0);  // 设置定时器回调函数
 
     glutMainLoop();  // 进入主循环
     return 0;
 }
+#endif
@@ -0,0 +1,553 @@
+// 性能测试程序：与主程序共用同一份代码，只是不编译主程序的main函数
+// 每个更新/绘制函数在不同规模下单独计时；绘制函数需要无窗口GL上下文（CMake在有EGL时定义CPT205_HEADLESS）
+//
+// 用法: CPT205_Benchmark [--json 文件] [--filter 名字的一部分] [--min-time 秒]
+#define CPT205_NO_MAIN
+#include "assessment-1-oop.cpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+struct BenchmarkResult {
+    std::string name;
+    int scale;  // 每次调用处理的对象数（粒子、气球、字符……）
+    long long iterations;
+    double nsPerCall;
+};
+
+std::vector<BenchmarkResult> results;
+std::string benchmarkFilter;
+double minSeconds = 0.2;  // 每项至少测这么久
+
+// 自动增加调用次数，直到总耗时超过minSeconds
+template <typename Body>
+void measure(const std::string& name, int scale, Body&& body) {
+    if (!benchmarkFilter.empty() && name.find(benchmarkFilter) == std::string::npos) return;
+    body();  // 预热
+    long long iterations = 1;
+    double seconds = 0;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; i++) {
+            body();
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds >= minSeconds || iterations >= (1LL << 32)) break;
+        double estimate = seconds > 0 ? iterations * minSeconds / seconds * 1.2 : iterations * 10.0;
+        iterations = std::max(iterations * 2, static_cast<long long>(std::min(estimate, 4.0e9)));
+    }
+    BenchmarkResult result = {name, scale, iterations, seconds * 1.0e9 / iterations};
+    results.push_back(result);
+    std::cout << "  " << name << " @ " << scale << ": " << result.nsPerCall << " ns/call, "
+              << result.nsPerCall / scale << " ns/item" << std::endl;
+}
+
+const BenchmarkResult* findResult(const std::string& name, int scale) {
+    for (const BenchmarkResult& result : results) {
+        if (result.name == name && result.scale == scale) return &result;
+    }
+    return nullptr;
+}
+
+// 用与respawnFirework相同的分布填充粒子
+void fillParticles(std::vector<float>& position, std::vector<float>& velocity, std::vector<float>& life, int count) {
+    position.resize(count * 2);
+    velocity.resize(count * 2);
+    life.resize(count);
+    Random& random = threadRandom();
+    for (int i = 0; i < count; i++) {
+        float speed = 1.0f + random.uniform();
+        float angle = random.uniform() * static_cast<float>(2 * TABLE_PI);
+        position[i * 2] = static_cast<float>(random.below(WINDOW_WIDTH));
+        position[i * 2 + 1] = static_cast<float>(500 + random.below(300));
+        velocity[i * 2] = speed * cos(angle);
+        velocity[i * 2 + 1] = speed * sin(angle);
+        life[i] = 2.0;
+    }
+}
+
+void benchmarkKernels() {
+    std::vector<ParticleKernel> kernels = availableParticleKernels();
+    const int sizes[] = {1000, 100000, 1000000};
+    std::cout << "particle integration" << std::endl;
+    for (int count : sizes) {
+        std::vector<float> position, velocity, life;
+        fillParticles(position, velocity, life, count);
+        for (const ParticleKernel& kernel : kernels) {
+            measure(std::string("ParticleKernel/") + kernel.name, count, [&]() {
+                kernel.integrate(position.data(), velocity.data(), life.data(), count);
+            });
+        }
+        const BenchmarkResult* scalar = findResult(std::string("ParticleKernel/") + kernels[0].name, count);
+        for (const ParticleKernel& kernel : kernels) {
+            const BenchmarkResult* result = findResult(std::string("ParticleKernel/") + kernel.name, count);
+            if (scalar != nullptr && result != nullptr) {
+                std::cout << "    " << kernel.name << " @ " << count << ": " << scalar->nsPerCall / result->nsPerCall
+                          << "x scalar" << std::endl;
+            }
+        }
+    }
+}
+
+// 随机数：原来的rand()、逐个生成，对照各指令集的批量生成；批量生成的结果必须与标量版本逐位相同
+void benchmarkRandom() {
+    std::vector<RandomKernel> kernels = availableRandomKernels();
+    std::cout << "random numbers" << std::endl;
+    for (int count : {1000, 100000}) {
+        std::vector<float> out(count), reference(count);
+        measure("rand", count, [&]() {
+            for (int i = 0; i < count; i++) out[i] = static_cast<float>(rand()) / RAND_MAX;
+        });
+        Random random(1);
+        measure("Random::uniform", count, [&]() {
+            for (int i = 0; i < count; i++) out[i] = random.uniform();
+        });
+        Random(7).fill(reference.data(), count, kernels[0].fill);
+        for (const RandomKernel& kernel : kernels) {
+            measure(std::string("RandomKernel/") + kernel.name, count, [&]() { random.fill(out.data(), count, kernel.fill); });
+            Random(7).fill(out.data(), count, kernel.fill);
+            if (out != reference) std::cout << "    " << kernel.name << " differs from scalar" << std::endl;
+        }
+    }
+}
+
+// 旧写法：每个顶点都调用cos/sin生成气球轮廓和高光
+int balloonOutlineTrig(float x, float y, float* out) {
+    int n = 0;
+    for (int i = 0; i < 360; i += 10) {
+        float degInRad = i * 3.14159 / 180;
+        out[n++] = x + cos(degInRad) * 20;
+        out[n++] = y + sin(degInRad) * 30;
+    }
+    for (int i = 0; i <= 360; i += 10) {
+        float degInRad = i * DEG2RAD;
+        out[n++] = x + cos(degInRad) * 10;
+        out[n++] = y + 15 + sin(degInRad) * 5;
+    }
+    return n;
+}
+
+// 新写法：查编译期生成的单位圆表
+int balloonOutlineTable(float x, float y, float* out) {
+    int n = 0;
+    for (int i = 0; i < CIRCLE_10.SEGMENTS; i++) {
+        out[n++] = x + CIRCLE_10.x[i] * 20;
+        out[n++] = y + CIRCLE_10.y[i] * 30;
+    }
+    for (int i = 0; i <= CIRCLE_10.SEGMENTS; i++) {
+        out[n++] = x + CIRCLE_10.x[i] * 10;
+        out[n++] = y + 15 + CIRCLE_10.y[i] * 5;
+    }
+    return n;
+}
+
+void benchmarkOutlines() {
+    std::cout << "balloon outline vertices" << std::endl;
+    const int balloonCount = 1000;
+    std::vector<float> out(balloonCount * 2 * 73);
+    auto outline = [&](int (*generate)(float, float, float*)) {
+        int n = 0;
+        for (int i = 0; i < balloonCount; i++) {
+            n += generate(static_cast<float>(i % WINDOW_WIDTH), static_cast<float>(i % WINDOW_HEIGHT), out.data() + n);
+        }
+        volatile float sink = out[n - 1];  // 防止编译器把整个循环优化掉
+        (void)sink;
+    };
+    measure("BalloonOutline/trig", balloonCount, [&]() { outline(balloonOutlineTrig); });
+    measure("BalloonOutline/table", balloonCount, [&]() { outline(balloonOutlineTable); });
+}
+
+// 软件光栅化：1080p的帧缓冲上画一批随机的三角形或点，计时包括分箱和各图块的执行
+void benchmarkRasterizer() {
+    std::cout << "software rasterizer (1920x1080, " << jobSystem.workerCount() << " threads)" << std::endl;
+    SoftwareRasterizer raster;
+    raster.resize(1920, 1080);
+    SoftwareRasterizer::Transform transform{1920.0f / WINDOW_WIDTH, 1080.0f / WINDOW_HEIGHT, 0, 0};
+    const int count = 1000;
+    Random random(1);
+    // 边长约30的三角形；opaque为false时三个顶点颜色不同、半透明
+    auto triangles = [&](bool opaque) {
+        std::vector<Vertex> vertices;
+        for (int i = 0; i < count; i++) {
+            float x = static_cast<float>(random.below(WINDOW_WIDTH)), y = static_cast<float>(random.below(WINDOW_HEIGHT));
+            for (int k = 0; k < 3; k++) {
+                unsigned char shade = opaque ? 200 : static_cast<unsigned char>(random.below(256));
+                vertices.push_back({x + random.uniform() * 30, y + random.uniform() * 30, shade, 100, 50,
+                                    static_cast<unsigned char>(opaque ? 255 : 128), 0, 0});
+            }
+        }
+        return vertices;
+    };
+    std::vector<Vertex> opaque = triangles(true), blended = triangles(false), points(count);
+    for (Vertex& point : points) {
+        point = {static_cast<float>(random.below(WINDOW_WIDTH)), static_cast<float>(random.below(WINDOW_HEIGHT)), 255, 200, 0, 200, 0, 0};
+    }
+    const unsigned char sky[4] = {0, 0, 80, 255};
+    measure("SoftwareRasterizer/clear", 1, [&]() {
+        raster.clear(sky);
+        raster.finish();
+    });
+    measure("SoftwareRasterizer/opaqueTriangles", count, [&]() {
+        raster.drawTriangles(opaque.data(), static_cast<int>(opaque.size()), transform, 0);
+        raster.finish();
+    });
+    measure("SoftwareRasterizer/blendedTriangles", count, [&]() {
+        raster.drawTriangles(blended.data(), static_cast<int>(blended.size()), transform, 0);
+        raster.finish();
+    });
+    measure("SoftwareRasterizer/points", count, [&]() {
+        raster.drawPoints(points.data(), count, 3.0f, transform);
+        raster.finish();
+    });
+}
+
+// 测试时把场景的实体换成一批临时的，测完换回来
+class ScopedWorld {
+public:
+    ScopedWorld() {
+        std::swap(saved, world);
+    }
+    ~ScopedWorld() {
+        std::swap(saved, world);
+    }
+private:
+    World saved;
+};
+
+// 临时世界里唯一的一个原型
+Archetype& onlyArchetype(unsigned components, ShapeKind kind) {
+    Archetype* found = nullptr;
+    world.each(components, kind, [&](Archetype& type) { found = &type; });
+    return *found;
+}
+
+// 更新函数只用CPU，不需要GL上下文
+void benchmarkUpdates() {
+    std::cout << "update routines" << std::endl;
+    for (int count : {1, 10, 100}) {
+        ScopedWorld scope;
+        for (int i = 0; i < count; i++) spawnFirework();
+        Archetype& type = onlyArchetype(FIREWORK_COMPONENTS, SHAPE_FIREWORK);
+        measure("respawnFirework", count, [&]() {
+            for (int i = 0; i < type.size; i++) respawnFirework(type, i);
+        });
+        measure("fireworkSystem", count, [&]() { fireworkSystem(type, 0, type.size); });
+    }
+    for (int count : {1, 10, 100}) {
+        measure("Tree::generateLeaves", count, [&]() {
+            for (int i = 0; i < count; i++) {
+                Tree tree(100, 100);  // 构造函数调用generateLeaves
+            }
+        });
+    }
+    // 组件数组上的线性遍历，十万个实体
+    for (int count : {10, 1000, 100000}) {
+        ScopedWorld scope;
+        for (int i = 0; i < count; i++) {
+            spawnFlower(300, 50);
+            spawnBalloon(static_cast<float>(i % WINDOW_WIDTH), -100, 1, 0, 0);
+        }
+        Archetype& flowerRows = onlyArchetype(FLOWER_COMPONENTS, SHAPE_FLOWER);
+        for (Lifetime& lifetime : flowerRows.lifetime) lifetime.running = true;
+        measure("bloomSystem", count, [&]() { bloomSystem(flowerRows, 0, flowerRows.size); });
+        Archetype& balloonRows = onlyArchetype(BALLOON_COMPONENTS, SHAPE_BALLOON);
+        measure("motionSystem", count, [&]() { motionSystem(balloonRows, 0, balloonRows.size); });
+        measure("riseSystem", count, [&]() { riseSystem(balloonRows, 0, balloonRows.size); });
+        measure("recycleSystem", count, [&]() { recycleSystem(balloonRows, 0, balloonRows.size); });
+    }
+    for (int count : {1, 16}) {
+        std::vector<Sky> skies(count);
+        measure("Sky::updateStars", count, [&]() {
+            for (Sky& s : skies) s.updateStars();
+        });
+        measure("Sky::updateClouds", count, [&]() {
+            for (Sky& s : skies) s.updateClouds();
+        });
+        measure("Sky::specialUpdateStars", count, [&]() {
+            for (Sky& s : skies) s.specialUpdateStars(400);
+        });
+        measure("Sky::specialUpdateClouds", count, [&]() {
+            for (Sky& s : skies) s.specialUpdateClouds(400);
+        });
+    }
+    // 场景文件：解析文本并编译，对照映射编译结果后整段复制（没有树和烟花，它们不是整段复制的）
+    Sky savedSky = sky;
+    for (int count : {1000, 100000}) {
+        std::string path = "cpt205_benchmark_" + std::to_string(count) + ".scene";
+        std::string cachePath = path + ".cscene";
+        {
+            std::ofstream file(path);
+            file << "stars 100\nclouds 5\nbanner 250 -100 1 0 0\nballoons " << count / 2 << "\nflowers " << count / 2 << "\n";
+        }
+        measure("compileSceneFile", count, [&]() { compileSceneFile(path.c_str(), cachePath.c_str()); });
+        measure("loadCachedScene", count, [&]() {
+            ScopedWorld scope;
+            loadCachedScene(path.c_str());
+        });
+        std::remove(cachePath.c_str());
+        std::remove(path.c_str());
+    }
+    sky = savedSky;
+    sceneLoaded = false;
+}
+
+long long benchmarkRespawnAllocations() {
+    // 预热后烟花反复重生不应再申请内存
+    ScopedWorld scope;
+    for (int i = 0; i < 100; i++) {
+        spawnFirework();
+    }
+    Archetype& pool = onlyArchetype(FIREWORK_COMPONENTS, SHAPE_FIREWORK);
+    long long warmAllocations = particleAllocations;
+    int frames = 10000;
+    for (int frame = 0; frame < frames; frame++) {
+        fireworkSystem(pool, 0, pool.size);
+    }
+    long long allocations = particleAllocations - warmAllocations;
+    std::cout << "firework respawn: " << pool.size * frames / 100 << " respawns, "
+              << allocations << " particle allocations after warm-up" << std::endl;
+    return allocations;
+}
+
+#ifdef CPT205_HEADLESS
+// 每次调用相当于一帧：开始帧、绘制、提交，并等GPU（或llvmpipe）画完
+template <typename Draw>
+void measureDraw(const std::string& name, int scale, Draw&& draw) {
+    measure(name, scale, [&]() {
+        renderer.beginFrame();
+        draw();
+        renderer.endFrame();
+        glFinish();
+    });
+}
+
+std::string repeatedText(int length) {
+    const std::string sentence = "Dear graduate, you are invited to the 2024 XJTLU Graduation Ceremony. ";
+    std::string text;
+    while (static_cast<int>(text.size()) < length) text += sentence;
+    return text.substr(0, length);
+}
+
+void benchmarkDraws() {
+    std::cout << "draw routines (" << glGetString(GL_RENDERER) << ")" << std::endl;
+    for (int count : {1, 10, 100}) {
+        ScopedWorld scope;
+        for (int i = 0; i < count; i++) spawnFirework();
+        Archetype& pool = onlyArchetype(FIREWORK_COMPONENTS, SHAPE_FIREWORK);
+        fireworkSystem(pool, 0, pool.size);
+        measureDraw("drawFireworks", count, drawFireworks);
+    }
+    for (int count : {1, 10, 100}) {
+        std::vector<Tree> pool;
+        for (int i = 0; i < count; i++) pool.push_back(Tree(100 + i * 4, 100));
+        measureDraw("Tree::draw", count, [&]() {
+            for (const Tree& tree : pool) tree.draw();
+        });
+    }
+    for (int count : {10, 100, 1000}) {
+        ScopedWorld scope;
+        for (int i = 0; i < count; i++) spawnFlower(300, 50);
+        Archetype& pool = onlyArchetype(FLOWER_COMPONENTS, SHAPE_FLOWER);
+        for (Lifetime& lifetime : pool.lifetime) lifetime.running = true;
+        for (int i = 0; i < 100; i++) bloomSystem(pool, 0, pool.size);
+        measureDraw("drawFlowerShape", count, [&]() {
+            for (int i = 0; i < pool.size; i++) {
+                drawFlowerShape(pool.transform[i].x, pool.transform[i].y, pool.lifetime[i].progress, pool.lifetime[i].running);
+            }
+        });
+        measureDraw("drawFlowers", count, drawFlowers);  // 实例化路径
+    }
+    for (int count : {10, 100, 1000}) {
+        ScopedWorld scope;
+        for (int i = 0; i < count; i++) spawnBalloon(static_cast<float>(threadRandom().below(WINDOW_WIDTH)), 400, 1, 0, 0);
+        Archetype& pool = onlyArchetype(BALLOON_COMPONENTS, SHAPE_BALLOON);
+        motionSystem(pool, 0, pool.size);
+        measureDraw("drawBalloonShape", count, [&]() {
+            for (int i = 0; i < pool.size; i++) {
+                const Colour& c = pool.colour[i];
+                drawBalloonShape(pool.transform[i].x, renderY(pool.transform[i]), c.r, c.g, c.b, pool.motion[i].sway, false);
+            }
+        });
+        measureDraw("drawBalloons", count, drawBalloons);  // 实例化路径
+    }
+    {
+        // 视野裁剪：只有十分之一的气球在视野内，其余停在地面以下
+        ScopedWorld scope;
+        for (int i = 0; i < 1000; i++) spawnBalloon(static_cast<float>(threadRandom().below(WINDOW_WIDTH)), i % 10 == 0 ? 400 : -100, 1, 0, 0);
+        motionSystem(onlyArchetype(BALLOON_COMPONENTS, SHAPE_BALLOON), 0, 1000);
+        measureDraw("drawBalloons/culled", 1000, drawBalloons);
+    }
+    SpecialBalloon special;
+    special.setY(300);
+    special.snapshot();
+    measureDraw("SpecialBalloon::draw", 1, [&]() { special.draw(); });
+    measureDraw("Sky::draw", 1, [&]() { sky.draw(); });
+    // 地面、建筑物、花和树：每帧重新提交网格，或者合成缓存好的静态图层
+    measureDraw("drawBackground/direct", 1, [&]() {
+        drawGroundAndBuilding();
+        drawFlowers();
+        drawTrees();
+    });
+    measureDraw("drawBackground/layer", 1, drawBackground);
+    // 整帧：基准里模拟时钟不前进，画面不变时脏矩形什么都不重画，对照每帧整帧重画
+    measure("display/damage", 1, [&]() {
+        display();
+        glFinish();
+    });
+    measure("display/full", 1, [&]() {
+        damageTracker.invalidate();
+        display();
+        glFinish();
+    });
+
+    for (int length : {32, 256, 1999}) {
+        std::string text = repeatedText(length);
+        Letter page;
+        page.setPosition(WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2);
+        measureDraw("Letter::drawText", length, [&]() { page.drawText(text.c_str()); });
+        measureDraw("drawCenteredText", length, [&]() { drawCenteredText(400, text.c_str()); });
+        measureDraw("drawArtisticText", length, [&]() { drawArtisticText(20, 400, text.c_str()); });
+    }
+
+    // 排版缓存：文字不变时只是一次比较；改动最后一段时只重排这一段
+    std::string invitation = text;
+    TextLayout layout;
+    measure("TextLayout::update/cached", static_cast<int>(invitation.size()), [&]() {
+        layout.update(invitation.c_str(), letterGlyphs, 200);
+    });
+    measure("TextLayout::update/edit", static_cast<int>(invitation.size()), [&]() {
+        invitation.back() = invitation.back() == 'y' ? 'Y' : 'y';
+        layout.update(invitation.c_str(), letterGlyphs, 200);
+    });
+    measure("TextLayout::update/full", static_cast<int>(invitation.size()), [&]() {
+        TextLayout fresh;
+        fresh.update(invitation.c_str(), letterGlyphs, 200);
+    });
+
+    for (int size : {64, 256, 1024}) {
+        std::string path = "cpt205_benchmark_" + std::to_string(size) + ".ppm";
+        {
+            std::ofstream file(path, std::ios::binary);
+            file << "P6\n" << size << " " << size << "\n255\n";
+            std::vector<unsigned char> pixels(size * size * 3);
+            for (size_t i = 0; i < pixels.size(); i++) pixels[i] = static_cast<unsigned char>(i * 31);
+            file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+        }
+        measure("loadPPMTexture", size * size, [&]() {
+            GLuint texture = loadPPMTexture(path.c_str());
+            glDeleteTextures(1, &texture);
+            glFinish();
+        });
+        // 异步加载的全部开销（映射、分块经PBO上传并等待完成），与上面的同步加载对比
+        measure("TextureUploader", size * size, [&]() {
+            GLuint texture = textureUploader.request(path.c_str());
+            textureUploader.finish();
+            glDeleteTextures(1, &texture);
+        });
+        // 预转换的.ctex（第一次调用时生成）：映射后直接上传完整mip链，压缩版还少传输3/4以上的数据
+        for (bool compress : {false, true}) {
+            std::string cachePath = path + ".ctex";
+            std::remove(cachePath.c_str());
+            measure(compress ? "loadCachedTexture/bc1" : "loadCachedTexture/rgba", size * size, [&]() {
+                GLuint texture = loadCachedTexture(path.c_str(), compress);
+                glDeleteTextures(1, &texture);
+                glFinish();
+            });
+            std::remove(cachePath.c_str());
+        }
+        std::remove(path.c_str());
+    }
+
+    // 64张32x32的小图：图集里共用一次绑定，单独的纹理每张都要换绑定、断开批次
+    const int images = 64;
+    std::vector<std::string> paths;
+    std::vector<TextureRegion> atlasRegions, separateRegions;
+    for (int i = 0; i < images; i++) {
+        paths.push_back("cpt205_benchmark_small_" + std::to_string(i) + ".ppm");
+        std::ofstream file(paths.back(), std::ios::binary);
+        file << "P6\n32 32\n255\n";
+        std::vector<unsigned char> pixels(32 * 32 * 3);
+        for (size_t p = 0; p < pixels.size(); p++) pixels[p] = static_cast<unsigned char>(p * 31 + i);
+        file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+    }
+    for (const std::string& path : paths) {
+        atlasRegions.push_back(textureCache.get(path.c_str()));
+        TextureRegion region;
+        region.texture = loadPPMTexture(path.c_str());
+        separateRegions.push_back(region);
+    }
+    measure("TextureCache::get", images, [&]() {
+        for (const std::string& path : paths) textureCache.get(path.c_str());
+    });
+    for (auto* regions : {&atlasRegions, &separateRegions}) {
+        measureDraw(regions == &atlasRegions ? "texturedQuad/atlas" : "texturedQuad/separate", images, [&]() {
+            for (int i = 0; i < images; i++) {
+                float x = i % 8 * 40.0f, y = i / 8 * 40.0f;
+                renderer.texturedQuad((*regions)[i], x, y, x + 32, y + 32);
+            }
+            renderer.bindTexture(0);
+        });
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+        glDeleteTextures(1, &separateRegions[i].texture);
+        std::remove(paths[i].c_str());
+    }
+}
+#endif
+
+// 手写JSON，名字里只有字母、数字和符号，不需要转义
+bool writeJson(const char* path, long long respawnAllocations) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    file << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        file << "    {\"name\": \"" << r.name << "\", \"scale\": " << r.scale << ", \"iterations\": " << r.iterations
+             << ", \"ns_per_call\": " << r.nsPerCall << ", \"ns_per_item\": " << r.nsPerCall / r.scale << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ],\n  \"firework_respawn_allocations\": " << respawnAllocations << "\n}\n";
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char** argv) {
+    const char* jsonPath = nullptr;
+    for (int i = 1; i < argc; i += 2) {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--json") {
+            jsonPath = argv[i + 1];
+        } else if (i + 1 < argc && arg == "--filter") {
+            benchmarkFilter = argv[i + 1];
+        } else if (i + 1 < argc && arg == "--min-time") {
+            minSeconds = atof(argv[i + 1]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--json file] [--filter name] [--min-time seconds]" << std::endl;
+            return 1;
+        }
+    }
+
+    benchmarkKernels();
+    benchmarkRandom();
+    benchmarkOutlines();
+    benchmarkRasterizer();
+    benchmarkUpdates();
+    long long respawnAllocations = benchmarkRespawnAllocations();
+#ifdef CPT205_HEADLESS
+    if (createHeadlessContext(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+        init();  // 投影、渲染器和实例化形状
+        benchmarkDraws();
+    } else {
+        std::cerr << "No headless GL context, skipping draw routines" << std::endl;
+    }
+#else
+    std::cout << "built without CPT205_HEADLESS, skipping draw routines" << std::endl;
+#endif
+
+    if (jsonPath != nullptr && !writeJson(jsonPath, respawnAllocations)) {
+        return 1;
+    }
+    return 0;
+}
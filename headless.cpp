@@ -0,0 +1,255 @@
+// 无窗口渲染：用EGL surfaceless（Mesa的llvmpipe也可以）创建离屏上下文，不需要显示器和GPU
+// 按帧号推进时间渲染N帧，可以把每帧写成PPM/PNG序列，最后报告帧率。--software 不创建GL上下文，
+// 整个场景用CPU上的软件光栅化画
+//
+// 用法: CPT205_Headless [--frames N] [--size WxH] [--out 前缀] [--format ppm|png]
+//                       [--fps 模拟帧率] [--click 帧号] [--special 帧号]
+//                       [--hud] [--profile-csv 文件] [--scene 场景文件] [--seed 种子] [--software]
+//                       [--threads 工作线程数]
+#define CPT205_NO_MAIN
+#define CPT205_HEADLESS
+#include "assessment-1-oop.cpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+struct HeadlessOptions {
+    int frames = 600;
+    int width = WINDOW_WIDTH, height = WINDOW_HEIGHT;
+    std::string out;  // 为空时不输出图片，只测帧率
+    std::string format = "ppm";
+    double fps = 60.0;
+    int clickFrame = 0;     // 在这一帧模拟左键点击，开始动画；-1表示不点击
+    int specialFrame = -1;  // 在这一帧模拟右键点击，放出特殊气球
+    bool hud = false;       // 在画面上显示帧分析器
+    std::string profileCsv;
+    std::string scene;  // 为空时用默认场景
+    uint64_t seed = randomSeed;  // 同一种子每次渲染的画面相同
+    bool software = false;  // 不用OpenGL，在CPU上光栅化
+    int threads = -1;  // 任务系统的工作线程数，-1表示按CPU核数
+};
+
+bool parseOptions(int argc, char** argv, HeadlessOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--hud") {
+            options.hud = true;
+            continue;
+        }
+        if (arg == "--software") {
+            options.software = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--frames") {
+            options.frames = atoi(value);
+        } else if (arg == "--size") {
+            if (sscanf(value, "%dx%d", &options.width, &options.height) != 2) {
+                std::cerr << "Invalid size: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--out") {
+            options.out = value;
+        } else if (arg == "--format") {
+            options.format = value;
+        } else if (arg == "--fps") {
+            options.fps = atof(value);
+        } else if (arg == "--click") {
+            options.clickFrame = atoi(value);
+        } else if (arg == "--special") {
+            options.specialFrame = atoi(value);
+        } else if (arg == "--profile-csv") {
+            options.profileCsv = value;
+        } else if (arg == "--scene") {
+            options.scene = value;
+        } else if (arg == "--seed") {
+            options.seed = strtoull(value, nullptr, 10);
+        } else if (arg == "--threads") {
+            options.threads = atoi(value);
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.format != "ppm" && options.format != "png") {
+        std::cerr << "Unknown format: " << options.format << std::endl;
+        return false;
+    }
+    return options.frames > 0 && options.width > 0 && options.height > 0 && options.fps > 0;
+}
+
+// 读回当前帧，按从上到下的行序存放RGB像素
+void readFrame(int width, int height, std::vector<unsigned char>& pixels) {
+    std::vector<unsigned char> rows(width * height * 3);
+    if (renderer.softwareMode()) {
+        std::vector<unsigned char> rgba(width * height * 4);
+        renderer.softwareRasterizer().read(rgba.data());
+        for (int i = 0; i < width * height; i++) {
+            std::copy(&rgba[i * 4], &rgba[i * 4 + 3], &rows[i * 3]);
+        }
+    } else {
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    }
+    pixels.resize(rows.size());
+    for (int y = 0; y < height; y++) {
+        std::copy(rows.begin() + (height - 1 - y) * width * 3, rows.begin() + (height - y) * width * 3,
+                  pixels.begin() + y * width * 3);
+    }
+}
+
+bool writePPM(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels) {
+    std::ofstream file(path, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+    return static_cast<bool>(file);
+}
+
+unsigned int crc32(const unsigned char* data, size_t length, unsigned int crc = 0) {
+    static unsigned int table[256];
+    if (table[1] == 0) {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void appendBigEndian(std::vector<unsigned char>& out, unsigned int value) {
+    out.insert(out.end(), {static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+                           static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value)});
+}
+
+void appendChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data) {
+    appendBigEndian(out, static_cast<unsigned int>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    appendBigEndian(out, crc32(out.data() + start, out.size() - start));
+}
+
+// PNG不依赖zlib：图像数据用不压缩的deflate块（stored block）保存，体积和PPM差不多，但任何看图软件都能打开
+bool writePNG(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels) {
+    std::vector<unsigned char> raw;
+    raw.reserve((width * 3 + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);  // 每行的过滤类型：不过滤
+        raw.insert(raw.end(), pixels.begin() + y * width * 3, pixels.begin() + (y + 1) * width * 3);
+    }
+
+    std::vector<unsigned char> deflate = {0x78, 0x01};
+    unsigned int a = 1, b = 0;  // Adler-32
+    for (size_t offset = 0; offset < raw.size() || offset == 0; ) {
+        size_t length = std::min<size_t>(65535, raw.size() - offset);
+        bool last = offset + length == raw.size();
+        deflate.push_back(last ? 1 : 0);
+        deflate.insert(deflate.end(), {static_cast<unsigned char>(length), static_cast<unsigned char>(length >> 8),
+                                       static_cast<unsigned char>(~length), static_cast<unsigned char>(~length >> 8)});
+        deflate.insert(deflate.end(), raw.begin() + offset, raw.begin() + offset + length);
+        for (size_t i = offset; i < offset + length; i++) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        offset += length;
+        if (last) break;
+    }
+    appendBigEndian(deflate, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});  // 8位RGB
+
+    std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", deflate);
+    appendChunk(png, "IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(png.data()), png.size());
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char** argv) {
+    HeadlessOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--frames N] [--size WxH] [--out prefix] [--format ppm|png]"
+                  << " [--fps rate] [--click frame] [--special frame] [--hud] [--profile-csv file]"
+                  << " [--scene file] [--seed n] [--software] [--threads n]" << std::endl;
+        return 1;
+    }
+    if (options.threads >= 0) {
+        jobSystem.resize(options.threads);
+    }
+    if (options.software) {
+        renderer.useSoftware(options.width, options.height);  // 场景坐标仍是600x800，按输出分辨率缩放
+        std::cout << "Software rasterizer: " << jobSystem.workerCount() << " threads" << std::endl;
+    } else {
+        if (!createHeadlessContext(options.width, options.height)) {
+            return 1;
+        }
+        std::cout << "GL renderer: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")" << std::endl;
+        glViewport(0, 0, options.width, options.height);  // 场景坐标仍是600x800，按输出分辨率缩放
+    }
+    seedRandom(options.seed);
+    if (!options.scene.empty() && !loadCachedScene(options.scene.c_str())) {
+        return 1;
+    }
+    init();
+    if (options.hud) {
+        frameProfiler.toggleHud();
+    }
+    if (!options.profileCsv.empty() && !frameProfiler.openCsv(options.profileCsv.c_str())) {
+        return 1;
+    }
+
+    std::vector<unsigned char> pixels;
+    double renderSeconds = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < options.frames; frame++) {
+        headlessSeconds = frame / options.fps;  // 时间只由帧号决定，每次运行结果相同
+        if (frame == options.clickFrame) {
+            mouse(GLUT_LEFT_BUTTON, GLUT_DOWN, options.width / 2, options.height / 2);
+        }
+        if (frame == options.specialFrame) {
+            mouse(GLUT_RIGHT_BUTTON, GLUT_DOWN, options.width / 2, options.height / 2);
+        }
+
+        auto frameStart = std::chrono::steady_clock::now();
+        display();
+        if (!options.software) glFinish();
+        renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+
+        if (!options.out.empty()) {
+            readFrame(options.width, options.height, pixels);
+            char name[32];
+            snprintf(name, sizeof(name), "%05d.", frame);
+            std::string path = options.out + name + options.format;
+            bool written = options.format == "png" ? writePNG(path, options.width, options.height, pixels)
+                                                   : writePPM(path, options.width, options.height, pixels);
+            if (!written) {
+                std::cerr << "Failed to write " << path << std::endl;
+                return 1;
+            }
+        }
+    }
+    double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << options.frames << " frames at " << options.width << "x" << options.height
+              << ": " << options.frames / renderSeconds << " FPS rendering, "
+              << options.frames / totalSeconds << " FPS including output, "
+              << renderer.drawCalls << " draw calls in the last frame" << std::endl;
+    return 0;
+}
@@ -0,0 +1,685 @@
+// 单元测试：与主程序共用同一份代码，只测不需要窗口的部分（装箱、排版、网格、脏矩形、随机数、
+// 缓存文件和软件光栅化）。有无窗口GL上下文时也测需要GL的部分，没有时字形图集改用软件光栅化生成
+//
+// 用法: CPT205_Tests [测试名的一部分]
+#define CPT205_NO_MAIN
+#define CPT205_HEADLESS
+#include "assessment-1-oop.cpp"
+#include <chrono>
+
+int failures = 0;
+bool haveGL = false;  // 有可用的GL上下文
+std::filesystem::path testDirectory;  // 测试写文件用的临时目录
+
+#define CHECK(condition) check(condition, #condition, __FILE__, __LINE__)
+
+void check(bool passed, const char* expression, const char* file, int line) {
+    if (passed) return;
+    std::cerr << file << ":" << line << ": check failed: " << expression << std::endl;
+    failures++;
+}
+
+std::string testPath(const char* name) {
+    return (testDirectory / name).string();
+}
+
+void writeFile(const std::string& path, const std::string& contents) {
+    std::ofstream out(path, std::ios::binary);
+    out << contents;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// 装进去的矩形都在范围内且互不重叠，放不下时返回false
+void testSkylinePacker() {
+    struct Placed { int x, y, w, h; };
+    std::vector<Placed> placed;
+    SkylinePacker packer(256, 256);
+    Random random(3);
+    for (int i = 0; i < 200; i++) {
+        int w = 4 + random.below(40), h = 4 + random.below(40), x = -1, y = -1;
+        if (!packer.insert(w, h, x, y)) continue;
+        CHECK(x >= 0 && y >= 0 && x + w <= 256 && y + h <= 256);
+        for (const Placed& other : placed) {
+            CHECK(x + w <= other.x || other.x + other.w <= x || y + h <= other.y || other.y + other.h <= y);
+        }
+        placed.push_back({x, y, w, h});
+    }
+    CHECK(placed.size() > 40);
+    int x, y;
+    CHECK(!packer.insert(257, 1, x, y));
+    CHECK(!SkylinePacker(16, 16).insert(8, 17, x, y));
+}
+
+bool sameLayout(const TextLayout& a, const TextLayout& b) {
+    const auto& linesA = a.layoutLines();
+    const auto& linesB = b.layoutLines();
+    const auto& glyphsA = a.layoutGlyphs();
+    const auto& glyphsB = b.layoutGlyphs();
+    if (linesA.size() != linesB.size() || glyphsA.size() != glyphsB.size()) return false;
+    for (size_t i = 0; i < linesA.size(); i++) {
+        if (linesA[i].x != linesB[i].x || linesA[i].y != linesB[i].y || linesA[i].first != linesB[i].first || linesA[i].count != linesB[i].count) return false;
+    }
+    for (size_t i = 0; i < glyphsA.size(); i++) {
+        if (glyphsA[i].c != glyphsB[i].c || glyphsA[i].x != glyphsB[i].x) return false;
+    }
+    return true;
+}
+
+// 改动一段后只重排这一段，结果与从头排版相同
+void testTextLayoutReflow() {
+    std::string source = "Title line\nThe first paragraph is long enough to wrap onto several lines of the letter.\n\nShort one\nLast paragraph";
+    TextLayout layout;
+    layout.update(source.c_str(), letterGlyphs, 200);
+    CHECK(layout.reflowCount == 5);
+    CHECK(layout.layoutLines().size() > 5);
+    for (const TextLayout::Line& line : layout.layoutLines()) {
+        float right = line.x;
+        for (int i = line.first; i < line.first + line.count; i++) {
+            right = layout.layoutGlyphs()[i].x + letterGlyphs.advance(layout.layoutGlyphs()[i].c);
+        }
+        CHECK(right <= 100 + 20);  // 最多多出一个字
+    }
+
+    layout.update(source.c_str(), letterGlyphs, 200);
+    CHECK(layout.reflowCount == 5);
+
+    source.replace(source.find("Short one"), 9, "Short two!");
+    layout.update(source.c_str(), letterGlyphs, 200);
+    CHECK(layout.reflowCount == 6);
+    TextLayout fresh;
+    fresh.update(source.c_str(), letterGlyphs, 200);
+    CHECK(sameLayout(layout, fresh));
+
+    layout.update(source.c_str(), letterGlyphs, 300);  // 宽度变了全部重排
+    CHECK(layout.reflowCount == 11);
+}
+
+// 查询结果与逐个检查所有实体相同，移动后也一样；超出网格的边界落在边缘的格子里
+void testSpatialGridQuery() {
+    const int COUNT = 300;
+    SpatialGrid grid(0, 0, 100, 6, 8);
+    grid.reset(COUNT);
+    std::vector<Bounds> bounds(COUNT);
+    Random random(5);
+    auto randomBounds = [&random]() {
+        float x = static_cast<float>(random.below(800)) - 100, y = static_cast<float>(random.below(1000)) - 100;
+        return Bounds{x, y, x + 1 + random.below(150), y + 1 + random.below(150)};
+    };
+    std::vector<int> found;
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < COUNT; i++) {
+            if (round == 0 || random.below(3) == 0) {
+                bounds[i] = randomBounds();
+                grid.move(i, bounds[i]);
+            }
+        }
+        for (int query = 0; query < 50; query++) {
+            Bounds view = randomBounds();
+            view.x1 += random.below(400);
+            grid.query(view, found);
+            std::vector<int> expected;
+            for (int i = 0; i < COUNT; i++) {
+                if (bounds[i].overlaps(view)) expected.push_back(i);
+            }
+            CHECK(found == expected);
+        }
+    }
+}
+
+// 脏矩形：第一帧和物体数量变化时整帧重画，没变化时没有矩形，移动时覆盖新旧位置
+void testDamageTrackerResolve() {
+    const GLint viewport[4] = {0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+    DamageTracker tracker;
+    std::vector<DamageTracker::Rect> rects;
+    auto report = [&tracker](float x, unsigned state) {
+        tracker.report(100, 100, 150, 150, 1);
+        tracker.report(x, 400, x + 20, 420, state);
+    };
+    report(300, 1);
+    CHECK(!tracker.resolve(viewport, rects));
+    report(300, 1);
+    CHECK(tracker.resolve(viewport, rects));
+    CHECK(rects.empty());
+
+    report(340, 1);
+    CHECK(tracker.resolve(viewport, rects));
+    auto covers = [&rects](int x, int y) {
+        for (const DamageTracker::Rect& rect : rects) {
+            if (x >= rect.x0 && x < rect.x1 && y >= rect.y0 && y < rect.y1) return true;
+        }
+        return false;
+    };
+    CHECK(!rects.empty());
+    CHECK(covers(300, 400) && covers(319, 419) && covers(340, 400) && covers(359, 419));
+    CHECK(!covers(120, 120));
+    long long area = 0;
+    for (const DamageTracker::Rect& rect : rects) area += rect.area();
+    CHECK(area < static_cast<long long>(WINDOW_WIDTH) * WINDOW_HEIGHT / 10);
+
+    report(340, 2);  // 只有状态变了
+    CHECK(tracker.resolve(viewport, rects));
+    CHECK(covers(345, 405) && !covers(120, 120));
+
+    tracker.report(0, 0, 10, 10, 0);
+    CHECK(!tracker.resolve(viewport, rects));
+    tracker.report(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, 1);  // 受损面积太大
+    CHECK(!tracker.resolve(viewport, rects));
+
+    for (int i = 0; i < 20; i++) tracker.report(i * 30.0f, i * 40.0f, i * 30.0f + 5, i * 40.0f + 5, 0);
+    tracker.resolve(viewport, rects);
+    for (int i = 0; i < 20; i++) tracker.report(i * 30.0f, i * 40.0f, i * 30.0f + 5, i * 40.0f + 5, 1);
+    CHECK(tracker.resolve(viewport, rects));
+    CHECK(rects.size() <= DamageTracker::MAX_RECTS);
+}
+
+// 各指令集的批量生成与标量版本逐位相同，长度不是通道数的倍数时也一样
+void testRandomKernels() {
+    std::vector<RandomKernel> kernels = availableRandomKernels();
+    for (int count : {1, RANDOM_LANES, 1001, 4096}) {
+        std::vector<float> first(count), second(count), out(count);
+        Random reference(7);
+        reference.fill(first.data(), count, kernels[0].fill);
+        reference.fill(second.data(), count, kernels[0].fill);
+        for (const RandomKernel& kernel : kernels) {
+            Random random(7);
+            random.fill(out.data(), count, kernel.fill);
+            CHECK(out == first);
+            random.fill(out.data(), count, kernel.fill);  // 之后的通道状态也相同
+            CHECK(out == second);
+        }
+        for (float value : first) CHECK(value >= 0.0f && value < 1.0f);
+    }
+    Random a(11), b(11), c(12);
+    bool differs = false;
+    for (int i = 0; i < 16; i++) {
+        uint32_t x = a.next();
+        CHECK(x == b.next());
+        differs = differs || x != c.next();
+    }
+    CHECK(differs);
+}
+
+// 5x3的PPM，mip链是5x3、2x1、1x1
+std::string testPPM(unsigned char seed) {
+    std::string ppm = "P6\n# test\n5 3\n255\n";
+    for (int i = 0; i < 5 * 3 * 3; i++) ppm.push_back(static_cast<char>(seed + i * 5));
+    return ppm;
+}
+
+// 按预算分块上传：传完之前ready为false，读回的像素与源文件相同；
+// 删除纹理后名字被新的请求复用时，新请求传完之前也不算完成
+void testTextureUploader() {
+    if (!haveGL) {
+        std::cout << "  skipped: needs a GL context" << std::endl;
+        return;
+    }
+    std::string source = testPath("upload.ppm");
+    std::string ppm = "P6 7 5 255\n";  // 每行21字节，不是4的倍数
+    for (int i = 0; i < 7 * 5 * 3; i++) ppm.push_back(static_cast<char>(i * 7));
+    writeFile(source, ppm);
+
+    TextureUploader uploader;
+    GLuint texture = uploader.request(source.c_str());
+    CHECK(texture != 0 && !uploader.ready(texture) && uploader.busy());
+    uploader.pump(21 * 2);
+    CHECK(!uploader.ready(texture));
+    uploader.finish();
+    CHECK(uploader.ready(texture) && !uploader.busy());
+
+    std::vector<unsigned char> pixels(7 * 5 * 3);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    glPopClientAttrib();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CHECK(std::equal(pixels.begin(), pixels.end(), reinterpret_cast<const unsigned char*>(ppm.data()) + ppm.size() - pixels.size()));
+
+    glDeleteTextures(1, &texture);
+    GLuint reused = uploader.request(source.c_str());
+    CHECK(reused != 0 && !uploader.ready(reused));
+    uploader.finish();
+    CHECK(uploader.ready(reused));
+    glDeleteTextures(1, &reused);
+    CHECK(uploader.request(testPath("missing.ppm").c_str()) == 0);
+}
+
+// 内容相同的文件共用一块区域，内容不同的（包括字节相同但尺寸不同的）各自装箱
+void testTextureCache() {
+    if (!haveGL) {
+        std::cout << "  skipped: needs a GL context" << std::endl;
+        return;
+    }
+    std::string pixels(12 * 3, '\x40');
+    writeFile(testPath("a.ppm"), "P6 4 3 255\n" + pixels);
+    writeFile(testPath("b.ppm"), "P6 4 3 255\n" + pixels);
+    writeFile(testPath("c.ppm"), "P6 3 4 255\n" + pixels);
+    pixels[5] = 1;
+    writeFile(testPath("d.ppm"), "P6 4 3 255\n" + pixels);
+
+    TextureCache cache;
+    TextureRegion a = cache.get(testPath("a.ppm").c_str());
+    TextureRegion b = cache.get(testPath("b.ppm").c_str());
+    TextureRegion c = cache.get(testPath("c.ppm").c_str());
+    TextureRegion d = cache.get(testPath("d.ppm").c_str());
+    CHECK(a.texture != 0 && a.width == 4 && a.height == 3);
+    CHECK(b.texture == a.texture && b.u0 == a.u0 && b.v0 == a.v0);
+    CHECK(c.texture == a.texture && c.width == 3 && (c.u0 != a.u0 || c.v0 != a.v0));
+    CHECK(d.u0 != a.u0 || d.v0 != a.v0);
+    CHECK(cache.atlasCount() == 1 && cache.textureCount() == 1);
+    CHECK(cache.get(testPath("missing.ppm").c_str()).texture == 0);
+}
+
+bool validTextureAt(const std::string& path, const std::string& source) {
+    MappedFile file;
+    return file.open(path.c_str()) && validTextureFile(file, source.c_str());
+}
+
+void testTextureFile() {
+    std::string source = testPath("image.ppm"), target = testPath("image.ppm.ctex");
+    writeFile(source, testPPM(10));
+    CHECK(convertPPMToTextureFile(source.c_str(), target.c_str(), false));
+    {
+        MappedFile file;
+        CHECK(file.open(target.c_str()) && validTextureFile(file, source.c_str()));
+        TextureFileHeader header;
+        memcpy(&header, file.data(), sizeof(header));
+        CHECK(header.format == TEXTURE_RGBA8 && header.width == 5 && header.height == 3 && header.levels == 3);
+        TextureFileLevel levels[3];
+        memcpy(levels, file.data() + sizeof(header), sizeof(levels));
+        CHECK(levels[1].width == 2 && levels[1].height == 1 && levels[2].width == 1 && levels[2].height == 1);
+        std::string ppm = testPPM(10);
+        const unsigned char* pixels = reinterpret_cast<const unsigned char*>(ppm.data()) + ppm.size() - 5 * 3 * 3;
+        bool same = levels[0].size == 5 * 3 * 4;
+        for (int i = 0; i < 5 * 3 && same; i++) {
+            const unsigned char* texel = file.data() + levels[0].offset + i * 4;
+            same = std::equal(texel, texel + 3, pixels + i * 3) && texel[3] == 255;
+        }
+        CHECK(same);
+    }
+
+    std::string contents = readFile(target);
+    std::string broken = testPath("broken.ctex");
+    writeFile(broken, contents.substr(0, contents.size() - 24));  // 截断
+    CHECK(!validTextureAt(broken, source));
+    std::string wrongVersion = contents;
+    wrongVersion[4] = 99;
+    writeFile(broken, wrongVersion);
+    CHECK(!validTextureAt(broken, source));
+    // 目录里的字节数或尺寸与格式不符时不能用，否则上传会读出映射范围
+    auto changeLevel = [&](int index, auto change) {
+        std::string changed = contents;
+        TextureFileLevel level;
+        size_t at = sizeof(TextureFileHeader) + sizeof(level) * index;
+        memcpy(&level, &changed[at], sizeof(level));
+        change(level);
+        memcpy(&changed[at], &level, sizeof(level));
+        writeFile(broken, changed);
+        return validTextureAt(broken, source);
+    };
+    CHECK(changeLevel(1, [](TextureFileLevel&) {}));
+    CHECK(!changeLevel(0, [](TextureFileLevel& level) { level.size -= 4; }));
+    CHECK(!changeLevel(1, [](TextureFileLevel& level) { level.size += 4; }));
+    CHECK(!changeLevel(1, [](TextureFileLevel& level) { level.width = 3; }));
+    CHECK(!changeLevel(2, [](TextureFileLevel& level) { level.height = 2; }));
+
+    if (haveGL && glCompressedTexImage2DPtr != nullptr) {
+        CHECK(convertPPMToTextureFile(source.c_str(), target.c_str(), true));
+        MappedFile file;
+        CHECK(file.open(target.c_str()) && validTextureFile(file, source.c_str()));
+        TextureFileLevel level;
+        memcpy(&level, file.data() + sizeof(TextureFileHeader), sizeof(level));
+        CHECK(level.size == 2 * 1 * 8);  // 5x3是2x1个块
+    }
+
+    writeFile(source, testPPM(10) + " ");  // 源文件变了，缓存过期
+    CHECK(!validTextureAt(target, source));
+
+    // 缓存写不进去（这里缓存路径是一个非空的目录）时仍然用转换的结果加载
+    if (haveGL) {
+        std::string readOnly = testPath("readonly.ppm");
+        writeFile(readOnly, testPPM(20));
+        std::filesystem::create_directories(readOnly + ".ctex");
+        writeFile(readOnly + ".ctex/keep", "");
+        GLuint texture = loadCachedTexture(readOnly.c_str());
+        CHECK(texture != 0);
+        GLint width = 0;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 2, GL_TEXTURE_WIDTH, &width);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        CHECK(width == 1);
+        glDeleteTextures(1, &texture);
+        CHECK(!std::filesystem::exists(readOnly + ".ctex.tmp"));
+    }
+}
+
+const char* TEST_SCENE =
+        "seed 3\n"
+        "stars 5  # 随机\n"
+        "cloud 10 20 30 40\n"
+        "tree 100 50\n"
+        "banner 300 -100 1 0 0\n"
+        "balloons 4\n"
+        "flowers 3\n"
+        "flower 50 60\n"
+        "fireworks 2\n";
+
+bool validSceneAt(const std::string& path, const std::string& source) {
+    MappedFile file;
+    return file.open(path.c_str()) && validSceneFile(file.data(), file.size(), source.c_str());
+}
+
+// 每段的内容与解析结果相同，同一个源文件总是编译出同样的字节；坏文件和坏源文件都被拒绝；缓存写不进去也能加载
+void testSceneFile() {
+    std::string source = testPath("test.scene"), target = testPath("test.scene.cscene");
+    writeFile(source, TEST_SCENE);
+    SceneSource scene;
+    CHECK(parseSceneText(source.c_str(), scene));
+    CHECK(scene.stars.size() == 5 && scene.clouds.size() == 1 && scene.trees.size() == 1);
+    CHECK(scene.balloonTransforms.size() == 5 && scene.flowerTransforms.size() == 4 && scene.fireworks == 2 && scene.bannerBalloon == 0);
+
+    CHECK(compileSceneFile(source.c_str(), target.c_str()));
+    std::string contents = readFile(target);
+    {
+        MappedFile file;
+        CHECK(file.open(target.c_str()) && validSceneFile(file.data(), file.size(), source.c_str()));
+        SceneFileHeader header;
+        memcpy(&header, file.data(), sizeof(header));
+        CHECK(header.fireworks == 2 && header.bannerBalloon == 0 && header.sections == 9);
+        auto same = [&file](const SceneFileSection& section, const auto& items) {
+            return section.count == items.size() && memcmp(file.data() + section.offset, items.data(), section.size) == 0;
+        };
+        for (uint32_t i = 0; i < header.sections; i++) {
+            SceneFileSection section = sceneSection(file.data(), i);
+            bool balloon = section.kind == SHAPE_BALLOON;
+            switch (section.content) {
+            case SCENE_STARS: CHECK(same(section, scene.stars)); break;
+            case SCENE_CLOUDS: CHECK(same(section, scene.clouds)); break;
+            case SCENE_TREES: CHECK(same(section, scene.trees)); break;
+            default:
+                switch (section.component) {
+                case COMPONENT_TRANSFORM: CHECK(same(section, balloon ? scene.balloonTransforms : scene.flowerTransforms)); break;
+                case COMPONENT_MOTION: CHECK(same(section, scene.balloonMotions)); break;
+                case COMPONENT_COLOUR: CHECK(same(section, scene.balloonColours)); break;
+                case COMPONENT_SHAPE: CHECK(same(section, scene.balloonShapes)); break;
+                default: CHECK(same(section, scene.flowerLifetimes)); break;
+                }
+            }
+        }
+    }
+    CHECK(compileSceneFile(source.c_str(), target.c_str()));
+    CHECK(readFile(target) == contents);
+
+    std::string broken = testPath("broken.cscene");
+    writeFile(broken, contents.substr(0, contents.size() - 32));
+    CHECK(!validSceneAt(broken, source));
+    std::string changed = contents;
+    changed[4] = 99;  // 版本
+    writeFile(broken, changed);
+    CHECK(!validSceneAt(broken, source));
+    changed = contents;
+    changed[16] = 50;  // 横幅气球超出范围
+    writeFile(broken, changed);
+    CHECK(!validSceneAt(broken, source));
+
+    std::string invalid = testPath("invalid.scene");
+    SceneSource ignored;
+    writeFile(invalid, "balloon 1 2\n");
+    CHECK(!parseSceneText(invalid.c_str(), ignored));
+    writeFile(invalid, "stars 5\n");  // 没有横幅气球
+    CHECK(!parseSceneText(invalid.c_str(), ignored));
+
+    writeFile(source, std::string(TEST_SCENE) + "stars 1\n");
+    CHECK(!validSceneAt(target, source));
+
+    // 缓存写不进去时仍然用编译的结果加载（会改动全局的场景，只在这里做一次）
+    std::string readOnly = testPath("readonly.scene");
+    writeFile(readOnly, TEST_SCENE);
+    std::filesystem::create_directories(readOnly + ".cscene");
+    writeFile(readOnly + ".cscene/keep", "");
+    size_t treeCount = trees.size();
+    CHECK(loadCachedScene(readOnly.c_str()));
+    CHECK(sceneLoaded && trees.size() == treeCount + 1);
+    CHECK(!std::filesystem::exists(readOnly + ".cscene.tmp"));
+}
+
+// 编译或链接失败时着色器和程序对象都被释放。着色器和程序共用一套名字，紧接着探测用的程序之后创建的名字一个都不应留下
+void testShaderFailureCleanup() {
+    if (!haveGL || glCreateShaderPtr == nullptr) {
+        std::cout << "  skipped: needs shaders" << std::endl;
+        return;
+    }
+    typedef GLboolean (APIENTRY* GLIsObjectFn)(GLuint object);
+    GLIsObjectFn isShader = reinterpret_cast<GLIsObjectFn>(getGLProcAddress("glIsShader"));
+    GLIsObjectFn isProgram = reinterpret_cast<GLIsObjectFn>(getGLProcAddress("glIsProgram"));
+    const char* vertex = "void main() { gl_Position = gl_Vertex; }";
+    const char* fragments[2] = {"void main() { gl_FragColor = broken; }",  // 编译失败
+                                "void helper(); void main() { helper(); gl_FragColor = vec4(1.0); }"};  // 链接失败
+    for (const char* fragment : fragments) {
+        GLuint probe = glCreateProgramPtr();
+        glDeleteProgramPtr(probe);
+        CHECK(compileProgram(vertex, fragment, nullptr) == 0);
+        for (GLuint name = probe + 1; name <= probe + 3; name++) {
+            CHECK(!isShader(name) && !isProgram(name));
+        }
+    }
+}
+
+// 描边宽度超过距离场能表示的范围时只截掉多出的部分，离笔画比SPREAD还远的像素保持背景色，
+// 不会把整个字形四边形画成半透明的描边颜色
+void testSDFOutlineLimit() {
+    if (!haveGL || !bannerFont.ready()) {
+        std::cout << "  skipped: needs shaders" << std::endl;
+        return;
+    }
+    const int SIZE = 128;
+    glViewport(0, 0, SIZE, SIZE);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, SIZE, 0, SIZE, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    renderer.color(0.0f, 0.0f, 1.0f);
+    bannerFont.draw(".", 50, 50, 1.0f, 40.0f, 1.0f, 1.0f, 1.0f);  // 描边宽度远超SPREAD
+    renderer.flush();
+    std::vector<unsigned char> pixels(SIZE * SIZE * 4);
+    glReadPixels(0, 0, SIZE, SIZE, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glDisable(GL_BLEND);
+
+    // 描边是以笔画为中心的圆盘，它的中心就是笔画的位置
+    float cx = 0, cy = 0;
+    int fill = 0;
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            const unsigned char* p = &pixels[(y * SIZE + x) * 4];
+            if (p[0] == 255) {
+                cx += x;
+                cy += y;
+                fill++;
+            }
+        }
+    }
+    CHECK(fill > 0);
+    if (fill == 0) return;
+    cx /= fill;
+    cy /= fill;
+    int outline = 0, far = 0;  // 描边以内没画满的像素，远处画了东西的像素
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            const unsigned char* p = &pixels[(y * SIZE + x) * 4];
+            float distance = std::hypot(x - cx, y - cy);
+            if (distance > SDFFont::SPREAD + 6 && p[0] != 0) far++;
+            if (distance > 8 && distance < SDFFont::maxOutline(1.0f) && p[0] != 255) outline++;
+        }
+    }
+    CHECK(far == 0);
+    CHECK(outline == 0);  // 笔画（半径几个单位的点）以外、最宽的描边以内都画满了
+}
+
+// 图层缓存合成半透明内容的结果与直接绘制相同（颜色不会被alpha乘两次），读回alpha后不改动像素存储状态
+void testLayerCacheComposite() {
+    if (!haveGL || glGenFramebuffersPtr == nullptr || glBlendFuncSeparatePtr == nullptr) {
+        std::cout << "  skipped: needs framebuffer objects" << std::endl;
+        return;
+    }
+    glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.2f, 0.4f, 0.8f, 1.0f);
+    auto render = [] {
+        renderer.color(1.0f, 0.5f, 0.0f, 0.5f);  // 两个半透明矩形部分重叠，还有一个不透明的
+        renderer.begin(GL_QUADS);
+        renderer.vertex(30, 30);
+        renderer.vertex(150, 30);
+        renderer.vertex(150, 110);
+        renderer.vertex(30, 110);
+        renderer.end();
+        renderer.color(0.0f, 1.0f, 0.5f, 0.25f);
+        renderer.begin(GL_QUADS);
+        renderer.vertex(90, 70);
+        renderer.vertex(210, 70);
+        renderer.vertex(210, 170);
+        renderer.vertex(90, 170);
+        renderer.end();
+        renderer.color(0.9f, 0.1f, 0.1f);
+        renderer.begin(GL_QUADS);
+        renderer.vertex(256, 32);
+        renderer.vertex(320, 32);
+        renderer.vertex(320, 96);
+        renderer.vertex(256, 96);
+        renderer.end();
+        renderer.flush();
+    };
+    std::vector<unsigned char> direct(WINDOW_WIDTH * WINDOW_HEIGHT * 4), cached(direct.size());
+    glClear(GL_COLOR_BUFFER_BIT);
+    render();
+    glReadPixels(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, direct.data());
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 8);
+    LayerCache layer;
+    glClear(GL_COLOR_BUFFER_BIT);
+    CHECK(layer.draw(0, render));
+    renderer.flush();
+    GLint alignment = 0;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+    CHECK(alignment == 8);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, cached.data());
+    layer.invalidate();
+    glDisable(GL_BLEND);
+
+    int worst = 0;
+    for (size_t i = 0; i < direct.size(); i++) {
+        if (i % 4 != 3) worst = std::max(worst, std::abs(direct[i] - cached[i]));
+    }
+    CHECK(worst <= 2);  // 只有舍入误差
+}
+
+// 按三角形扇形画一个半透明的多边形：共用的边上的像素只画一次，所以盖住的像素颜色都相同，
+// 盖住的像素数与多边形面积相差不超过边长
+void testRasterizerCoverage() {
+    SoftwareRasterizer raster;
+    raster.resize(150, 130);  // 不是图块边长的倍数
+    const unsigned char black[4] = {0, 0, 0, 255};
+    raster.clear(black);
+    std::vector<Vertex> vertices;
+    const int SIDES = 17;
+    float cx = 70.3f, cy = 61.7f, radius = 55;
+    for (int i = 0; i < SIDES; i++) {
+        float a0 = static_cast<float>(2 * TABLE_PI * i / SIDES), a1 = static_cast<float>(2 * TABLE_PI * (i + 1) / SIDES);
+        vertices.push_back({cx, cy, 255, 255, 255, 128, 0, 0});
+        vertices.push_back({cx + radius * std::cos(a0), cy + radius * std::sin(a0), 255, 255, 255, 128, 0, 0});
+        vertices.push_back({cx + radius * std::cos(a1), cy + radius * std::sin(a1), 255, 255, 255, 128, 0, 0});
+    }
+    // 再画一个正好铺满[20, 40)x[100, 120)的正方形，两个三角形沿对角线相接
+    const Vertex quad[6] = {{20, 100, 0, 255, 0, 255, 0, 0}, {40, 100, 0, 255, 0, 255, 0, 0}, {40, 120, 0, 255, 0, 255, 0, 0},
+                            {20, 100, 0, 255, 0, 255, 0, 0}, {40, 120, 0, 255, 0, 255, 0, 0}, {20, 120, 0, 255, 0, 255, 0, 0}};
+    vertices.insert(vertices.end(), quad, quad + 6);
+    raster.drawTriangles(vertices.data(), static_cast<int>(vertices.size()), SoftwareRasterizer::Transform(), 0);
+    raster.finish();
+
+    std::vector<unsigned char> pixels(150 * 130 * 4);
+    raster.read(pixels.data());
+    int covered = 0, green = 0, other = 0;
+    unsigned char grey = 0;
+    for (int y = 0; y < 130; y++) {
+        for (int x = 0; x < 150; x++) {
+            const unsigned char* p = &pixels[(y * 150 + x) * 4];
+            if (p[0] == 0 && p[1] == 255 && p[2] == 0) {
+                green++;
+                CHECK(x >= 20 && x < 40 && y >= 100 && y < 120);
+            } else if (p[0] != 0) {
+                if (grey == 0) grey = p[0];
+                if (p[0] != grey || p[1] != grey || p[2] != grey) other++;
+                covered++;
+            }
+        }
+    }
+    CHECK(green == 20 * 20);
+    CHECK(other == 0);
+    CHECK(grey >= 127 && grey <= 129);
+    float area = static_cast<float>(SIDES * 0.5 * radius * radius * std::sin(2 * TABLE_PI / SIDES));
+    float perimeter = static_cast<float>(SIDES * 2 * radius * std::sin(TABLE_PI / SIDES));
+    CHECK(std::abs(covered - area) < perimeter);
+}
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+const Test TESTS[] = {
+        {"SkylinePacker", testSkylinePacker},
+        {"TextLayoutReflow", testTextLayoutReflow},
+        {"SpatialGridQuery", testSpatialGridQuery},
+        {"DamageTrackerResolve", testDamageTrackerResolve},
+        {"RandomKernels", testRandomKernels},
+        {"TextureUploader", testTextureUploader},
+        {"TextureCache", testTextureCache},
+        {"TextureFile", testTextureFile},
+        {"SceneFile", testSceneFile},
+        {"ShaderFailureCleanup", testShaderFailureCleanup},
+        {"SDFOutlineLimit", testSDFOutlineLimit},
+        {"LayerCacheComposite", testLayerCacheComposite},
+        {"RasterizerCoverage", testRasterizerCoverage},
+};
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : "";
+    haveGL = createHeadlessContext(WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (haveGL) {
+        renderer.init();
+    } else {
+        std::cout << "No headless GL context, glyph atlas uses the software rasterizer" << std::endl;
+        renderer.useSoftware(WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+    testDirectory = std::filesystem::temp_directory_path() /
+                    ("cpt205-tests-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::filesystem::create_directories(testDirectory);
+
+    int run = 0;
+    for (const Test& test : TESTS) {
+        if (std::string(test.name).find(filter) == std::string::npos) continue;
+        int before = failures;
+        test.run();
+        run++;
+        std::cout << (failures == before ? "PASS " : "FAIL ") << test.name << std::endl;
+    }
+    std::error_code error;
+    std::filesystem::remove_all(testDirectory, error);
+    std::cout << run << " tests, " << failures << " failed checks" << std::endl;
+    return failures == 0 && run > 0 ? 0 : 1;
+}